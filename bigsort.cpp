@@ -1,18 +1,93 @@
 #include <iostream>
 #include <vector>
 #include <cstdlib>      // For exit()
-#include <algorithm>    // For std::max_element and std::shuffle
+#include <algorithm>    // For std::minmax_element, std::sort and std::shuffle
+#include <functional>   // For std::greater
 #include <chrono>       // For high-resolution timing
 #include <random>       // For random number generation
+#include <cstdint>      // For fixed-width bitmap words
+#include <cstddef>      // For size_t
+#include <iterator>     // For PresenceIndex iterator tags
+#include <thread>       // For the parallel sort mode
+#include <unordered_map> // For 2-bit counter overflow
+#include <cmath>        // For the planner cost model
+#include <array>        // For fixed-size narrow-key bitmaps
+#include <limits>       // For key type ranges
+#include <type_traits>  // For key type traits
+#include <span>         // For the zero-copy sort API (C++20)
+#include <cstring>      // For std::memcpy
+#include <cstdio>       // For sequential file I/O
+#include <string>       // For file paths
+#include <string_view>  // For IntegerParser
+#include <fcntl.h>      // For open() in file mode
+#include <sys/mman.h>   // For mmap() / madvise() in file mode
+#include <sys/stat.h>   // For fstat()
+#include <unistd.h>     // For ftruncate() / close()
+#include <sstream>      // For the SortStats JSON dump
+#include <charconv>     // For std::to_chars in IntegerWriter
+#include <mutex>        // For the pipelined driver's ring
+#include <atomic>       // For bitmap allocation accounting
+#include <condition_variable>
+#include <memory>       // For shared mappings of loaded indexes
+#include <cerrno>       // For EINTR in the TCP transport
+#include <sys/socket.h> // For the distributed mode's TCP transport
+#include <netdb.h>      // For getaddrinfo()
+#include <netinet/in.h>
+#include <netinet/tcp.h> // For TCP_NODELAY
+#ifdef BIGSORT_WITH_MPI
+#define OMPI_SKIP_MPICXX 1  // C API only.
+#define MPICH_SKIP_MPICXX 1
+#include <mpi.h>        // For the MPI transport
+#endif
+#if defined(__linux__)
+#include <linux/perf_event.h>  // For hardware counters in SortStats
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>  // For NUMA interleaving of the bitmap
+#endif
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define BIGSORT_X86_DISPATCH 1
+#include <immintrin.h>  // For AVX2 / AVX-512 bitmap kernels
+#endif
+
+// ============================================================
+// Function: parallelFor
+// ------------------------------------------------------------
+// Role: Splits [0, count) into one contiguous range per thread
+//       and runs body(begin, end, threadIndex) on each, using the
+//       calling thread for the first range. Returns once every
+//       range is done. With threads <= 1 the body runs inline.
+// ============================================================
+template <typename Body>
+void parallelFor(unsigned threads, size_t count, Body body) {
+    if (threads <= 1 || count <= 1) {
+        body(size_t(0), count, 0u);
+        return;
+    }
+    if (threads > count) threads = static_cast<unsigned>(count);
+    std::vector<std::thread> workers;
+    workers.reserve(threads - 1);
+    size_t chunk = (count + threads - 1) / threads;
+    for (unsigned t = 1; t < threads; ++t) {
+        size_t begin = std::min(count, t * chunk);
+        size_t end = std::min(count, begin + chunk);
+        workers.emplace_back([=] { body(begin, end, t); });
+    }
+    body(size_t(0), std::min(count, chunk), 0u);
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
 
 // ============================================================
 // Class: RandomArrayGenerator
 // ------------------------------------------------------------
-// Role: Provides a static method to generate a unique random
-//       array (vector) of integers within a specified range.
-//       This class encapsulates the logic for creating and
-//       shuffling a full range of numbers, then selecting the
-//       desired count.
+// Role: Provides static methods to generate random arrays of
+//       integers within a specified range: unique values for the
+//       interactive demo, and seedable dense, sparse, clustered or
+//       Zipfian inputs for benchmarks. Memory is O(size) whatever
+//       the range, and large arrays are filled in parallel.
 // ============================================================
 class RandomArrayGenerator {
 public:
@@ -25,143 +100,7165 @@ public:
     //   - maxValue: The maximum possible value in the range.
     //
     // Returns:
-    //   A vector of integers of the given size, containing unique
-    //   random values from [minValue, maxValue].
+    //   A vector of integers of the given size, containing unique
+    //   random values from [minValue, maxValue].
+    //
+    // Flow:
+    //   1. Check if the range is sufficient for the requested size.
+    //      The range is counted in the unsigned key type, so any
+    //      [minValue, maxValue] of a 64-bit Key is measured exactly.
+    //   2. Draw 'size' distinct values with generate(Sparse) from a
+    //      random seed, in O(size) memory.
+    // ------------------------------------------------------------
+    template <typename Key = int64_t>
+    static std::vector<Key> generateUniqueRandomArray(size_t size, Key minValue, Key maxValue) {
+        if (maxValue < minValue || (size > 0 && size - 1 > rangeMaxOffset(minValue, maxValue))) {
+            std::cerr << "Error: Array size cannot be larger than the number of unique values in the range.\n";
+            exit(1);
+        }
+
+        // Step 2: Sample without replacement from a fresh seed.
+        std::random_device rd;
+        uint64_t seed = (static_cast<uint64_t>(rd()) << 32) | rd();
+        return generate<Key>(size, minValue, maxValue, Distribution::Sparse, seed);
+    }
+
+    // ------------------------------------------------------------
+    // Method: rangeMaxOffset
+    // ------------------------------------------------------------
+    // Returns:
+    //   maxValue - minValue, computed without overflow: the range
+    //   [minValue, maxValue] holds rangeMaxOffset() + 1 values,
+    //   which is 2^64 (not representable) only for the full range
+    //   of a 64-bit Key. Requires minValue <= maxValue.
+    // ------------------------------------------------------------
+    template <typename Key>
+    static unsigned long long rangeMaxOffset(Key minValue, Key maxValue) {
+        using UKey = std::make_unsigned_t<Key>;
+        return static_cast<UKey>(static_cast<UKey>(maxValue) - static_cast<UKey>(minValue));
+    }
+
+    // ------------------------------------------------------------
+    // Enum: Distribution
+    // ------------------------------------------------------------
+    //   - Dense:     A shuffled block of consecutive values starting
+    //                at minValue (every slot of its span is used).
+    //   - Sparse:    Unique values drawn uniformly from the whole
+    //                [minValue, maxValue] range.
+    //   - Clustered: Unique values packed at 50% density into
+    //                kClusters runs spread evenly over the range.
+    //   - Zipf:      Values with repeats; the r-th most popular key
+    //                appears with probability ~ 1/r, and popular
+    //                keys are scattered over the range.
+    // ------------------------------------------------------------
+    enum class Distribution { Dense, Sparse, Clustered, Zipf };
+
+    static constexpr size_t kClusters = 64;
+
+    // ------------------------------------------------------------
+    // Method: generate
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - size:         Number of values to generate.
+    //   - minValue:     The minimum possible value in the range.
+    //   - maxValue:     The maximum possible value in the range.
+    //   - distribution: Shape of the values (see Distribution).
+    //   - seed:         The same seed gives the same array, whatever
+    //                   the thread count.
+    //   - threads:      Worker threads; 0 uses every hardware thread.
+    //
+    // Returns:
+    //   A vector of 'size' values in [minValue, maxValue], in random
+    //   order. Memory is O(size) whatever the range.
+    //
+    // Flow:
+    //   Element i is a pure function of (seed, i) (see Sampler), so
+    //   each thread fills its own contiguous slice of the output.
+    // ------------------------------------------------------------
+    template <typename Key = int>
+    static std::vector<Key> generate(size_t size, Key minValue, Key maxValue, Distribution distribution,
+                                     uint64_t seed, unsigned threads = 0) {
+        Sampler<Key> sampler(size, minValue, maxValue, distribution, seed);
+
+        // Fill the output, one contiguous slice per thread.
+        std::vector<Key> values(size);
+        unsigned workers = threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+        if (size < (size_t(1) << 16)) workers = 1;
+        parallelFor(workers, size, [&](size_t begin, size_t end, unsigned) {
+            sampler.fill(values.data() + begin, begin, end - begin);
+        });
+        return values;
+    }
+
+private:
+    // SplitMix64 finalizer: a fast, well-mixed 64-bit hash.
+    static uint64_t splitMix64(uint64_t x) {
+        x += 0x9e3779b97f4a7c15ULL;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+
+    // ------------------------------------------------------------
+    // Class: FeistelPermutation
+    // ------------------------------------------------------------
+    // Role: Keyed bijection of [0, maxIndex]. A balanced Feistel
+    //       network permutes the smallest even number of bits that
+    //       covers maxIndex, and cycle-walking re-applies it until
+    //       the value lands back in range (fewer than 4 rounds of
+    //       walking on average, since the bit domain is < 4x the
+    //       range).
+    // ------------------------------------------------------------
+    class FeistelPermutation {
+    public:
+        static constexpr int kRounds = 4;
+
+        FeistelPermutation(uint64_t maxIndex, uint64_t seed) : limit(maxIndex), halfBits(0), halfMask(0) {
+            int bits = limit ? 64 - __builtin_clzll(limit) : 0;
+            halfBits = (bits + 1) / 2;
+            halfMask = halfBits ? (~uint64_t(0) >> (64 - halfBits)) : 0;
+            for (int round = 0; round < kRounds; ++round) {
+                roundKeys[round] = splitMix64(seed + static_cast<uint64_t>(round) * 0x632be59bd9b4e019ULL);
+            }
+        }
+
+        uint64_t operator()(uint64_t index) const {
+            if (!halfBits) return index;
+            do {
+                uint64_t left = index >> halfBits;
+                uint64_t right = index & halfMask;
+                for (int round = 0; round < kRounds; ++round) {
+                    uint64_t mixed = left ^ (splitMix64(right ^ roundKeys[round]) & halfMask);
+                    left = right;
+                    right = mixed;
+                }
+                index = (left << halfBits) | right;
+            } while (index > limit);
+            return index;
+        }
+
+    private:
+        uint64_t limit;                              // Largest index in the domain.
+        int halfBits;                                // Bits per Feistel half.
+        uint64_t halfMask;                           // Mask of one half.
+        std::array<uint64_t, kRounds> roundKeys{};   // Per-round keys from the seed.
+    };
+
+public:
+    // ------------------------------------------------------------
+    // Class: Sampler
+    // ------------------------------------------------------------
+    // Role: The per-element rule behind generate(). Element i of an
+    //       array is a pure function of (seed, i), so any slice can
+    //       be drawn on its own, e.g. chunk by chunk by a pipeline
+    //       producer, and still match generate() exactly.
+    //
+    // Flow:
+    //   1. Unique distributions take i through a keyed Feistel
+    //      permutation of [0, D), a bijection, so no two elements
+    //      collide and nothing has to be remembered or rejected.
+    //   2. Zipf draws its popularity rank from a counter-based
+    //      hash of i and scatters ranks with the same permutation.
+    // ------------------------------------------------------------
+    template <typename Key>
+    class Sampler {
+    public:
+        using UKey = std::make_unsigned_t<Key>;
+
+        Sampler(size_t size, Key minValue, Key maxValue, Distribution distribution, uint64_t seed)
+            : base(static_cast<UKey>(minValue)), shape(distribution), clusterWidth(0), clusterPitch(0),
+              permute(domainFor(size, minValue, maxValue, distribution, clusterWidth, clusterPitch), seed),
+              zipfKey(splitMix64(seed ^ 0x5a17f00dULL)) {
+            maxOffset = static_cast<UKey>(static_cast<UKey>(maxValue) - static_cast<UKey>(minValue));
+            zipfLogRange = std::log(static_cast<double>(maxOffset) + 2.0);
+        }
+
+        Key operator()(size_t i) const {
+            uint64_t offset;
+            if (shape == Distribution::Zipf) {
+                // Continuous s = 1 Zipf: rank = floor((D + 1)^u), u in [0, 1).
+                double u = static_cast<double>(splitMix64(zipfKey + i) >> 11) * 0x1.0p-53;
+                double rank = std::floor(std::exp(u * zipfLogRange));
+                uint64_t r = rank >= static_cast<double>(maxOffset) + 1.0 ? maxOffset
+                                                                           : static_cast<uint64_t>(rank) - 1;
+                offset = permute(r);
+            } else if (clusterWidth) {
+                uint64_t slot = permute(i);
+                offset = (slot / clusterWidth) * clusterPitch + slot % clusterWidth;
+            } else {
+                offset = permute(i);
+            }
+            return static_cast<Key>(static_cast<UKey>(base + static_cast<UKey>(offset)));
+        }
+
+        // Writes elements [first, first + count) to out.
+        void fill(Key* out, size_t first, size_t count) const {
+            for (size_t j = 0; j < count; ++j) out[j] = (*this)(first + j);
+        }
+
+    private:
+        // ------------------------------------------------------------
+        // Method: domainFor
+        // ------------------------------------------------------------
+        // Role:
+        //   Validates the request and returns the largest index the
+        //   permutation must cover; sets the cluster geometry for
+        //   Clustered (width 0 falls back to Sparse).
+        // ------------------------------------------------------------
+        static uint64_t domainFor(size_t size, Key minValue, Key maxValue, Distribution distribution,
+                                  uint64_t& width, uint64_t& pitch) {
+            if (maxValue < minValue) {
+                std::cerr << "Error: The minimum value is greater than the maximum value.\n";
+                exit(1);
+            }
+            // Largest offset from minValue; the range holds maxOffset + 1 values.
+            uint64_t maxOffset = static_cast<UKey>(static_cast<UKey>(maxValue) - static_cast<UKey>(minValue));
+            if (distribution != Distribution::Zipf && size > 0 && size - 1 > maxOffset) {
+                std::cerr << "Error: Array size cannot be larger than the number of unique values in the range.\n";
+                exit(1);
+            }
+            switch (distribution) {
+                case Distribution::Dense:
+                    return size ? size - 1 : 0;
+                case Distribution::Clustered: {
+                    uint64_t clusters = std::max<uint64_t>(1, std::min<uint64_t>(kClusters, size));
+                    width = (2 * static_cast<uint64_t>(size) + clusters - 1) / clusters;
+                    pitch = maxOffset / clusters;
+                    if (width <= pitch) return clusters * width - 1;
+                    width = 0;  // Too full to cluster: fall back to Sparse.
+                    return maxOffset;
+                }
+                default:
+                    return maxOffset;
+            }
+        }
+
+        UKey base;                    // minValue.
+        Distribution shape;           // Distribution being drawn.
+        uint64_t clusterWidth;        // Slots per cluster, 0 unless clustering.
+        uint64_t clusterPitch;        // Distance between cluster starts.
+        FeistelPermutation permute;   // Keyed bijection of the domain.
+        uint64_t zipfKey;             // Hash key for Zipf ranks.
+        uint64_t maxOffset = 0;       // maxValue - minValue.
+        double zipfLogRange = 0;      // log(D + 1) for Zipf ranks.
+    };
+};
+
+// ============================================================
+// Class: BitmapKernels
+// ------------------------------------------------------------
+// Role: Holds the mark (scatter) and extract (gather) kernels
+//       for the presence bitmap and picks the widest one the
+//       running CPU supports, once, on first use. Every kernel
+//       works on 32-bit keys taken relative to a base with
+//       wrap-around arithmetic, so the same code serves signed
+//       and unsigned inputs. A portable scalar kernel is always
+//       available and is the only one on non-x86 builds.
+// ============================================================
+class BitmapKernels {
+public:
+    // Kernel generations, from narrowest to widest.
+    enum class Level { Scalar, AVX2, AVX512 };
+
+    // Sets bit (values[i] - base) for every i in [0, n).
+    using MarkFn = void (*)(uint64_t* words, const uint32_t* values, size_t n, uint32_t base);
+
+    // Writes base + (index of every set bit) into out and returns the
+    // new end. out must have room for every set bit; outEnd is only
+    // used to decide when the vector kernels must fall back to scalar
+    // stores so they never write past the caller's buffer.
+    using ExtractFn = uint32_t* (*)(const uint64_t* words, size_t wordCount,
+                                   uint32_t* out, uint32_t* outEnd, uint32_t base);
+
+    // Word-parallel set operations (see PresenceSet).
+    enum class SetOp { Union, Intersection, Difference, SymmetricDifference };
+
+    // dst[i] = dst[i] op src[i] for every i in [0, count).
+    using CombineFn = void (*)(uint64_t* dst, const uint64_t* src, size_t count, SetOp op);
+
+    // Returns the number of set bits in words [0, count).
+    using PopcountFn = size_t (*)(const uint64_t* words, size_t count);
+
+    // ------------------------------------------------------------
+    // Method: detect
+    // ------------------------------------------------------------
+    // Returns:
+    //   The widest kernel level supported by the running CPU.
+    // ------------------------------------------------------------
+    static Level detect() {
+#ifdef BIGSORT_X86_DISPATCH
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512cd") &&
+            __builtin_cpu_supports("avx512vl")) {
+            return Level::AVX512;
+        }
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+            return Level::AVX2;
+        }
+#endif
+        return Level::Scalar;
+    }
+
+    // ------------------------------------------------------------
+    // Method: active / setLevel
+    // ------------------------------------------------------------
+    // Role:
+    //   active() returns the current kernel level, detecting it on
+    //   first call. setLevel() forces a level (clamped to what the
+    //   CPU supports) so benchmarks can compare kernels in one binary.
+    // ------------------------------------------------------------
+    static Level active() { return state().level; }
+
+    static void setLevel(Level level) {
+        Level best = detect();
+        state() = makeState(static_cast<int>(level) > static_cast<int>(best) ? best : level);
+    }
+
+    static const char* levelName(Level level) {
+        switch (level) {
+            case Level::AVX512: return "avx512";
+            case Level::AVX2:   return "avx2";
+            default:            return "scalar";
+        }
+    }
+
+    static void mark(uint64_t* words, const uint32_t* values, size_t n, uint32_t base) {
+        state().mark(words, values, n, base);
+    }
+
+    static uint32_t* extract(const uint64_t* words, size_t wordCount,
+                             uint32_t* out, uint32_t* outEnd, uint32_t base) {
+        return state().extract(words, wordCount, out, outEnd, base);
+    }
+
+    static void combine(uint64_t* dst, const uint64_t* src, size_t count, SetOp op) {
+        state().combine(dst, src, count, op);
+    }
+
+    static size_t popcount(const uint64_t* words, size_t count) {
+        return state().popcount(words, count);
+    }
+
+private:
+    struct State {
+        Level level;
+        MarkFn mark;
+        ExtractFn extract;
+        CombineFn combine;
+        PopcountFn popcount;
+    };
+
+    static State& state() {
+        static State current = makeState(detect());
+        return current;
+    }
+
+    static State makeState(Level level) {
+#ifdef BIGSORT_X86_DISPATCH
+        if (level == Level::AVX512) {
+            // VPOPCNTQ is a separate extension; without it the AVX2
+            // nibble-LUT popcount is the fastest available.
+            PopcountFn popcount = __builtin_cpu_supports("avx512vpopcntdq") ? popcountAVX512 : popcountAVX2;
+            return { level, markAVX512, extractAVX512, combineAVX512, popcount };
+        }
+        if (level == Level::AVX2) return { level, markAVX2, extractAVX2, combineAVX2, popcountAVX2 };
+#endif
+        return { Level::Scalar, markScalar, extractScalar, combineScalar, popcountScalar };
+    }
+
+    // ------------------------------------------------------------
+    // Portable kernels
+    // ------------------------------------------------------------
+    static void markScalar(uint64_t* words, const uint32_t* values, size_t n, uint32_t base) {
+        for (size_t i = 0; i < n; ++i) {
+            uint32_t offset = values[i] - base;
+            words[offset >> 6] |= uint64_t(1) << (offset & 63);
+        }
+    }
+
+    static uint32_t* extractScalar(const uint64_t* words, size_t wordCount,
+                                   uint32_t* out, uint32_t* /*outEnd*/, uint32_t base) {
+        for (size_t wi = 0; wi < wordCount; ++wi) {
+            uint64_t w = words[wi];
+            uint32_t wordBase = base + static_cast<uint32_t>(wi * 64);
+            while (w) {
+                *out++ = wordBase + static_cast<uint32_t>(__builtin_ctzll(w));
+                w &= w - 1;
+            }
+        }
+        return out;
+    }
+
+    template <typename Op>
+    static void combineWith(uint64_t* dst, const uint64_t* src, size_t count, Op op) {
+        for (size_t i = 0; i < count; ++i) dst[i] = op(dst[i], src[i]);
+    }
+
+    static void combineScalar(uint64_t* dst, const uint64_t* src, size_t count, SetOp op) {
+        switch (op) {
+            case SetOp::Union:        combineWith(dst, src, count, [](uint64_t a, uint64_t b) { return a | b; }); break;
+            case SetOp::Intersection: combineWith(dst, src, count, [](uint64_t a, uint64_t b) { return a & b; }); break;
+            case SetOp::Difference:   combineWith(dst, src, count, [](uint64_t a, uint64_t b) { return a & ~b; }); break;
+            default:                  combineWith(dst, src, count, [](uint64_t a, uint64_t b) { return a ^ b; }); break;
+        }
+    }
+
+    static size_t popcountScalar(const uint64_t* words, size_t count) {
+        size_t total = 0;
+        for (size_t i = 0; i < count; ++i) total += static_cast<size_t>(__builtin_popcountll(words[i]));
+        return total;
+    }
+
+#ifdef BIGSORT_X86_DISPATCH
+    // ------------------------------------------------------------
+    // AVX2 kernels
+    // ------------------------------------------------------------
+    // Marking computes word indices and bit masks for 8 keys at a
+    // time; the OR into memory stays scalar because AVX2 has no
+    // scatter. Extraction expands one byte of the bitmap at a time
+    // through a 256-entry LUT of packed bit positions (the pshufb
+    // style expansion), storing 8 lanes and advancing by popcount.
+    // ------------------------------------------------------------
+    struct ByteLUT {
+        uint64_t positions[256];  // Bit positions of each byte, packed as 8 x uint8.
+        constexpr ByteLUT() : positions() {
+            for (int b = 0; b < 256; ++b) {
+                uint64_t packed = 0;
+                int k = 0;
+                for (int bit = 0; bit < 8; ++bit) {
+                    if (b & (1 << bit)) {
+                        packed |= uint64_t(bit) << (8 * k++);
+                    }
+                }
+                positions[b] = packed;
+            }
+        }
+    };
+
+    static const ByteLUT& byteLUT() {
+        static constexpr ByteLUT lut;
+        return lut;
+    }
+
+    __attribute__((target("avx2")))
+    static void markAVX2(uint64_t* words, const uint32_t* values, size_t n, uint32_t base) {
+        const __m256i vbase = _mm256_set1_epi32(static_cast<int>(base));
+        const __m256i ones = _mm256_set1_epi64x(1);
+        const __m256i low6 = _mm256_set1_epi32(63);
+        alignas(32) uint32_t wordIndex[8];
+        alignas(32) uint64_t mask[8];
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            __m256i v = _mm256_sub_epi32(
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i)), vbase);
+            __m256i bit = _mm256_and_si256(v, low6);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(wordIndex), _mm256_srli_epi32(v, 6));
+            _mm256_store_si256(reinterpret_cast<__m256i*>(mask),
+                _mm256_sllv_epi64(ones, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(bit))));
+            _mm256_store_si256(reinterpret_cast<__m256i*>(mask + 4),
+                _mm256_sllv_epi64(ones, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(bit, 1))));
+            for (int lane = 0; lane < 8; ++lane) {
+                words[wordIndex[lane]] |= mask[lane];
+            }
+        }
+        markScalar(words, values + i, n - i, base);
+    }
+
+    __attribute__((target("avx2,popcnt")))
+    static uint32_t* extractAVX2(const uint64_t* words, size_t wordCount,
+                                 uint32_t* out, uint32_t* outEnd, uint32_t base) {
+        const ByteLUT& lut = byteLUT();
+        size_t wi = 0;
+        // Each byte stores 8 lanes, so keep 64 + 8 slots of headroom.
+        for (; wi < wordCount && outEnd - out >= 72; ++wi) {
+            uint64_t w = words[wi];
+            if (!w) continue;
+            uint32_t wordBase = base + static_cast<uint32_t>(wi * 64);
+            for (int byte = 0; byte < 8 && w; ++byte, w >>= 8) {
+                unsigned b = static_cast<unsigned>(w & 0xff);
+                if (!b) continue;
+                __m256i lanes = _mm256_cvtepu8_epi32(
+                    _mm_cvtsi64_si128(static_cast<long long>(lut.positions[b])));
+                lanes = _mm256_add_epi32(lanes,
+                    _mm256_set1_epi32(static_cast<int>(wordBase + 8 * byte)));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), lanes);
+                out += __builtin_popcount(b);
+            }
+        }
+        return extractScalar(words + wi, wordCount - wi, out, outEnd,
+                             base + static_cast<uint32_t>(wi * 64));
+    }
+
+    // Set operations combine 4 words per instruction; the scalar
+    // kernel finishes the tail.
+    __attribute__((target("avx2")))
+    static void combineAVX2(uint64_t* dst, const uint64_t* src, size_t count, SetOp op) {
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+            __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+            __m256i r = op == SetOp::Union        ? _mm256_or_si256(a, b)
+                      : op == SetOp::Intersection ? _mm256_and_si256(a, b)
+                      : op == SetOp::Difference   ? _mm256_andnot_si256(b, a)
+                                                  : _mm256_xor_si256(a, b);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), r);
+        }
+        combineScalar(dst + i, src + i, count - i, op);
+    }
+
+    // Popcount by nibble lookup (pshufb) and byte sums (psadbw).
+    __attribute__((target("avx2,popcnt")))
+    static size_t popcountAVX2(const uint64_t* words, size_t count) {
+        const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                             0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+        const __m256i low4 = _mm256_set1_epi8(0x0f);
+        __m256i sums = _mm256_setzero_si256();
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + i));
+            __m256i bytes = _mm256_add_epi8(_mm256_shuffle_epi8(lut, _mm256_and_si256(v, low4)),
+                                            _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(v, 4), low4)));
+            sums = _mm256_add_epi64(sums, _mm256_sad_epu8(bytes, _mm256_setzero_si256()));
+        }
+        alignas(32) uint64_t lanes[4];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), sums);
+        size_t total = static_cast<size_t>(lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+        for (; i < count; ++i) total += static_cast<size_t>(_mm_popcnt_u64(words[i]));
+        return total;
+    }
+
+    // ------------------------------------------------------------
+    // AVX-512 kernels
+    // ------------------------------------------------------------
+    // Marking gathers the 8 target words, ORs in the 8 masks and
+    // scatters them back, but only when the conflict-detection
+    // instruction reports that no two lanes hit the same word;
+    // otherwise the group is marked with scalar stores. Extraction
+    // compresses 16 candidate indices per 16-bit chunk with the
+    // chunk as the lane mask and stores them unmasked (compress to
+    // register then store is faster than compress-store on Zen4).
+    // ------------------------------------------------------------
+    __attribute__((target("avx512f,avx512cd,avx512vl")))
+    static void markAVX512(uint64_t* words, const uint32_t* values, size_t n, uint32_t base) {
+        const __m256i vbase = _mm256_set1_epi32(static_cast<int>(base));
+        const __m256i low6 = _mm256_set1_epi32(63);
+        const __m512i ones = _mm512_set1_epi64(1);
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            __m256i v = _mm256_sub_epi32(
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i)), vbase);
+            __m256i wordIndex = _mm256_srli_epi32(v, 6);
+            if (_mm256_test_epi32_mask(_mm256_conflict_epi32(wordIndex), _mm256_set1_epi32(-1))) {
+                markScalar(words, values + i, 8, base);
+                continue;
+            }
+            // maskz forms avoid GCC's -Wmaybe-uninitialized on _mm512_undefined.
+            __m512i mask = _mm512_maskz_sllv_epi64(0xff, ones,
+                _mm512_maskz_cvtepu32_epi64(0xff, _mm256_and_si256(v, low6)));
+            __m512i current = _mm512_mask_i32gather_epi64(_mm512_setzero_si512(), 0xff, wordIndex, words, 8);
+            _mm512_i32scatter_epi64(words, wordIndex, _mm512_or_si512(current, mask), 8);
+        }
+        markScalar(words, values + i, n - i, base);
+    }
+
+    __attribute__((target("avx512f,popcnt")))
+    static uint32_t* extractAVX512(const uint64_t* words, size_t wordCount,
+                                   uint32_t* out, uint32_t* outEnd, uint32_t base) {
+        const __m512i iota = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7,
+                                               8, 9, 10, 11, 12, 13, 14, 15);
+        size_t wi = 0;
+        // Each chunk stores 16 lanes, so keep 64 + 16 slots of headroom.
+        for (; wi < wordCount && outEnd - out >= 80; ++wi) {
+            uint64_t w = words[wi];
+            if (!w) continue;
+            uint32_t wordBase = base + static_cast<uint32_t>(wi * 64);
+            for (int chunk = 0; chunk < 4 && w; ++chunk, w >>= 16) {
+                __mmask16 m = static_cast<__mmask16>(w & 0xffff);
+                if (!m) continue;
+                __m512i lanes = _mm512_add_epi32(iota,
+                    _mm512_set1_epi32(static_cast<int>(wordBase + 16 * chunk)));
+                _mm512_storeu_si512(out, _mm512_maskz_compress_epi32(m, lanes));
+                out += __builtin_popcount(m);
+            }
+        }
+        return extractScalar(words + wi, wordCount - wi, out, outEnd,
+                             base + static_cast<uint32_t>(wi * 64));
+    }
+
+    __attribute__((target("avx512f")))
+    static void combineAVX512(uint64_t* dst, const uint64_t* src, size_t count, SetOp op) {
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            __m512i a = _mm512_loadu_si512(dst + i);
+            __m512i b = _mm512_loadu_si512(src + i);
+            // maskz andnot for the same -Wmaybe-uninitialized reason as markAVX512.
+            __m512i r = op == SetOp::Union        ? _mm512_or_si512(a, b)
+                      : op == SetOp::Intersection ? _mm512_and_si512(a, b)
+                      : op == SetOp::Difference   ? _mm512_maskz_andnot_epi64(0xff, b, a)
+                                                  : _mm512_xor_si512(a, b);
+            _mm512_storeu_si512(dst + i, r);
+        }
+        combineScalar(dst + i, src + i, count - i, op);
+    }
+
+    __attribute__((target("avx512f,avx512vpopcntdq,popcnt")))
+    static size_t popcountAVX512(const uint64_t* words, size_t count) {
+        __m512i sums = _mm512_setzero_si512();
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            sums = _mm512_add_epi64(sums, _mm512_popcnt_epi64(_mm512_loadu_si512(words + i)));
+        }
+        // A store, not _mm512_reduce_add_epi64, avoids GCC's -Wuninitialized.
+        alignas(64) uint64_t lanes[8];
+        _mm512_store_si512(lanes, sums);
+        size_t total = 0;
+        for (uint64_t lane : lanes) total += static_cast<size_t>(lane);
+        for (; i < count; ++i) total += static_cast<size_t>(_mm_popcnt_u64(words[i]));
+        return total;
+    }
+#endif
+};
+
+// ============================================================
+// Struct: BitmapMemoryPolicy
+// ------------------------------------------------------------
+// Role: How a PresenceBitmap's word buffer is allocated. With
+//       every field at its default the buffer comes from calloc,
+//       as a std::vector would. Any other setting maps it with
+//       mmap:
+//         - pages:     TransparentHuge asks for THP on a 2 MB
+//                      aligned range (madvise(MADV_HUGEPAGE));
+//                      ExplicitHuge uses MAP_HUGETLB from the
+//                      reserved pool, falling back to THP when the
+//                      pool is empty. Either cuts TLB misses
+//                      during random marking.
+//         - placement: Interleave spreads pages round-robin over
+//                      the NUMA nodes (mbind); FirstTouch faults
+//                      each page in from the thread whose parallel
+//                      shard will use it.
+//         - prefault:  Fault every page in at allocation time, so
+//                      the sort does not pay for it.
+//         - prefaultThreads: Threads that do the faulting.
+//       A bitmap keeps its buffer across sorts, and growth keeps
+//       the policy, so the mapping stays warm between calls.
+// ============================================================
+struct BitmapMemoryPolicy {
+    enum class Pages { Default, TransparentHuge, ExplicitHuge };
+    enum class Placement { Default, Interleave, FirstTouch };
+
+    Pages pages = Pages::Default;
+    Placement placement = Placement::Default;
+    bool prefault = false;
+    unsigned prefaultThreads = 1;
+
+    bool isDefault() const {
+        return pages == Pages::Default && placement == Placement::Default && !prefault;
+    }
+};
+
+// ============================================================
+// Class: BitmapBuffer
+// ------------------------------------------------------------
+// Role: Zero-initialized, growable array of bitmap words that
+//       allocates according to a BitmapMemoryPolicy. It stands in
+//       for std::vector<uint64_t> inside PresenceBitmap: size and
+//       capacity only grow, and new words always read as zero.
+// ============================================================
+class BitmapBuffer {
+public:
+    static constexpr size_t kHugePageBytes = size_t(2) << 20;
+    static constexpr size_t kPageBytes = 4096;
+
+    BitmapBuffer() : words(nullptr), length(0), capacityWords(0), mapBase(nullptr), mapBytes(0) { }
+
+    BitmapBuffer(const BitmapBuffer& other) : BitmapBuffer() {
+        policy = other.policy;
+        assignZero(other.length);
+        if (length) std::memcpy(words, other.words, length * sizeof(uint64_t));
+    }
+
+    BitmapBuffer(BitmapBuffer&& other) noexcept : BitmapBuffer() { swap(other); }
+
+    BitmapBuffer& operator=(BitmapBuffer other) noexcept {
+        swap(other);
+        return *this;
+    }
+
+    ~BitmapBuffer() { release(); }
+
+    // Bytes all BitmapBuffers have allocated so far (calloc or
+    // mmap, never freed bytes subtracted). Bitmaps bypass operator
+    // new, so allocation accounting such as bigsort_bench.cpp's
+    // adds this in.
+    static size_t allocatedBytes() { return allocationCounter().load(std::memory_order_relaxed); }
+
+    // Applies to allocations from now on.
+    void setPolicy(const BitmapMemoryPolicy& newPolicy) { policy = newPolicy; }
+    const BitmapMemoryPolicy& getPolicy() const { return policy; }
+
+    // Sets the size to n words, all zero, reusing the capacity.
+    void assignZero(size_t n) {
+        if (n > capacityWords) {
+            release();
+            allocate(n);
+        } else if (n) {
+            std::memset(words, 0, n * sizeof(uint64_t));
+        }
+        length = n;
+    }
+
+    // Grows to n words, keeping the contents; new words are zero.
+    void growZero(size_t n) {
+        if (n <= length) return;
+        if (n > capacityWords) {
+            BitmapBuffer bigger;
+            bigger.policy = policy;
+            bigger.allocate(n);
+            if (length) std::memcpy(bigger.words, words, length * sizeof(uint64_t));
+            bigger.length = n;
+            swap(bigger);
+            return;
+        }
+        std::memset(words + length, 0, (n - length) * sizeof(uint64_t));
+        length = n;
+    }
+
+    size_t size() const { return length; }
+    size_t capacityBytes() const { return mapBase ? mapBytes : capacityWords * sizeof(uint64_t); }
+    uint64_t* data() { return words; }
+    const uint64_t* data() const { return words; }
+    uint64_t& operator[](size_t i) { return words[i]; }
+    const uint64_t& operator[](size_t i) const { return words[i]; }
+
+private:
+    void swap(BitmapBuffer& other) noexcept {
+        std::swap(words, other.words);
+        std::swap(length, other.length);
+        std::swap(capacityWords, other.capacityWords);
+        std::swap(mapBase, other.mapBase);
+        std::swap(mapBytes, other.mapBytes);
+        std::swap(policy, other.policy);
+    }
+
+    // ------------------------------------------------------------
+    // Method: allocate
+    // ------------------------------------------------------------
+    // Role:
+    //   Gets zeroed room for n words (length stays 0) from calloc
+    //   under the default policy, or from an anonymous mapping
+    //   shaped by the policy otherwise.
+    // ------------------------------------------------------------
+    void allocate(size_t n) {
+        size_t bytes = n * sizeof(uint64_t);
+        if (policy.isDefault() || !bytes) {
+            words = static_cast<uint64_t*>(std::calloc(std::max<size_t>(n, 1), sizeof(uint64_t)));
+            if (!words) fail();
+            capacityWords = n;
+            allocationCounter().fetch_add(bytes, std::memory_order_relaxed);
+            return;
+        }
+        bytes = (bytes + kHugePageBytes - 1) / kHugePageBytes * kHugePageBytes;
+        void* region = nullptr;
+        if (policy.pages == BitmapMemoryPolicy::Pages::ExplicitHuge) {
+            region = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (region == MAP_FAILED) region = nullptr;  // Pool empty: use THP.
+            if (region) {
+                mapBase = region;
+                mapBytes = bytes;
+            }
+        }
+        if (!region) {
+            // Over-map by one huge page so the buffer can start on a
+            // 2 MB boundary, where THP can back it.
+            size_t padded = bytes + kHugePageBytes;
+            void* raw = ::mmap(nullptr, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (raw == MAP_FAILED) fail();
+            uintptr_t start = reinterpret_cast<uintptr_t>(raw);
+            uintptr_t aligned = (start + kHugePageBytes - 1) & ~(uintptr_t(kHugePageBytes) - 1);
+            if (aligned > start) ::munmap(raw, aligned - start);
+            size_t tail = (start + padded) - (aligned + bytes);
+            if (tail) ::munmap(reinterpret_cast<void*>(aligned + bytes), tail);
+            region = reinterpret_cast<void*>(aligned);
+            mapBase = region;
+            mapBytes = bytes;
+#ifdef MADV_HUGEPAGE
+            if (policy.pages != BitmapMemoryPolicy::Pages::Default) ::madvise(region, bytes, MADV_HUGEPAGE);
+#endif
+        }
+        if (policy.placement == BitmapMemoryPolicy::Placement::Interleave) interleave(region, bytes);
+        words = static_cast<uint64_t*>(region);
+        capacityWords = bytes / sizeof(uint64_t);
+        allocationCounter().fetch_add(bytes, std::memory_order_relaxed);
+        if (policy.prefault || policy.placement == BitmapMemoryPolicy::Placement::FirstTouch) {
+            prefault(static_cast<unsigned char*>(region), bytes);
+        }
+    }
+
+    // Spreads the range over every online NUMA node.
+    static void interleave(void* region, size_t bytes) {
+#if defined(__linux__) && defined(SYS_mbind)
+        FILE* online = std::fopen("/sys/devices/system/node/online", "r");
+        if (!online) return;
+        unsigned long mask = 0;
+        unsigned first = 0, last = 0;
+        int got;
+        while ((got = std::fscanf(online, "%u", &first)) == 1) {
+            last = first;
+            if (std::fscanf(online, "-%u", &last) < 0) last = first;
+            for (unsigned node = first; node <= last && node < 64; ++node) mask |= 1UL << node;
+            if (std::fgetc(online) != ',') break;
+        }
+        std::fclose(online);
+        if (__builtin_popcountl(mask) > 1) {
+            ::syscall(SYS_mbind, region, bytes, MPOL_INTERLEAVE, &mask, 64UL, 0U);
+        }
+#else
+        (void)region;
+        (void)bytes;
+#endif
+    }
+
+    // Writes one byte per page so every page is faulted in now. The
+    // threads split the range in contiguous pieces, as the parallel
+    // sort shards do, so first-touch placement matches their use.
+    void prefault(unsigned char* region, size_t bytes) const {
+        size_t pages = bytes / kPageBytes;
+        parallelFor(std::max(1u, policy.prefaultThreads), pages, [&](size_t begin, size_t end, unsigned) {
+            for (size_t page = begin; page < end; ++page) {
+                reinterpret_cast<volatile unsigned char*>(region)[page * kPageBytes] = 0;
+            }
+        });
+    }
+
+    void release() {
+        if (mapBase) {
+            ::munmap(mapBase, mapBytes);
+        } else {
+            std::free(words);
+        }
+        words = nullptr;
+        length = 0;
+        capacityWords = 0;
+        mapBase = nullptr;
+        mapBytes = 0;
+    }
+
+    static std::atomic<size_t>& allocationCounter() {
+        static std::atomic<size_t> bytes{0};
+        return bytes;
+    }
+
+    [[noreturn]] static void fail() {
+        std::cerr << "Error: cannot allocate the presence bitmap.\n";
+        exit(1);
+    }
+
+    uint64_t* words;            // First word, or nullptr.
+    size_t length;              // Words in use.
+    size_t capacityWords;       // Words allocated.
+    void* mapBase;              // Mapping to munmap, or nullptr if calloc'd.
+    size_t mapBytes;            // Length of the mapping.
+    BitmapMemoryPolicy policy;  // Applied to the next allocation.
+};
+
+// ============================================================
+// Class: PresenceBitmap
+// ------------------------------------------------------------
+// Role: A dense presence bitmap backed by raw 64-bit words.
+//       Bit i represents the value (base + i). Extraction walks
+//       the words instead of the bits, so empty regions cost one
+//       load per 64 slots and set bits are emitted with
+//       count-trailing-zeros / clear-lowest-bit.
+//
+//       An optional summary level keeps one bit per block of 64
+//       words (4096 slots). When enabled, counting and extraction
+//       visit only non-empty blocks, so a very sparse bitmap costs
+//       O(touched blocks) instead of O(k / 64) to scan.
+// ============================================================
+class PresenceBitmap {
+public:
+    static constexpr size_t kWordBits = 64;
+    static constexpr size_t kBlockWords = 64;  // Words covered by one summary bit.
+    // How markAll-style marking proceeds: Auto picks per input with
+    // prefersBlockedMarking(); Direct and Blocked force a path.
+    enum class MarkMode { Auto, Direct, Blocked };
+
+    static constexpr unsigned kSliceMinBits = 21;   // markAllBlocked() slice: 2^21 slots = 256 KB.
+    static constexpr size_t kMaxSlices = 4096;      // Bounds the write-combining lines to 256 KB.
+    static constexpr size_t kLineOffsets = 16;      // uint32 offsets per 64-byte line.
+    static constexpr size_t kBlockedMinBytes = size_t(64) << 20;  // Smaller bitmaps mark directly.
+
+    // ------------------------------------------------------------
+    // Struct: SliceBuffers
+    // ------------------------------------------------------------
+    // Role: Per-slice bookkeeping for markAllBlocked(): slice
+    //       starts and cursors, and one write-combining line per
+    //       slice. The buffers only grow, so a caller that keeps
+    //       one across sorts (SortWorkspace, BigSorter) marks
+    //       without heap allocation once they are large enough.
+    // ------------------------------------------------------------
+    struct SliceBuffers {
+        struct alignas(64) Line {
+            uint32_t offsets[kLineOffsets];
+        };
+
+        std::vector<size_t> start;   // start[s] = slice s's first scratch slot; start[slices] = n.
+        std::vector<size_t> cursor;  // Next scratch slot per slice.
+        std::vector<Line> lines;     // Write-combining line per slice.
+        std::vector<uint8_t> fill;   // Offsets buffered in each line.
+
+        // Sizes the buffers for slices slices; start and fill are zeroed.
+        void prepare(size_t slices) {
+            start.assign(slices + 1, 0);
+            cursor.resize(slices);
+            lines.resize(slices);
+            fill.assign(slices, 0);
+        }
+
+        size_t capacityBytes() const {
+            return (start.capacity() + cursor.capacity()) * sizeof(size_t) + lines.capacity() * sizeof(Line) +
+                   fill.capacity();
+        }
+    };
+
+    // ------------------------------------------------------------
+    // Constructor: PresenceBitmap
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - bitCount: Number of slots the bitmap must represent.
+    //
+    // Role:
+    //   Allocates ceil(bitCount / 64) zeroed words.
+    // ------------------------------------------------------------
+    explicit PresenceBitmap(size_t bitCount = 0)
+        : bits(bitCount), summaryEnabled(false) {
+        words.assignZero((bitCount + kWordBits - 1) / kWordBits);
+    }
+
+    // ------------------------------------------------------------
+    // Method: setSummaryEnabled
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - enabled: Maintain the one-bit-per-block summary level.
+    //
+    // Role:
+    //   Takes effect at the next reset() / resizeClean(); call it
+    //   while the bitmap is empty.
+    // ------------------------------------------------------------
+    void setSummaryEnabled(bool enabled) {
+        summaryEnabled = enabled;
+        if (!enabled) summary.clear();
+    }
+
+    bool hasSummary() const { return summaryEnabled; }
+
+    // Allocation policy for the words (see BitmapMemoryPolicy);
+    // applies from the next allocation on.
+    void setMemoryPolicy(const BitmapMemoryPolicy& policy) { words.setPolicy(policy); }
+    const BitmapMemoryPolicy& getMemoryPolicy() const { return words.getPolicy(); }
+
+    // ------------------------------------------------------------
+    // Method: reset
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - bitCount: Number of slots the bitmap must now represent.
+    //
+    // Role:
+    //   Resizes the bitmap and zeroes every word in use. Storage is
+    //   only reallocated when bitCount exceeds every earlier size,
+    //   so a reused bitmap reaches a steady state with no heap
+    //   traffic.
+    // ------------------------------------------------------------
+    void reset(size_t bitCount) {
+        words.assignZero((bitCount + kWordBits - 1) / kWordBits);
+        bits = bitCount;
+        if (summaryEnabled) summary.assign(summaryWordCount(), 0);
+    }
+
+    // ------------------------------------------------------------
+    // Method: resizeClean
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - bitCount: Number of slots the bitmap must now represent.
+    //
+    // Role:
+    //   Like reset(), but without zeroing: the caller guarantees the
+    //   bitmap was left all-zero (see clearMarked), so only storage
+    //   beyond every earlier size is initialized. Together with
+    //   clearMarked this makes reuse cost O(touched words) rather
+    //   than O(k).
+    // ------------------------------------------------------------
+    void resizeClean(size_t bitCount) {
+        size_t needed = (bitCount + kWordBits - 1) / kWordBits;
+        words.growZero(needed);
+        bits = bitCount;
+        if (summaryEnabled && summary.size() < summaryWordCount()) {
+            summary.resize(summaryWordCount(), 0);
+        }
+    }
+
+    // Marks slot i as present. Does not maintain the summary level;
+    // use markAll for bitmaps that have one.
+    void set(size_t i) { words[i / kWordBits] |= uint64_t(1) << (i % kWordBits); }
+
+    // Returns true if slot i is present.
+    bool test(size_t i) const { return (words[i / kWordBits] >> (i % kWordBits)) & 1; }
+
+    // ------------------------------------------------------------
+    // Method: count
+    // ------------------------------------------------------------
+    // Returns:
+    //   The number of set bits, computed with one popcount per word.
+    // ------------------------------------------------------------
+    size_t count() const { return countWords(0, wordCount()); }
+
+    // Returns the number of set bits in words [wordBegin, wordEnd).
+    size_t countWords(size_t wordBegin, size_t wordEnd) const {
+        size_t total = 0;
+        forEachBlock(wordBegin, wordEnd, [&](size_t blockBegin, size_t blockEnd) {
+            for (size_t wi = blockBegin; wi < blockEnd; ++wi) {
+                total += static_cast<size_t>(__builtin_popcountll(words[wi]));
+            }
+        });
+        return total;
+    }
+
+    // ------------------------------------------------------------
+    // Method: markAll
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - keys: Keys to mark; each must lie in [base, base + size()).
+    //   - n:    Number of keys.
+    //   - base: Key represented by slot 0.
+    //
+    // Role:
+    //   Sets slot (key - base) for every key. Offsets are taken in
+    //   the key's unsigned type, so signed keys are bias-shifted by
+    //   the base for free. 32-bit keys go through the dispatched
+    //   mark kernel; other widths use the scalar loop. The summary
+    //   level, if any, is filled by a second pass over the keys
+    //   that only touches the small, cache-resident summary.
+    // ------------------------------------------------------------
+    template <typename Key>
+    void markAll(const Key* keys, size_t n, Key base) {
+        if constexpr (sizeof(Key) == sizeof(uint32_t)) {
+            BitmapKernels::mark(words.data(), reinterpret_cast<const uint32_t*>(keys), n,
+                                static_cast<uint32_t>(base));
+        } else {
+            for (size_t i = 0; i < n; ++i) {
+                set(offsetOf(keys[i], base));
+            }
+        }
+        if (summaryEnabled) {
+            for (size_t i = 0; i < n; ++i) {
+                size_t block = offsetOf(keys[i], base) / (kWordBits * kBlockWords);
+                summary[block / 64] |= uint64_t(1) << (block % 64);
+            }
+        }
+    }
+
+    // ------------------------------------------------------------
+    // Method: markAllAtomic
+    // ------------------------------------------------------------
+    // Role:
+    //   Same contract as markAll, but ORs each mask in with a relaxed
+    //   atomic fetch_or so several threads may mark disjoint slices
+    //   of the input into the same bitmap concurrently. Summary bits
+    //   are checked before the atomic OR, since most are already set.
+    // ------------------------------------------------------------
+    template <typename Key>
+    void markAllAtomic(const Key* keys, size_t n, Key base) {
+        for (size_t i = 0; i < n; ++i) {
+            size_t offset = offsetOf(keys[i], base);
+            __atomic_fetch_or(&words[offset / kWordBits], uint64_t(1) << (offset % kWordBits),
+                              __ATOMIC_RELAXED);
+            if (summaryEnabled) {
+                size_t block = offset / (kWordBits * kBlockWords);
+                uint64_t bit = uint64_t(1) << (block % 64);
+                if (!(__atomic_load_n(&summary[block / 64], __ATOMIC_RELAXED) & bit)) {
+                    __atomic_fetch_or(&summary[block / 64], bit, __ATOMIC_RELAXED);
+                }
+            }
+        }
+    }
+
+    // ------------------------------------------------------------
+    // Method: markAllBlocked
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - keys, n, base: As for markAll().
+    //   - scratch:       Room for n uint32 offsets.
+    //   - buffers:       Per-slice state, reused across calls.
+    //
+    // Role:
+    //   Cache-blocked markAll() for bitmaps far larger than the LLC,
+    //   where direct marking takes one DRAM miss per key. The keys
+    //   are radix-partitioned by L2-sized bitmap slice, then each
+    //   slice is marked while it is cache-resident, so the random
+    //   writes hit L2 and DRAM only sees streaming traffic.
+    //
+    // Flow:
+    //   1. Histogram the keys by slice and prefix-sum the counts.
+    //   2. Scatter each key's in-slice offset into its slice's
+    //      range of scratch through a 64-byte write-combining line
+    //      per slice, so memory sees whole-line writes.
+    //   3. Mark each slice's offsets with the dispatched kernel.
+    // ------------------------------------------------------------
+    template <typename Key>
+    void markAllBlocked(const Key* keys, size_t n, Key base, uint32_t* scratch, SliceBuffers& buffers) {
+        unsigned sliceBits = sliceBitsFor(bits);
+        size_t slices = (bits + (size_t(1) << sliceBits) - 1) >> sliceBits;
+        size_t sliceMask = (size_t(1) << sliceBits) - 1;
+        buffers.prepare(slices);
+        std::vector<size_t>& start = buffers.start;
+        std::vector<size_t>& cursor = buffers.cursor;
+        std::vector<SliceBuffers::Line>& lines = buffers.lines;
+        std::vector<uint8_t>& fill = buffers.fill;
+
+        // Step 1: Count keys per slice; start[s] is slice s's first slot.
+        for (size_t i = 0; i < n; ++i) {
+            ++start[(offsetOf(keys[i], base) >> sliceBits) + 1];
+        }
+        for (size_t s = 0; s < slices; ++s) start[s + 1] += start[s];
+
+        // Step 2: Partition through write-combining lines.
+        std::copy(start.begin(), start.end() - 1, cursor.begin());
+        for (size_t i = 0; i < n; ++i) {
+            size_t offset = offsetOf(keys[i], base);
+            size_t s = offset >> sliceBits;
+            lines[s].offsets[fill[s]++] = static_cast<uint32_t>(offset & sliceMask);
+            if (fill[s] == kLineOffsets) {
+                std::memcpy(scratch + cursor[s], lines[s].offsets, sizeof(SliceBuffers::Line));
+                cursor[s] += kLineOffsets;
+                fill[s] = 0;
+            }
+        }
+        for (size_t s = 0; s < slices; ++s) {
+            std::memcpy(scratch + cursor[s], lines[s].offsets, fill[s] * sizeof(uint32_t));
+        }
+
+        // Step 3: Mark slice by slice while its words stay in L2.
+        size_t sliceWords = (size_t(1) << sliceBits) / kWordBits;
+        for (size_t s = 0; s < slices; ++s) {
+            size_t count = start[s + 1] - start[s];
+            if (!count) continue;
+            const uint32_t* offsets = scratch + start[s];
+            BitmapKernels::mark(words.data() + s * sliceWords, offsets, count, 0);
+            if (summaryEnabled) {
+                for (size_t i = 0; i < count; ++i) {
+                    size_t block = ((s << sliceBits) | offsets[i]) / (kWordBits * kBlockWords);
+                    summary[block / 64] |= uint64_t(1) << (block % 64);
+                }
+            }
+        }
+    }
+
+    // ------------------------------------------------------------
+    // Method: prefersBlockedMarking
+    // ------------------------------------------------------------
+    // Returns:
+    //   True if markAllBlocked() should beat markAll() for n keys
+    //   over bitCount slots: the bitmap is well past LLC size and
+    //   there are enough keys to fill each slice's line. Spans whose
+    //   slices would not fit uint32 offsets are never blocked.
+    // ------------------------------------------------------------
+    static bool prefersBlockedMarking(size_t n, size_t bitCount) {
+        if (!supportsBlockedMarking(bitCount) || bitCount / 8 < kBlockedMinBytes) return false;
+        size_t slices = (bitCount + (size_t(1) << sliceBitsFor(bitCount)) - 1) >> sliceBitsFor(bitCount);
+        return n >= slices * kLineOffsets;
+    }
+
+    static bool supportsBlockedMarking(size_t bitCount) { return sliceBitsFor(bitCount) <= 32; }
+
+    // Whether a mark of n keys over bitCount slots goes blocked.
+    static bool useBlockedMarking(MarkMode mode, size_t n, size_t bitCount) {
+        switch (mode) {
+            case MarkMode::Direct: return false;
+            case MarkMode::Blocked: return supportsBlockedMarking(bitCount);
+            default: return prefersBlockedMarking(n, bitCount);
+        }
+    }
+
+    // ------------------------------------------------------------
+    // Method: clearMarked
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - keys, n, base: The same keys markAll was given.
+    //
+    // Role:
+    //   Returns the bitmap to all-zero. The marked keys are exactly
+    //   the record of which words are dirty, so when there are
+    //   fewer keys than words each dirty word is zeroed through its
+    //   key (O(n)); otherwise the words in use are cleared in one
+    //   sweep (O(k / 64)). The summary is cleared the same way.
+    // ------------------------------------------------------------
+    template <typename Key>
+    void clearMarked(const Key* keys, size_t n, Key base) {
+        if (n < wordCount()) {
+            for (size_t i = 0; i < n; ++i) {
+                size_t offset = offsetOf(keys[i], base);
+                words[offset / kWordBits] = 0;
+                if (summaryEnabled) summary[offset / (kWordBits * kBlockWords * 64)] = 0;
+            }
+        } else {
+            clearAll();
+        }
+    }
+
+    // Zeroes every word in use, and the summary.
+    void clearAll() {
+        std::fill_n(words.data(), wordCount(), 0);
+        clearSummary();
+    }
+
+    // ------------------------------------------------------------
+    // Method: clearTouched
+    // ------------------------------------------------------------
+    // Role:
+    //   Clears the bitmap when the marked keys are no longer at
+    //   hand. With the summary level only the flagged blocks are
+    //   zeroed; without it this is clearAll().
+    // ------------------------------------------------------------
+    void clearTouched() {
+        if (!summaryEnabled) {
+            clearAll();
+            return;
+        }
+        forEachBlock(0, wordCount(), [&](size_t blockBegin, size_t blockEnd) {
+            std::fill(words.data() + blockBegin, words.data() + blockEnd, 0);
+        });
+        clearSummary();
+    }
+
+    // Zeroes the summary level only, for callers that cleared the words.
+    void clearSummary() {
+        if (summaryEnabled) std::fill_n(summary.data(), summaryWordCount(), 0);
+    }
+
+    // ------------------------------------------------------------
+    // Method: spanFor
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - minKey, maxKey: Inclusive key range a bitmap must cover.
+    //   - budgetBytes:    Largest bitmap the caller accepts; 0 means
+    //                     any addressable size.
+    //
+    // Returns:
+    //   The slot count maxKey - minKey + 1, or 0 if the range is
+    //   empty, not addressable, or over budgetBytes. The shared
+    //   guard of the bitmap-backed containers (PresenceSet,
+    //   PresenceIndex, StreamingBigSorter); sorts are budgeted by
+    //   SortPlanner instead.
+    // ------------------------------------------------------------
+    template <typename Key>
+    static size_t spanFor(Key minKey, Key maxKey, size_t budgetBytes = 0) {
+        using UKey = std::make_unsigned_t<Key>;
+        if (maxKey < minKey) return 0;
+        unsigned long long span = static_cast<unsigned long long>(
+            static_cast<UKey>(static_cast<UKey>(maxKey) - static_cast<UKey>(minKey))) + 1;
+        if (span == 0 || span >= (1ULL << 62) || span > std::numeric_limits<size_t>::max()) return 0;
+        if (budgetBytes && span / 8 > budgetBytes) return 0;
+        return static_cast<size_t>(span);
+    }
+
+    // ------------------------------------------------------------
+    // Method: scanSlots
+    // ------------------------------------------------------------
+    // Returns:
+    //   The slot count a scan is expected to cost for n keys over
+    //   bitCount slots: all of them without a summary, otherwise at
+    //   most one block per key plus the summary itself. Used by the
+    //   planner's cost model.
+    // ------------------------------------------------------------
+    static unsigned long long scanSlots(size_t n, unsigned long long bitCount, bool withSummary) {
+        if (!withSummary) return bitCount;
+        const unsigned long long blockSlots = kWordBits * kBlockWords;
+        unsigned long long touched = static_cast<unsigned long long>(n) * blockSlots;
+        return std::min(bitCount, touched + bitCount / blockSlots);
+    }
+
+    // ------------------------------------------------------------
+    // Method: extract
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - out:    Destination with room for count() keys.
+    //   - outEnd: One past the end of the destination buffer.
+    //   - base:   Key represented by slot 0.
+    //
+    // Returns:
+    //   Pointer one past the last key written.
+    //
+    // Flow:
+    //   Skips zero words (and, with a summary, whole empty blocks)
+    //   and expands each non-zero word into the keys of its set
+    //   bits. 32-bit keys use the dispatched kernel (LUT or compress
+    //   expansion on the vector paths); other widths use ctz /
+    //   clear-lowest-bit.
+    // ------------------------------------------------------------
+    template <typename Key>
+    Key* extract(Key* out, Key* outEnd, Key base) const {
+        return extractWords(0, wordCount(), out, outEnd, base);
+    }
+
+    // Extracts only words [wordBegin, wordEnd); base still refers to slot 0.
+    template <typename Key>
+    Key* extractWords(size_t wordBegin, size_t wordEnd, Key* out, Key* outEnd, Key base) const {
+        using UKey = std::make_unsigned_t<Key>;
+        forEachBlock(wordBegin, wordEnd, [&](size_t blockBegin, size_t blockEnd) {
+            if constexpr (sizeof(Key) == sizeof(uint32_t)) {
+                uint32_t* end = BitmapKernels::extract(words.data() + blockBegin, blockEnd - blockBegin,
+                                                       reinterpret_cast<uint32_t*>(out),
+                                                       reinterpret_cast<uint32_t*>(outEnd),
+                                                       static_cast<uint32_t>(base) +
+                                                           static_cast<uint32_t>(blockBegin * kWordBits));
+                out = reinterpret_cast<Key*>(end);
+            } else {
+                for (size_t wi = blockBegin; wi < blockEnd; ++wi) {
+                    uint64_t w = words[wi];
+                    UKey wordBase = static_cast<UKey>(static_cast<UKey>(base) + static_cast<UKey>(wi * kWordBits));
+                    while (w) {
+                        *out++ = static_cast<Key>(static_cast<UKey>(wordBase + static_cast<UKey>(__builtin_ctzll(w))));
+                        w &= w - 1;
+                    }
+                }
+            }
+        });
+        return out;
+    }
+
+    size_t size() const { return bits; }
+    size_t wordCount() const { return (bits + kWordBits - 1) / kWordBits; }
+    size_t capacityBytes() const { return words.capacityBytes() + summary.capacity() * sizeof(uint64_t); }
+    const uint64_t* data() const { return words.data(); }
+    uint64_t* data() { return words.data(); }
+
+private:
+    // Slot of a key relative to base, in the key's unsigned type.
+    template <typename Key>
+    static size_t offsetOf(Key key, Key base) {
+        using UKey = std::make_unsigned_t<Key>;
+        return static_cast<size_t>(static_cast<UKey>(static_cast<UKey>(key) - static_cast<UKey>(base)));
+    }
+
+    // Slice size for markAllBlocked(): 2^21 slots (256 KB, L2-sized)
+    // or larger, so there are at most kMaxSlices slices.
+    static unsigned sliceBitsFor(size_t bitCount) {
+        unsigned bitsNeeded = bitCount > 1 ? 64 - static_cast<unsigned>(__builtin_clzll(bitCount - 1)) : 0;
+        unsigned maxSliceShift = 12;  // log2(kMaxSlices)
+        return std::max(kSliceMinBits, bitsNeeded > maxSliceShift ? bitsNeeded - maxSliceShift : 0u);
+    }
+
+    size_t summaryWordCount() const {
+        size_t blocks = (wordCount() + kBlockWords - 1) / kBlockWords;
+        return (blocks + 63) / 64;
+    }
+
+    // ------------------------------------------------------------
+    // Method: forEachBlock
+    // ------------------------------------------------------------
+    // Role:
+    //   Calls visit(begin, end) for the word ranges of [wordBegin,
+    //   wordEnd) that may hold set bits: the whole range without a
+    //   summary, otherwise each non-empty 64-word block (clipped to
+    //   the range), found with ctz over the summary words.
+    // ------------------------------------------------------------
+    template <typename Visit>
+    void forEachBlock(size_t wordBegin, size_t wordEnd, Visit visit) const {
+        if (!summaryEnabled) {
+            visit(wordBegin, wordEnd);
+            return;
+        }
+        if (wordBegin >= wordEnd) return;
+        size_t firstBlock = wordBegin / kBlockWords;
+        size_t lastBlock = (wordEnd - 1) / kBlockWords;
+        for (size_t si = firstBlock / 64; si <= lastBlock / 64; ++si) {
+            uint64_t s = summary[si];
+            while (s) {
+                size_t block = si * 64 + static_cast<size_t>(__builtin_ctzll(s));
+                s &= s - 1;
+                if (block < firstBlock) continue;
+                if (block > lastBlock) break;
+                visit(std::max(wordBegin, block * kBlockWords),
+                      std::min(wordEnd, (block + 1) * kBlockWords));
+            }
+        }
+    }
+
+    BitmapBuffer words;             // Backing storage, 64 slots per word.
+    size_t bits;                    // Number of valid slots; words past them are spare capacity.
+    std::vector<uint64_t> summary;  // One bit per kBlockWords words, when enabled.
+    bool summaryEnabled;            // Maintain and use the summary level.
+};
+
+// ============================================================
+// Class: PresenceCounter
+// ------------------------------------------------------------
+// Role: The counting counterpart of PresenceBitmap, used when
+//       the input may contain duplicates. Slot i counts how often
+//       the value (base + i) occurred. The counter width is chosen
+//       up front as the narrowest one that fits:
+//         - TwoBit: 32 saturating counters per word; occurrences
+//           past 3 spill into an overflow hash map. Chosen when
+//           there are no more elements than slots, so repeats are
+//           expected to be rare.
+//         - U8 / U16 / U32: the narrowest plain counter that can
+//           hold n, so it never overflows.
+// ============================================================
+class PresenceCounter {
+public:
+    enum class Width { TwoBit, U8, U16, U32 };
+
+    // ------------------------------------------------------------
+    // Method: chooseWidth
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - elementCount: Number of values that will be added.
+    //   - slotCount:    Number of slots (max - min + 1).
+    //
+    // Returns:
+    //   The narrowest counter width suitable for this input.
+    // ------------------------------------------------------------
+    static Width chooseWidth(size_t elementCount, size_t slotCount) {
+        if (elementCount <= 3 || elementCount <= slotCount) return Width::TwoBit;
+        if (elementCount <= UINT8_MAX) return Width::U8;
+        if (elementCount <= UINT16_MAX) return Width::U16;
+        return Width::U32;
+    }
+
+    static const char* widthName(Width width) {
+        switch (width) {
+            case Width::TwoBit: return "2-bit";
+            case Width::U8:     return "uint8";
+            case Width::U16:    return "uint16";
+            default:            return "uint32";
+        }
+    }
+
+    PresenceCounter(size_t slotCount, Width counterWidth) : width(counterWidth), slots(slotCount) {
+        switch (width) {
+            case Width::TwoBit: packed.assign((slotCount + 31) / 32, 0); break;
+            case Width::U8:     counts8.assign(slotCount, 0); break;
+            case Width::U16:    counts16.assign(slotCount, 0); break;
+            case Width::U32:    counts32.assign(slotCount, 0); break;
+        }
+    }
+
+    // Records one occurrence of slot i.
+    void add(size_t i) {
+        switch (width) {
+            case Width::TwoBit: {
+                uint64_t& word = packed[i / 32];
+                unsigned shift = static_cast<unsigned>(i % 32) * 2;
+                if (((word >> shift) & 3) == 3) {
+                    ++overflow[i];
+                } else {
+                    word += uint64_t(1) << shift;
+                }
+                break;
+            }
+            case Width::U8:  ++counts8[i]; break;
+            case Width::U16: ++counts16[i]; break;
+            case Width::U32: ++counts32[i]; break;
+        }
+    }
+
+    // ------------------------------------------------------------
+    // Method: forEachRun
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - visit: Called as visit(slot, count) for every non-zero
+    //            slot, in increasing slot order.
+    //
+    // Flow:
+    //   The 2-bit layout skips zero words and finds occupied
+    //   counters with ctz over a mask holding one bit per non-zero
+    //   counter; the plain layouts scan the counter array.
+    // ------------------------------------------------------------
+    template <typename Visit>
+    void forEachRun(Visit visit) const {
+        switch (width) {
+            case Width::TwoBit:
+                for (size_t wi = 0; wi < packed.size(); ++wi) {
+                    uint64_t w = packed[wi];
+                    uint64_t occupied = (w | (w >> 1)) & 0x5555555555555555ULL;
+                    while (occupied) {
+                        unsigned shift = static_cast<unsigned>(__builtin_ctzll(occupied));
+                        size_t slot = wi * 32 + shift / 2;
+                        size_t count = (w >> shift) & 3;
+                        if (count == 3 && !overflow.empty()) {
+                            auto spill = overflow.find(slot);
+                            if (spill != overflow.end()) count += spill->second;
+                        }
+                        visit(slot, count);
+                        occupied &= occupied - 1;
+                    }
+                }
+                break;
+            case Width::U8:  scanCounts(counts8, visit); break;
+            case Width::U16: scanCounts(counts16, visit); break;
+            case Width::U32: scanCounts(counts32, visit); break;
+        }
+    }
+
+    Width getWidth() const { return width; }
+    size_t size() const { return slots; }
+
+    // Heap bytes held by the counters, overflow entries estimated.
+    size_t memoryBytes() const {
+        return packed.capacity() * sizeof(uint64_t) + counts8.capacity() + counts16.capacity() * 2 +
+               counts32.capacity() * 4 + overflow.size() * (sizeof(std::pair<size_t, size_t>) + 16);
+    }
+
+private:
+    template <typename Counter, typename Visit>
+    static void scanCounts(const std::vector<Counter>& counts, Visit& visit) {
+        for (size_t i = 0; i < counts.size(); ++i) {
+            if (counts[i]) visit(i, static_cast<size_t>(counts[i]));
+        }
+    }
+
+    Width width;                                   // Layout in use.
+    size_t slots;                                  // Number of valid slots.
+    std::vector<uint64_t> packed;                  // TwoBit: 32 counters per word.
+    std::unordered_map<size_t, size_t> overflow;   // TwoBit: occurrences past 3.
+    std::vector<uint8_t> counts8;                  // U8 counters.
+    std::vector<uint16_t> counts16;                // U16 counters.
+    std::vector<uint32_t> counts32;                // U32 counters.
+};
+
+// ============================================================
+// Class: ChunkedPresenceSet
+// ------------------------------------------------------------
+// Role: Compressed (Roaring-style) presence set over 32-bit
+//       offsets. The span is cut into 2^16-slot chunks and each
+//       non-empty chunk is one container, encoded by density:
+//         - Array:  sorted 16-bit low halves, while a chunk holds
+//                   at most 4096 values (2 bytes per value).
+//         - Bitmap: 1024 words covering the whole chunk (8 KB).
+//         - Run:    (start, length - 1) pairs, chosen by
+//                   finalize() whenever it is the smallest form.
+//       Empty chunks cost one directory entry, so memory follows
+//       n rather than k and a full 32-bit span stays in budget.
+//       Usage is insert-then-iterate: insert() every offset, call
+//       finalize() once, then extract() in increasing order.
+// ============================================================
+class ChunkedPresenceSet {
+public:
+    static constexpr unsigned kChunkBits = 16;
+    static constexpr size_t kChunkSlots = size_t(1) << kChunkBits;
+    static constexpr size_t kArrayMax = 4096;               // Largest array container.
+    static constexpr size_t kBitmapWords = kChunkSlots / 64; // Words in a bitmap container.
+
+    enum class Kind : uint8_t { Array, Bitmap, Run };
+
+    // ------------------------------------------------------------
+    // Constructor: ChunkedPresenceSet
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - span: Number of slots (offsets lie in [0, span)); at most 2^32.
+    // ------------------------------------------------------------
+    explicit ChunkedPresenceSet(unsigned long long span)
+        : directory(static_cast<size_t>((span + kChunkSlots - 1) >> kChunkBits), -1) { }
+
+    // Adds one offset. Duplicates are allowed until finalize().
+    void insert(uint32_t offset) {
+        size_t chunk = offset >> kChunkBits;
+        uint16_t low = static_cast<uint16_t>(offset);
+        if (directory[chunk] < 0) {
+            directory[chunk] = static_cast<int32_t>(containers.size());
+            containers.emplace_back();
+        }
+        Container& c = containers[static_cast<size_t>(directory[chunk])];
+        if (c.kind == Kind::Array) {
+            c.array.push_back(low);
+            if (c.array.size() > kArrayMax) toBitmap(c);
+        } else {
+            c.bitmap[low / 64] |= uint64_t(1) << (low % 64);
+        }
+    }
+
+    // ------------------------------------------------------------
+    // Method: finalize
+    // ------------------------------------------------------------
+    // Role:
+    //   Sorts and de-duplicates array containers, then re-encodes
+    //   each container in whichever of array, bitmap or run form is
+    //   smallest, and records its cardinality.
+    // ------------------------------------------------------------
+    void finalize() {
+        for (Container& c : containers) {
+            if (c.kind == Kind::Array) {
+                std::sort(c.array.begin(), c.array.end());
+                c.array.erase(std::unique(c.array.begin(), c.array.end()), c.array.end());
+                c.cardinality = c.array.size();
+            } else {
+                c.cardinality = 0;
+                for (uint64_t w : c.bitmap) c.cardinality += static_cast<size_t>(__builtin_popcountll(w));
+            }
+            size_t runs = countRuns(c);
+            size_t arrayBytes = c.cardinality * sizeof(uint16_t);
+            size_t bitmapBytes = kBitmapWords * sizeof(uint64_t);
+            size_t runBytes = runs * 2 * sizeof(uint16_t);
+            if (runBytes < std::min(arrayBytes, bitmapBytes)) {
+                toRuns(c);
+            } else if (c.kind == Kind::Bitmap && arrayBytes < bitmapBytes) {
+                toArray(c);
+            }
+            cardinalityTotal += c.cardinality;
+        }
+    }
+
+    // Number of distinct offsets; valid after finalize().
+    size_t cardinality() const { return cardinalityTotal; }
+
+    // ------------------------------------------------------------
+    // Method: extract
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - out:  Destination with room for cardinality() keys.
+    //   - base: Key represented by offset 0.
+    //
+    // Returns:
+    //   Pointer one past the last key written. Chunks are visited
+    //   in directory order, so keys come out increasing.
+    // ------------------------------------------------------------
+    template <typename Key>
+    Key* extract(Key* out, Key base) const {
+        using UKey = std::make_unsigned_t<Key>;
+        auto emit = [&](size_t offset) {
+            *out++ = static_cast<Key>(static_cast<UKey>(static_cast<UKey>(base) + static_cast<UKey>(offset)));
+        };
+        for (size_t chunk = 0; chunk < directory.size(); ++chunk) {
+            if (directory[chunk] < 0) continue;
+            const Container& c = containers[static_cast<size_t>(directory[chunk])];
+            size_t high = chunk << kChunkBits;
+            switch (c.kind) {
+                case Kind::Array:
+                    for (uint16_t low : c.array) emit(high | low);
+                    break;
+                case Kind::Bitmap:
+                    for (size_t wi = 0; wi < kBitmapWords; ++wi) {
+                        uint64_t w = c.bitmap[wi];
+                        while (w) {
+                            emit(high | (wi * 64 + static_cast<size_t>(__builtin_ctzll(w))));
+                            w &= w - 1;
+                        }
+                    }
+                    break;
+                case Kind::Run:
+                    for (const auto& run : c.runs) {
+                        for (size_t low = run.first; low <= size_t(run.first) + run.second; ++low) {
+                            emit(high | low);
+                        }
+                    }
+                    break;
+            }
+        }
+        return out;
+    }
+
+    // Approximate heap bytes held by the directory and containers.
+    size_t memoryBytes() const {
+        size_t bytes = directory.size() * sizeof(int32_t) + containers.size() * sizeof(Container);
+        for (const Container& c : containers) {
+            bytes += c.array.capacity() * sizeof(uint16_t) + c.bitmap.capacity() * sizeof(uint64_t) +
+                     c.runs.capacity() * sizeof(c.runs[0]);
+        }
+        return bytes;
+    }
+
+    // Number of containers of the given kind.
+    size_t containerCount(Kind kind) const {
+        return static_cast<size_t>(std::count_if(containers.begin(), containers.end(),
+                                                 [kind](const Container& c) { return c.kind == kind; }));
+    }
+
+private:
+    struct Container {
+        Kind kind = Kind::Array;
+        size_t cardinality = 0;
+        std::vector<uint16_t> array;                       // Array: low halves.
+        std::vector<uint64_t> bitmap;                      // Bitmap: kBitmapWords words.
+        std::vector<std::pair<uint16_t, uint16_t>> runs;   // Run: (start, length - 1).
+    };
+
+    static void toBitmap(Container& c) {
+        c.bitmap.assign(kBitmapWords, 0);
+        for (uint16_t low : c.array) c.bitmap[low / 64] |= uint64_t(1) << (low % 64);
+        std::vector<uint16_t>().swap(c.array);
+        c.kind = Kind::Bitmap;
+    }
+
+    static void toArray(Container& c) {
+        std::vector<uint16_t> array;
+        array.reserve(c.cardinality);
+        for (size_t wi = 0; wi < kBitmapWords; ++wi) {
+            for (uint64_t w = c.bitmap[wi]; w; w &= w - 1) {
+                array.push_back(static_cast<uint16_t>(wi * 64 + static_cast<size_t>(__builtin_ctzll(w))));
+            }
+        }
+        c.array.swap(array);
+        std::vector<uint64_t>().swap(c.bitmap);
+        c.kind = Kind::Array;
+    }
+
+    // Number of maximal runs of consecutive values in the container.
+    static size_t countRuns(const Container& c) {
+        size_t runs = 0;
+        if (c.kind == Kind::Array) {
+            for (size_t i = 0; i < c.array.size(); ++i) {
+                if (i == 0 || c.array[i] != c.array[i - 1] + 1) ++runs;
+            }
+        } else {
+            uint64_t carry = 0;  // Top bit of the previous word.
+            for (uint64_t w : c.bitmap) {
+                runs += static_cast<size_t>(__builtin_popcountll(w & ~((w << 1) | carry)));
+                carry = w >> 63;
+            }
+        }
+        return runs;
+    }
+
+    static void toRuns(Container& c) {
+        std::vector<std::pair<uint16_t, uint16_t>> runs;
+        auto add = [&](size_t low) {
+            if (!runs.empty() && size_t(runs.back().first) + runs.back().second + 1 == low) {
+                ++runs.back().second;
+            } else {
+                runs.push_back({ static_cast<uint16_t>(low), 0 });
+            }
+        };
+        if (c.kind == Kind::Array) {
+            for (uint16_t low : c.array) add(low);
+        } else {
+            for (size_t wi = 0; wi < kBitmapWords; ++wi) {
+                for (uint64_t w = c.bitmap[wi]; w; w &= w - 1) {
+                    add(wi * 64 + static_cast<size_t>(__builtin_ctzll(w)));
+                }
+            }
+        }
+        std::vector<uint16_t>().swap(c.array);
+        std::vector<uint64_t>().swap(c.bitmap);
+        c.runs.swap(runs);
+        c.kind = Kind::Run;
+    }
+
+    std::vector<int32_t> directory;     // Chunk -> container index, or -1 when empty.
+    std::vector<Container> containers;  // Non-empty chunks, in first-touch order.
+    size_t cardinalityTotal = 0;        // Distinct offsets, set by finalize().
+};
+
+// ============================================================
+// Class: RadixSorter
+// ------------------------------------------------------------
+// Role: Stable LSD radix sort with 11-bit digits over any item
+//       type, keyed by an unsigned offset (key - min). Only as
+//       many passes as the largest offset needs are run, so a
+//       span of k values costs ceil(log2(k) / 11) passes.
+// ============================================================
+class RadixSorter {
+public:
+    static constexpr unsigned kDigitBits = 11;
+
+    // Number of passes needed for offsets in [0, maxOffset].
+    static unsigned passesFor(unsigned long long maxOffset) {
+        unsigned bits = maxOffset ? 64 - static_cast<unsigned>(__builtin_clzll(maxOffset)) : 0;
+        return (bits + kDigitBits - 1) / kDigitBits;
+    }
+
+    // ------------------------------------------------------------
+    // Method: sort
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - items:     Items to sort in place.
+    //   - maxOffset: Largest offset any item maps to.
+    //   - offsetOf:  Maps an item to its unsigned offset.
+    //
+    // Flow:
+    //   For each 11-bit digit, histogram, exclusive prefix sum and
+    //   stable scatter into a scratch buffer, then swap buffers.
+    // ------------------------------------------------------------
+    template <typename Item, typename OffsetOf>
+    static void sort(std::vector<Item>& items, unsigned long long maxOffset, OffsetOf offsetOf) {
+        std::vector<Item> scratch(items.size());
+        sort(items.data(), scratch.data(), items.size(), maxOffset, offsetOf);
+    }
+
+    // ------------------------------------------------------------
+    // Method: sort (caller-provided scratch)
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - items:   n items, sorted in place.
+    //   - scratch: Room for n items; its contents are clobbered.
+    //
+    // Role:
+    //   Same as above without any heap allocation: the histogram
+    //   lives on the stack, and after an odd number of passes the
+    //   result is moved back from scratch into items.
+    // ------------------------------------------------------------
+    template <typename Item, typename OffsetOf>
+    static void sort(Item* items, Item* scratch, size_t n, unsigned long long maxOffset,
+                     OffsetOf offsetOf) {
+        constexpr size_t kBuckets = size_t(1) << kDigitBits;
+        std::array<size_t, kBuckets> offsets;
+        unsigned passes = passesFor(maxOffset);
+        Item* from = items;
+        Item* to = scratch;
+        for (unsigned pass = 0; pass < passes; ++pass) {
+            unsigned shift = pass * kDigitBits;
+            offsets.fill(0);
+            for (size_t i = 0; i < n; ++i) {
+                ++offsets[(offsetOf(from[i]) >> shift) & (kBuckets - 1)];
+            }
+            size_t running = 0;
+            for (size_t& offset : offsets) {
+                size_t bucketSize = offset;
+                offset = running;
+                running += bucketSize;
+            }
+            for (size_t i = 0; i < n; ++i) {
+                to[offsets[(offsetOf(from[i]) >> shift) & (kBuckets - 1)]++] = std::move(from[i]);
+            }
+            std::swap(from, to);
+        }
+        if (from != items) {
+            std::move(from, from + n, items);
+        }
+    }
+};
+
+#ifdef BIGSORT_WITH_CUDA
+// Supplied by a separately built device library; none ships here.
+extern "C" size_t bigsortGpuMemoryBytes();
+extern "C" size_t bigsortGpuSort32(const uint32_t* keys, size_t n, uint32_t base, unsigned long long span,
+                                   uint32_t* out);
+extern "C" size_t bigsortGpuSort64(const uint64_t* keys, size_t n, uint64_t base, unsigned long long span,
+                                   uint64_t* out);
+#endif
+
+// ============================================================
+// Class: GpuBackend
+// ------------------------------------------------------------
+// Role: Host-side hook for a device backend of the bitmap path.
+//       No device code is part of this tree: a build with
+//       -DBIGSORT_WITH_CUDA must link an object that defines the
+//       three extern "C" entry points above (free device memory,
+//       and a 32- and a 64-bit sort returning the distinct keys
+//       ascending). Without the build flag, or without a usable
+//       device, available() is false and SortPlanner never picks
+//       the GPU.
+// ============================================================
+class GpuBackend {
+public:
+    // Free device memory at first use; 0 when there is no backend.
+    static size_t memoryBytes() {
+#ifdef BIGSORT_WITH_CUDA
+        static const size_t bytes = bigsortGpuMemoryBytes();
+        return bytes;
+#else
+        return 0;
+#endif
+    }
+
+    static bool available() { return memoryBytes() != 0; }
+
+    // Whether Key can go to the device (32- and 64-bit integers).
+    template <typename Key>
+    static constexpr bool supports() {
+        return std::is_integral_v<Key> && (sizeof(Key) == 4 || sizeof(Key) == 8);
+    }
+
+    // ------------------------------------------------------------
+    // Method: sort
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - keys, n: Input keys.
+    //   - base:    Smallest key; offsets are taken from it.
+    //   - span:    max - min + 1.
+    //   - out:     Room for n keys.
+    //
+    // Returns:
+    //   The number of distinct keys written to out, ascending.
+    // ------------------------------------------------------------
+    template <typename Key>
+    static size_t sort(const Key* keys, size_t n, Key base, unsigned long long span, Key* out) {
+        static_assert(supports<Key>(), "the GPU backend sorts 32- and 64-bit integer keys");
+#ifdef BIGSORT_WITH_CUDA
+        using UKey = std::make_unsigned_t<Key>;
+        if constexpr (sizeof(Key) == 4) {
+            return bigsortGpuSort32(reinterpret_cast<const uint32_t*>(keys), n, static_cast<UKey>(base), span,
+                                    reinterpret_cast<uint32_t*>(out));
+        } else {
+            return bigsortGpuSort64(reinterpret_cast<const uint64_t*>(keys), n, static_cast<UKey>(base), span,
+                                    reinterpret_cast<uint64_t*>(out));
+        }
+#else
+        (void)keys; (void)n; (void)base; (void)span; (void)out;
+        std::cerr << "Error: this build has no GPU backend (define BIGSORT_WITH_CUDA).\n";
+        exit(1);
+#endif
+    }
+};
+
+// ============================================================
+// Class: SortPlanner
+// ------------------------------------------------------------
+// Role: Chooses between the bitmap path, chunked containers,
+//       radix sort and a comparison sort (and the GPU bitmap path,
+//       when GpuBackend is available) from the input size n
+//       and key span k,
+//       using a linear cost model whose coefficients can be
+//       calibrated on the running machine (see
+//       BigSorter::calibratePlanner). Estimates are in ns.
+// ============================================================
+class SortPlanner {
+public:
+    enum class Strategy { Auto, Bitmap, Radix, Comparison, Chunked, Gpu };
+
+    // Per-machine cost coefficients, in nanoseconds.
+    struct CostModel {
+        double bitmapPerElement = 3.0;    // Mark + extract, per input element.
+        double bitmapPerWord = 0.4;       // Allocate, zero and scan, per 64-slot word.
+        double radixPerElementPass = 1.5; // One histogram + scatter pass, per element.
+        double comparePerElementLog = 1.2; // Comparison sort, per element per log2(n).
+        double chunkedPerElement = 6.0;   // Container insert + finalize + extract, per element.
+        double gpuFixed = 2.0e5;          // Device allocation, launches and synchronization, per sort.
+        double gpuPerByte = 0.1;          // PCIe transfer, per key byte sent or returned (~10 GB/s).
+        double gpuPerWord = 0.01;         // Device zero, scan and compaction, per 64-slot word.
+    };
+
+    // What the planner needs to know about one sort.
+    struct Input {
+        size_t n;                    // Number of elements.
+        unsigned long long k;        // Key span, max - min + 1 (at least 1).
+        unsigned long long scanSlots; // Slots the bitmap scan touches (k, or fewer with a summary).
+        unsigned counterBits;        // Bits per slot on the bitmap path (1 = presence bitmap).
+        unsigned threads;            // Threads the bitmap path may use.
+        bool keysOnly;               // Integer keys without counting (Chunked is available).
+        unsigned gpuKeyBytes = 0;    // Key width if the GPU path may run this sort, else 0.
+        size_t budgetBytes = 0;      // Bitmap byte budget for this sort; 0 uses memoryBudget().
+    };
+
+    // Result of planning one sort.
+    struct Plan {
+        Strategy strategy;
+        double estimatedNs;
+    };
+
+    static const char* strategyName(Strategy strategy) {
+        switch (strategy) {
+            case Strategy::Bitmap:     return "bitmap";
+            case Strategy::Radix:      return "radix";
+            case Strategy::Comparison: return "comparison";
+            case Strategy::Chunked:    return "chunked";
+            case Strategy::Gpu:        return "gpu";
+            default:                   return "auto";
+        }
+    }
+
+    // Inverse of strategyName(); false for an unknown name.
+    static bool parseStrategy(const std::string& name, Strategy& strategy) {
+        for (Strategy candidate : { Strategy::Auto, Strategy::Bitmap, Strategy::Radix,
+                                    Strategy::Comparison, Strategy::Chunked, Strategy::Gpu }) {
+            if (name == strategyName(candidate)) {
+                strategy = candidate;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static CostModel& model() {
+        static CostModel current;
+        return current;
+    }
+
+    // ------------------------------------------------------------
+    // Method: memoryBudget
+    // ------------------------------------------------------------
+    // Returns:
+    //   A reference to the byte budget for the bitmap path (0 means
+    //   unlimited). Spans whose bitmap would exceed it are sorted
+    //   with the chunked containers, radix or comparison instead.
+    //   Input::budgetBytes overrides it for a single sort, so
+    //   callers with their own limit need not touch this shared
+    //   setting.
+    // ------------------------------------------------------------
+    static size_t& memoryBudget() {
+        static size_t bytes = 0;
+        return bytes;
+    }
+
+    // Bytes the bitmap path would allocate for this input.
+    static double bitmapBytes(const Input& input) {
+        return static_cast<double>(input.k) * input.counterBits / 8.0;
+    }
+
+    // ------------------------------------------------------------
+    // Method: estimate
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - strategy: Path to cost (not Auto).
+    //   - input:    Shape of the sort.
+    //
+    // Returns:
+    //   Estimated running time in nanoseconds.
+    // ------------------------------------------------------------
+    static double estimate(Strategy strategy, const Input& input) {
+        const CostModel& m = model();
+        double dn = static_cast<double>(input.n);
+        switch (strategy) {
+            case Strategy::Bitmap: {
+                double words = static_cast<double>(input.scanSlots) * input.counterBits / 64.0;
+                return (m.bitmapPerElement * dn + m.bitmapPerWord * words) / std::max(1u, input.threads);
+            }
+            case Strategy::Radix:
+                // Copy in and out counts as roughly one extra pass.
+                return m.radixPerElementPass * dn * (RadixSorter::passesFor(input.k - 1) + 1);
+            case Strategy::Chunked:
+                // One directory entry per 2^16 slots of span.
+                return m.chunkedPerElement * dn +
+                       m.bitmapPerWord * static_cast<double>(input.k >> 16);
+            case Strategy::Gpu:
+                // Keys cross PCIe both ways (at most n come back); the
+                // bitmap stays on the device.
+                return m.gpuFixed + m.gpuPerByte * 2.0 * dn * input.gpuKeyBytes +
+                       m.gpuPerWord * static_cast<double>(input.k) / 64.0;
+            default:
+                return m.comparePerElementLog * dn * std::max(1.0, std::log2(dn));
+        }
+    }
+
+    // ------------------------------------------------------------
+    // Method: feasible
+    // ------------------------------------------------------------
+    // Returns:
+    //   Whether the strategy can run this input at all: the bitmap
+    //   must be addressable and within the memory budget, and the
+    //   chunked containers need integer keys, no counting, and a
+    //   span of at most 2^32. The GPU path needs a device with
+    //   room for the bitmap and the keys.
+    // ------------------------------------------------------------
+    static bool feasible(Strategy strategy, const Input& input) {
+        switch (strategy) {
+            case Strategy::Bitmap: {
+                size_t budget = input.budgetBytes ? input.budgetBytes : memoryBudget();
+                return input.k < (1ULL << 62) &&
+                       (budget == 0 || bitmapBytes(input) <= static_cast<double>(budget));
+            }
+            case Strategy::Chunked:
+                return input.keysOnly && input.k <= (1ULL << 32);
+            case Strategy::Gpu:
+                // Bitmap plus input and output keys must fit on the device.
+                return input.gpuKeyBytes != 0 && GpuBackend::available() && input.k < (1ULL << 62) &&
+                       input.k / 8.0 + 2.0 * static_cast<double>(input.n) * input.gpuKeyBytes <
+                           0.9 * static_cast<double>(GpuBackend::memoryBytes());
+            case Strategy::Auto:
+                return false;
+            default:
+                return true;
+        }
+    }
+
+    // ------------------------------------------------------------
+    // Method: plan
+    // ------------------------------------------------------------
+    // Returns:
+    //   The cheapest feasible strategy for the input and its
+    //   estimated cost.
+    // ------------------------------------------------------------
+    static Plan plan(const Input& input) {
+        Plan best = { Strategy::Comparison, estimate(Strategy::Comparison, input) };
+        for (Strategy strategy : { Strategy::Radix, Strategy::Chunked, Strategy::Bitmap, Strategy::Gpu }) {
+            if (!feasible(strategy, input)) continue;
+            double cost = estimate(strategy, input);
+            if (cost < best.estimatedNs) best = { strategy, cost };
+        }
+        return best;
+    }
+
+    // Plans with a forced strategy when it is feasible, else as Auto.
+    static Plan plan(const Input& input, Strategy forced) {
+        if (feasible(forced, input)) return { forced, estimate(forced, input) };
+        return plan(input);
+    }
+};
+
+// ============================================================
+// Struct: ValueRun
+// ------------------------------------------------------------
+// Role: One entry of the run-length output of the counting
+//       mode: a distinct key and how many times it occurred.
+// ============================================================
+template <typename Key = int>
+struct ValueRun {
+    Key value;
+    size_t count;
+
+    bool operator==(const ValueRun& other) const {
+        return value == other.value && count == other.count;
+    }
+};
+
+// ============================================================
+// Enum: SortOrder
+// ------------------------------------------------------------
+// Role: Direction of a partial sort (BigSorter::sortTopK).
+// ============================================================
+enum class SortOrder { Ascending, Descending };
+
+// ============================================================
+// Struct: IdentityKey
+// ------------------------------------------------------------
+// Role: Default key extractor for BigSorter: the element is its
+//       own key.
+// ============================================================
+struct IdentityKey {
+    template <typename T>
+    constexpr const T& operator()(const T& value) const { return value; }
+};
+
+// ============================================================
+// Class: FixedPresenceBitmap
+// ------------------------------------------------------------
+// Role: Presence bitmap for keys of 16 bits or fewer, covering
+//       the type's whole range with a constexpr-sized array
+//       (8 KB for 16-bit keys, 32 bytes for 8-bit keys). No
+//       min/max pass or heap allocation is needed.
+// ============================================================
+template <typename Key>
+class FixedPresenceBitmap {
+public:
+    static_assert(sizeof(Key) <= 2, "FixedPresenceBitmap is for 8- and 16-bit keys");
+    using UKey = std::make_unsigned_t<Key>;
+    static constexpr size_t kBits = size_t(1) << (8 * sizeof(Key));
+    static constexpr size_t kWords = (kBits + 63) / 64;
+
+    // Slot of a key: its unsigned representation, bias-shifted so
+    // signed keys keep their order.
+    static constexpr size_t slotOf(Key key) {
+        return static_cast<size_t>(static_cast<UKey>(
+            static_cast<UKey>(key) - static_cast<UKey>(std::numeric_limits<Key>::min())));
+    }
+
+    static constexpr Key keyOf(size_t slot) {
+        return static_cast<Key>(static_cast<UKey>(
+            static_cast<UKey>(slot) + static_cast<UKey>(std::numeric_limits<Key>::min())));
+    }
+
+    void set(Key key) {
+        size_t slot = slotOf(key);
+        words[slot / 64] |= uint64_t(1) << (slot % 64);
+    }
+
+    // Writes every present key in increasing order; returns the new end.
+    Key* extract(Key* out) const {
+        for (size_t wi = 0; wi < kWords; ++wi) {
+            uint64_t w = words[wi];
+            while (w) {
+                *out++ = keyOf(wi * 64 + static_cast<size_t>(__builtin_ctzll(w)));
+                w &= w - 1;
+            }
+        }
+        return out;
+    }
+
+    size_t count() const {
+        size_t total = 0;
+        for (uint64_t w : words) total += static_cast<size_t>(__builtin_popcountll(w));
+        return total;
+    }
+
+private:
+    std::array<uint64_t, kWords> words{};  // One bit per possible key.
+};
+
+// ============================================================
+// Class: MappedFile
+// ------------------------------------------------------------
+// Role: Owns one memory-mapped file, either an existing file
+//       mapped read-only or a new file of a given size mapped
+//       read-write. Sorting straight between two mappings lets
+//       bigSort() read the input and write the output with no
+//       intermediate copies or text parsing.
+// ============================================================
+class MappedFile {
+public:
+    // ------------------------------------------------------------
+    // Method: openRead
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - path: Existing file to map read-only.
+    //
+    // Role:
+    //   Maps the whole file and hints the kernel that it will be
+    //   read once, front to back, so readahead can run ahead of
+    //   the marking pass.
+    // ------------------------------------------------------------
+    static MappedFile openRead(const std::string& path) {
+        MappedFile file(path, ::open(path.c_str(), O_RDONLY));
+        struct stat info;
+        if (::fstat(file.fd, &info) != 0) file.fail("cannot stat");
+        file.map(static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE);
+#ifdef MADV_SEQUENTIAL
+        if (file.bytes) ::madvise(file.base, file.bytes, MADV_SEQUENTIAL);
+#endif
+        return file;
+    }
+
+    // ------------------------------------------------------------
+    // Method: create
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - path:  File to create (or truncate) and map read-write.
+    //   - bytes: Size of the new file.
+    //
+    // Role:
+    //   Sizes the file up front and asks for transparent huge
+    //   pages so writing a large sorted output takes fewer faults.
+    // ------------------------------------------------------------
+    static MappedFile create(const std::string& path, size_t bytes) {
+        MappedFile file(path, ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644));
+        if (::ftruncate(file.fd, static_cast<off_t>(bytes)) != 0) file.fail("cannot size");
+        file.map(bytes, PROT_READ | PROT_WRITE, MAP_SHARED);
+#ifdef MADV_HUGEPAGE
+        if (file.bytes) ::madvise(file.base, file.bytes, MADV_HUGEPAGE);
+#endif
+        return file;
+    }
+
+    // True if path names this file (same device and inode), e.g.
+    // an output path that would truncate a mapped input.
+    bool isSameFile(const std::string& otherPath) const {
+        struct stat mine, other;
+        return ::fstat(fd, &mine) == 0 && ::stat(otherPath.c_str(), &other) == 0 &&
+               mine.st_dev == other.st_dev && mine.st_ino == other.st_ino;
+    }
+
+    MappedFile(MappedFile&& other) noexcept
+        : path(std::move(other.path)), fd(other.fd), base(other.base), bytes(other.bytes) {
+        other.fd = -1;
+        other.base = nullptr;
+        other.bytes = 0;
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        unmap();
+        if (fd >= 0) ::close(fd);
+    }
+
+    // ------------------------------------------------------------
+    // Method: truncate
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - newBytes: Final file size (at most size()).
+    //
+    // Role:
+    //   Unmaps the file and cuts it to newBytes, for outputs sized
+    //   for the worst case before duplicates were dropped.
+    // ------------------------------------------------------------
+    void truncate(size_t newBytes) {
+        unmap();
+        if (::ftruncate(fd, static_cast<off_t>(newBytes)) != 0) fail("cannot truncate");
+    }
+
+    // Typed view of the mapping; the size must be a multiple of Key.
+    template <typename Key>
+    std::span<Key> as() const {
+        if (bytes % sizeof(Key) != 0) {
+            std::cerr << "Error: " << path << " is not a whole number of "
+                      << sizeof(Key) * 8 << "-bit keys.\n";
+            exit(1);
+        }
+        return std::span<Key>(static_cast<Key*>(base), bytes / sizeof(Key));
+    }
+
+    size_t size() const { return bytes; }
+
+    // madvise() over the whole mapping, e.g. to undo openRead()'s
+    // MADV_SEQUENTIAL for random access.
+    void advise(int advice) const {
+        if (base) ::madvise(base, bytes, advice);
+    }
+
+private:
+    MappedFile(std::string filePath, int descriptor)
+        : path(std::move(filePath)), fd(descriptor), base(nullptr), bytes(0) {
+        if (fd < 0) fail("cannot open");
+    }
+
+    void map(size_t length, int protection, int flags) {
+        bytes = length;
+        if (!bytes) return;  // mmap rejects empty mappings.
+        base = ::mmap(nullptr, bytes, protection, flags, fd, 0);
+        if (base == MAP_FAILED) {
+            base = nullptr;
+            fail("cannot map");
+        }
+    }
+
+    void unmap() {
+        if (base) ::munmap(base, bytes);
+        base = nullptr;
+        bytes = 0;
+    }
+
+    [[noreturn]] void fail(const char* what) const {
+        std::cerr << "Error: " << what << " " << path << ".\n";
+        exit(1);
+    }
+
+    std::string path;  // For error messages.
+    int fd;            // Open descriptor, -1 once moved from.
+    void* base;        // Start of the mapping, or nullptr.
+    size_t bytes;      // Mapped length.
+};
+
+// ============================================================
+// Class: PresenceIndex
+// ------------------------------------------------------------
+// Role: Read-only sorted view of a set of integer keys, kept as
+//       the presence bitmap itself instead of a materialized
+//       sorted array. A prefix table holds the number of keys
+//       before each kBlockWords-word block, so:
+//         - contains(x) is one bit test,
+//         - rank(x) is O(kBlockWords) popcounts,
+//         - select(i) is a binary search plus one block scan,
+//         - iteration skips empty blocks and yields keys in order.
+//       Consumers that read 1% of the output pay for 1% of it.
+//
+// Usage:
+//   PresenceIndex<uint32_t> index(keys);
+//   for (uint32_t key : index.range(a, b)) { ... }
+//   uint32_t median = index.select(index.size() / 2);
+// ============================================================
+template <typename Key>
+class PresenceIndex {
+public:
+    static_assert(std::is_integral_v<Key>, "PresenceIndex requires integer keys");
+
+    // ------------------------------------------------------------
+    // Class: PresenceIndex::iterator
+    // ------------------------------------------------------------
+    // Role: Forward iterator over the keys in ascending order. It
+    //       holds the current word and the bits of it not yet
+    //       visited; dereferencing decodes the lowest of them.
+    // ------------------------------------------------------------
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Key;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Key*;
+        using reference = Key;
+
+        iterator() : index(nullptr), word(0), bits(0) { }
+
+        Key operator*() const { return index->keyAt(word, static_cast<size_t>(__builtin_ctzll(bits))); }
+
+        iterator& operator++() {
+            bits &= bits - 1;
+            if (!bits) *this = index->firstFrom(word + 1);
+            return *this;
+        }
+
+        iterator operator++(int) {
+            iterator before = *this;
+            ++*this;
+            return before;
+        }
+
+        bool operator==(const iterator& other) const { return word == other.word && bits == other.bits; }
+        bool operator!=(const iterator& other) const { return !(*this == other); }
+
+    private:
+        friend class PresenceIndex;
+        iterator(const PresenceIndex* owner, size_t wordIndex, uint64_t remaining)
+            : index(owner), word(wordIndex), bits(remaining) { }
+
+        const PresenceIndex* index;  // Index being walked.
+        size_t word;                 // Current word; wordCount() at the end.
+        uint64_t bits;               // Unvisited set bits of the current word.
+    };
+
+    // Half-open iterator pair usable in a range-for.
+    struct Range {
+        iterator first;
+        iterator last;
+        iterator begin() const { return first; }
+        iterator end() const { return last; }
+    };
+
+    // ------------------------------------------------------------
+    // Constructor: PresenceIndex
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - keys: Keys to index, in any order; duplicates collapse.
+    //
+    // Flow:
+    //   1. Find the minimum and maximum key.
+    //   2. Mark every key into a bitmap of max - min + 1 slots.
+    //   3. Build the per-block prefix table in one popcount pass.
+    // ------------------------------------------------------------
+    explicit PresenceIndex(std::span<const Key> keys)
+        : base(0), top(0), wordTotal(0), blocks(0), mappedWords(nullptr), mappedRanks(nullptr) {
+        if (keys.empty()) {
+            blockRank.assign(1, 0);
+            return;
+        }
+        // Step 1: Find the key bounds.
+        auto bounds = std::minmax_element(keys.begin(), keys.end());
+        allocate(*bounds.first, *bounds.second);
+
+        // Step 2: Mark the keys.
+        exists.markAll(keys.data(), keys.size(), base);
+
+        // Step 3: Prefix counts, blockRank[b] = keys before block b.
+        buildRanks();
+    }
+
+    // ------------------------------------------------------------
+    // Method: save
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - path: File to write.
+    //
+    // Role:
+    //   Writes the index in the on-disk format load() maps back:
+    //     - a 64-byte Header (magic, version, key type, block
+    //       size, base and top keys, word and block counts),
+    //     - the bitmap words, 8-byte aligned,
+    //     - the blockRank prefix table (blocks + 1 entries).
+    //   All fields are little-endian 64-bit words, as in memory.
+    // ------------------------------------------------------------
+    void save(const std::string& path) const {
+        Header header = headerFor();
+        FILE* file = std::fopen(path.c_str(), "wb");
+        if (!file) {
+            std::cerr << "Error: cannot create " << path << ".\n";
+            exit(1);
+        }
+        bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+                  (wordTotal == 0 || std::fwrite(words(), sizeof(uint64_t), wordTotal, file) == wordTotal) &&
+                  std::fwrite(ranks(), sizeof(uint64_t), blocks + 1, file) == blocks + 1;
+        if (std::fclose(file) != 0 || !ok) {
+            std::cerr << "Error: failed writing " << path << ".\n";
+            exit(1);
+        }
+    }
+
+    // ------------------------------------------------------------
+    // Method: load
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - path: A file written by save() for the same Key type.
+    //
+    // Returns:
+    //   An index that queries the mapped file in place. Loading
+    //   only maps the file and checks the header, so it is O(1)
+    //   in the key count; pages fault in as queries touch them.
+    //   Copies share the mapping. A bad or mismatched file is
+    //   fatal.
+    // ------------------------------------------------------------
+    static PresenceIndex load(const std::string& path) {
+        auto file = std::make_shared<MappedFile>(MappedFile::openRead(path));
+        file->advise(MADV_NORMAL);  // Queries are not one front-to-back pass.
+        Header header{};
+        bool whole = file->size() >= sizeof(Header) && file->size() % sizeof(uint64_t) == 0;
+        std::span<const uint64_t> data = whole ? file->as<const uint64_t>() : std::span<const uint64_t>();
+        if (whole) std::memcpy(&header, data.data(), sizeof(Header));
+        Header expected = PresenceIndex(std::span<const Key>()).headerFor();
+        size_t headerWords = sizeof(Header) / sizeof(uint64_t);
+        bool valid = whole &&
+                     std::memcmp(header.magic, expected.magic, sizeof(header.magic)) == 0 &&
+                     header.version == expected.version && header.keyBytes == expected.keyBytes &&
+                     header.keySigned == expected.keySigned && header.blockWords == expected.blockWords;
+        if (!valid) {
+            std::cerr << "Error: " << path << " is not a PresenceIndex file for this key type.\n";
+            exit(1);
+        }
+
+        // The sizes must follow from base and top and match the file
+        // exactly, or queries would read past the mapping. Checking
+        // the first and last rank keeps load() O(1).
+        uint64_t payloadWords = data.size() - headerWords;
+        UKey maxBits = std::numeric_limits<UKey>::max();
+        Key low = static_cast<Key>(static_cast<UKey>(header.base));
+        Key high = static_cast<Key>(static_cast<UKey>(header.top));
+        uint64_t spanWords = header.wordCount == 0 ? 0
+            : static_cast<UKey>(static_cast<UKey>(high) - static_cast<UKey>(low)) / kWordBits + 1;
+        bool consistent = header.base <= maxBits && header.top <= maxBits &&
+                          (header.wordCount == 0 ? header.base == 0 && header.top == 0 : low <= high) &&
+                          header.wordCount == spanWords && header.wordCount < payloadWords &&
+                          header.blockCount == (header.wordCount + kBlockWords - 1) / kBlockWords &&
+                          payloadWords == header.wordCount + header.blockCount + 1;
+        const uint64_t* rankTable = data.data() + headerWords + (consistent ? header.wordCount : 0);
+        if (!consistent || rankTable[0] != 0 || rankTable[header.blockCount] > header.wordCount * kWordBits) {
+            std::cerr << "Error: " << path << " is a truncated or corrupt PresenceIndex file.\n";
+            exit(1);
+        }
+        PresenceIndex index(std::span<const Key>{});
+        index.base = static_cast<Key>(static_cast<UKey>(header.base));
+        index.top = static_cast<Key>(static_cast<UKey>(header.top));
+        index.wordTotal = static_cast<size_t>(header.wordCount);
+        index.blocks = static_cast<size_t>(header.blockCount);
+        index.mappedWords = data.data() + headerWords;
+        index.mappedRanks = index.mappedWords + index.wordTotal;
+        index.mapping = std::move(file);
+        return index;
+    }
+
+    // ------------------------------------------------------------
+    // Method: merge
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - batch: New keys, in any order.
+    //
+    // Role:
+    //   Adds batch to the index. The range widens to cover it; the
+    //   old words are copied over shifted when the base moves, the
+    //   batch is marked, and the prefix table is rebuilt, so the
+    //   cost is one pass over the bitmap, not a re-sort. A loaded
+    //   index becomes an in-memory one (save() it to persist).
+    // ------------------------------------------------------------
+    void merge(std::span<const Key> batch) {
+        if (batch.empty()) return;
+        auto bounds = std::minmax_element(batch.begin(), batch.end());
+        Key low = empty() ? *bounds.first : std::min(base, *bounds.first);
+        Key high = empty() ? *bounds.second : std::max(top, *bounds.second);
+
+        PresenceIndex merged(std::span<const Key>{});
+        merged.allocate(low, high);
+        if (!empty()) {
+            // Old slot s lands at s + shift in the merged bitmap.
+            size_t shift = merged.offsetOf(base);
+            uint64_t* target = merged.exists.data();
+            const uint64_t* source = words();
+            size_t wordShift = shift / kWordBits;
+            unsigned bitShift = static_cast<unsigned>(shift % kWordBits);
+            for (size_t wi = 0; wi < wordTotal; ++wi) {
+                uint64_t w = source[wi];
+                if (!w) continue;
+                target[wi + wordShift] |= w << bitShift;
+                if (bitShift) {
+                    uint64_t carry = w >> (kWordBits - bitShift);
+                    if (carry) target[wi + wordShift + 1] |= carry;
+                }
+            }
+        }
+        merged.exists.markAll(batch.data(), batch.size(), merged.base);
+        merged.buildRanks();
+        *this = std::move(merged);
+    }
+
+    // Number of distinct keys.
+    size_t size() const { return static_cast<size_t>(ranks()[blocks]); }
+    bool empty() const { return size() == 0; }
+
+    // True when the index queries a mapped file (see load()).
+    bool isMapped() const { return mapping != nullptr; }
+
+    iterator begin() const { return firstFrom(0); }
+    iterator end() const { return iterator(this, wordTotal, 0); }
+
+    // ------------------------------------------------------------
+    // Method: rank
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - x: Any key value.
+    //
+    // Returns:
+    //   The number of indexed keys strictly less than x.
+    // ------------------------------------------------------------
+    size_t rank(Key x) const {
+        if (empty() || x <= base) return 0;
+        if (x > top) return size();
+        size_t offset = offsetOf(x);
+        size_t word = offset / kWordBits;
+        size_t block = word / kBlockWords;
+        const uint64_t* bits = words();
+        size_t total = static_cast<size_t>(ranks()[block]) +
+                       BitmapKernels::popcount(bits + block * kBlockWords, word - block * kBlockWords);
+        uint64_t below = (uint64_t(1) << (offset % kWordBits)) - 1;
+        return total + static_cast<size_t>(__builtin_popcountll(bits[word] & below));
+    }
+
+    // ------------------------------------------------------------
+    // Method: select
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - i: Zero-based position, less than size().
+    //
+    // Returns:
+    //   The i-th smallest key, i.e. the key with rank(key) == i.
+    // ------------------------------------------------------------
+    Key select(size_t i) const {
+        if (i >= size()) {
+            std::cerr << "Error: PresenceIndex::select(" << i << ") past size " << size() << ".\n";
+            exit(1);
+        }
+        // Find the block holding the i-th key, then the word within it.
+        const uint64_t* rankTable = ranks();
+        size_t block = static_cast<size_t>(
+            std::upper_bound(rankTable, rankTable + blocks + 1, static_cast<uint64_t>(i)) - rankTable) - 1;
+        size_t remaining = i - static_cast<size_t>(rankTable[block]);
+        const uint64_t* bits = words();
+        size_t word = block * kBlockWords;
+        for (;; ++word) {
+            if (word == wordTotal) {
+                // Only an inconsistent rank table in a loaded file gets here.
+                std::cerr << "Error: PresenceIndex rank table disagrees with its bitmap.\n";
+                exit(1);
+            }
+            size_t inWord = static_cast<size_t>(__builtin_popcountll(bits[word]));
+            if (remaining < inWord) break;
+            remaining -= inWord;
+        }
+        // Drop the lower set bits to reach the wanted one.
+        uint64_t w = bits[word];
+        for (; remaining > 0; --remaining) w &= w - 1;
+        return keyAt(word, static_cast<size_t>(__builtin_ctzll(w)));
+    }
+
+    bool contains(Key x) const {
+        if (empty() || x < base || x > top) return false;
+        size_t offset = offsetOf(x);
+        return (words()[offset / kWordBits] >> (offset % kWordBits)) & 1;
+    }
+
+    // Iterator to the first key >= x (end() if none).
+    iterator lower_bound(Key x) const {
+        if (empty() || x <= base) return begin();
+        if (x > top) return end();
+        size_t offset = offsetOf(x);
+        size_t word = offset / kWordBits;
+        uint64_t bits = words()[word] & (~uint64_t(0) << (offset % kWordBits));
+        return bits ? iterator(this, word, bits) : firstFrom(word + 1);
+    }
+
+    // Iterator to the first key > x (end() if none).
+    iterator upper_bound(Key x) const {
+        if (empty() || x >= top) return end();
+        return lower_bound(static_cast<Key>(x + 1));
+    }
+
+    // Keys in the closed interval [low, high], in order.
+    Range range(Key low, Key high) const {
+        if (high < low) return { end(), end() };
+        return { lower_bound(low), upper_bound(high) };
+    }
+
+private:
+    using UKey = std::make_unsigned_t<Key>;
+    static constexpr size_t kWordBits = PresenceBitmap::kWordBits;
+    static constexpr size_t kBlockWords = PresenceBitmap::kBlockWords;
+    static constexpr uint64_t kFormatVersion = 1;
+
+    // On-disk header; eight 64-bit fields, so the words that
+    // follow it stay 8-byte aligned in the mapping.
+    struct Header {
+        char magic[8];        // "BSINDEX\0".
+        uint64_t version;     // kFormatVersion.
+        uint32_t keyBytes;    // sizeof(Key).
+        uint32_t keySigned;   // 1 for signed Key types.
+        uint64_t blockWords;  // Words per blockRank entry (kBlockWords).
+        uint64_t base;        // Smallest key, as UKey bits.
+        uint64_t top;         // Largest key, as UKey bits.
+        uint64_t wordCount;   // Bitmap words that follow.
+        uint64_t blockCount;  // Blocks; blockRank has blockCount + 1 entries.
+    };
+    static_assert(sizeof(Header) == 64, "PresenceIndex header must stay 64 bytes");
+
+    Header headerFor() const {
+        Header header{};
+        std::memcpy(header.magic, "BSINDEX", 8);
+        header.version = kFormatVersion;
+        header.keyBytes = sizeof(Key);
+        header.keySigned = std::is_signed_v<Key> ? 1 : 0;
+        header.blockWords = kBlockWords;
+        header.base = static_cast<UKey>(base);
+        header.top = static_cast<UKey>(top);
+        header.wordCount = wordTotal;
+        header.blockCount = blocks;
+        return header;
+    }
+
+    // Bitmap words and prefix table, from memory or the mapping.
+    const uint64_t* words() const { return mapping ? mappedWords : exists.data(); }
+    const uint64_t* ranks() const { return mapping ? mappedRanks : blockRank.data(); }
+
+    // Sizes an all-zero in-memory bitmap for [low, high].
+    void allocate(Key low, Key high) {
+        base = low;
+        top = high;
+        // The span is fixed by the keys being indexed.
+        size_t span = PresenceBitmap::spanFor(low, high);
+        if (span == 0) {
+            std::cerr << "Error: key span is too large for a PresenceIndex bitmap.\n";
+            exit(1);
+        }
+        exists.reset(span);
+        wordTotal = exists.wordCount();
+        blocks = (wordTotal + kBlockWords - 1) / kBlockWords;
+        mapping.reset();
+    }
+
+    // blockRank[b] = keys before block b, one popcount pass.
+    void buildRanks() {
+        blockRank.assign(blocks + 1, 0);
+        for (size_t b = 0; b < blocks; ++b) {
+            size_t first = b * kBlockWords;
+            blockRank[b + 1] = blockRank[b] +
+                BitmapKernels::popcount(exists.data() + first, std::min(wordTotal, first + kBlockWords) - first);
+        }
+    }
+
+    size_t offsetOf(Key key) const {
+        return static_cast<size_t>(static_cast<UKey>(static_cast<UKey>(key) - static_cast<UKey>(base)));
+    }
+
+    Key keyAt(size_t word, size_t bit) const {
+        return static_cast<Key>(static_cast<UKey>(static_cast<UKey>(base) +
+                                                  static_cast<UKey>(word * kWordBits + bit)));
+    }
+
+    // Iterator at the first set bit in or after word, skipping
+    // blocks the prefix table shows to be empty.
+    iterator firstFrom(size_t word) const {
+        const uint64_t* bits = words();
+        const uint64_t* rankTable = ranks();
+        while (word < wordTotal) {
+            size_t block = word / kBlockWords;
+            if (rankTable[block + 1] == rankTable[block]) {
+                word = (block + 1) * kBlockWords;
+                continue;
+            }
+            size_t blockEnd = std::min(wordTotal, (block + 1) * kBlockWords);
+            for (; word < blockEnd; ++word) {
+                if (bits[word]) return iterator(this, word, bits[word]);
+            }
+        }
+        return end();
+    }
+
+    PresenceBitmap exists;           // One bit per offset key - base (in-memory index).
+    std::vector<uint64_t> blockRank; // Keys before each block; back() is the total.
+    Key base;                        // Smallest key (range start after a merge).
+    Key top;                         // Largest key (range end after a merge).
+    size_t wordTotal;                // Bitmap words.
+    size_t blocks;                   // Prefix-table blocks.
+    const uint64_t* mappedWords;     // Words inside the mapping (loaded index).
+    const uint64_t* mappedRanks;     // Prefix table inside the mapping.
+    std::shared_ptr<const MappedFile> mapping;  // Keeps a loaded file mapped.
+};
+
+// ============================================================
+// Class: PresenceSet
+// ------------------------------------------------------------
+// Role: A set of integer keys kept as a presence bitmap over a
+//       key range [minKey, maxKey], with set algebra done word by
+//       word (BitmapKernels::combine, AVX2 / AVX-512 when
+//       available). Intersecting or merging two key batches is
+//       then one bitwise pass over the bitmaps instead of two
+//       sorts and a merge, and the result comes out sorted.
+//
+//       Operands may cover different ranges. Union and symmetric
+//       difference widen the left operand to the hull of both
+//       ranges; intersection and difference keep its range. When
+//       the range starts differ by other than a multiple of 64,
+//       the right operand's words are realigned in cache-sized
+//       chunks before combining.
+//
+// Usage:
+//   PresenceSet<uint32_t> seen(batchA), fresh(batchB);
+//   fresh -= seen;                              // keys only in B
+//   std::vector<uint32_t> out = fresh.toSortedVector();
+// ============================================================
+template <typename Key>
+class PresenceSet {
+public:
+    static_assert(std::is_integral_v<Key> && !std::is_same_v<Key, bool>, "PresenceSet requires integer keys");
+    using UKey = std::make_unsigned_t<Key>;
+    using SetOp = BitmapKernels::SetOp;
+
+    // Empty set with an empty range.
+    PresenceSet() : base(0), top(0), hasRange(false) { }
+
+    // Empty set over [minKey, maxKey]; insert() fills it. A nonzero
+    // budgetBytes caps the bitmap (see PresenceBitmap::spanFor).
+    PresenceSet(Key minKey, Key maxKey, size_t budgetBytes = 0) : PresenceSet() {
+        setRange(minKey, maxKey, budgetBytes);
+    }
+
+    // The distinct keys of any unordered batch, over their own range.
+    explicit PresenceSet(std::span<const Key> keys) : PresenceSet() {
+        if (keys.empty()) return;
+        auto bounds = std::minmax_element(keys.begin(), keys.end());
+        setRange(*bounds.first, *bounds.second);
+        insert(keys);
+    }
+
+    // ------------------------------------------------------------
+    // Method: insert
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - keys: Keys to add; each must lie in [minKey(), maxKey()].
+    // ------------------------------------------------------------
+    void insert(std::span<const Key> keys) {
+        for (Key key : keys) {
+            if (!inRange(key)) {
+                std::cerr << "Error: PresenceSet key is outside its range.\n";
+                exit(1);
+            }
+        }
+        exists.markAll(keys.data(), keys.size(), base);
+    }
+
+    void insert(Key key) { insert(std::span<const Key>(&key, 1)); }
+
+    bool contains(Key key) const { return inRange(key) && exists.test(offsetOf(key)); }
+
+    // Number of keys in the set (one popcount pass).
+    size_t size() const { return BitmapKernels::popcount(exists.data(), exists.wordCount()); }
+    bool empty() const { return size() == 0; }
+
+    // The range the bitmap covers; meaningless while it is empty.
+    Key minKey() const { return base; }
+    Key maxKey() const { return top; }
+
+    // ------------------------------------------------------------
+    // Set operators
+    // ------------------------------------------------------------
+    // In place: |= union, &= intersection, -= difference,
+    // ^= symmetric difference. The binary forms copy the left
+    // operand first.
+    // ------------------------------------------------------------
+    PresenceSet& operator|=(const PresenceSet& other) { return combine(other, SetOp::Union); }
+    PresenceSet& operator&=(const PresenceSet& other) { return combine(other, SetOp::Intersection); }
+    PresenceSet& operator-=(const PresenceSet& other) { return combine(other, SetOp::Difference); }
+    PresenceSet& operator^=(const PresenceSet& other) { return combine(other, SetOp::SymmetricDifference); }
+
+    friend PresenceSet operator|(PresenceSet a, const PresenceSet& b) { return a |= b; }
+    friend PresenceSet operator&(PresenceSet a, const PresenceSet& b) { return a &= b; }
+    friend PresenceSet operator-(PresenceSet a, const PresenceSet& b) { return a -= b; }
+    friend PresenceSet operator^(PresenceSet a, const PresenceSet& b) { return a ^= b; }
+
+    // ------------------------------------------------------------
+    // Method: extract / toSortedVector
+    // ------------------------------------------------------------
+    // Role:
+    //   Write the keys in increasing order, through the same
+    //   dispatched extract kernel as the sort. [out, outEnd) must
+    //   hold size() keys; extract() returns the new end.
+    // ------------------------------------------------------------
+    Key* extract(Key* out, Key* outEnd) const {
+        return exists.extract(out, outEnd, base);
+    }
+
+    std::vector<Key> toSortedVector() const {
+        std::vector<Key> keys(size());
+        extract(keys.data(), keys.data() + keys.size());
+        return keys;
+    }
+
+    // Calls visit(key) for each key in increasing order.
+    template <typename Visit>
+    void forEach(Visit visit) const {
+        const uint64_t* words = exists.data();
+        for (size_t wi = 0; wi < exists.wordCount(); ++wi) {
+            for (uint64_t w = words[wi]; w; w &= w - 1) {
+                visit(keyAt(wi * PresenceBitmap::kWordBits + static_cast<size_t>(__builtin_ctzll(w))));
+            }
+        }
+    }
+
+private:
+    static constexpr size_t kWordBits = PresenceBitmap::kWordBits;
+    static constexpr size_t kRealignWords = 4096;  // 32 KB: the realigned chunk stays in L1/L2.
+
+    void setRange(Key minKey, Key maxKey, size_t budgetBytes = 0) {
+        size_t span = PresenceBitmap::spanFor(minKey, maxKey, budgetBytes);
+        if (span == 0) {
+            std::cerr << "Error: PresenceSet range is empty or too large for a bitmap.\n";
+            exit(1);
+        }
+        base = minKey;
+        top = maxKey;
+        hasRange = true;
+        exists.reset(span);
+    }
+
+    bool inRange(Key key) const { return hasRange && key >= base && key <= top; }
+
+    size_t offsetOf(Key key) const {
+        return static_cast<size_t>(static_cast<UKey>(static_cast<UKey>(key) - static_cast<UKey>(base)));
+    }
+
+    Key keyAt(size_t offset) const {
+        return static_cast<Key>(static_cast<UKey>(static_cast<UKey>(base) + static_cast<UKey>(offset)));
+    }
+
+    // 64 bits of words starting at bit position, zero outside [0, bitCount).
+    static uint64_t bitsAt(const uint64_t* words, size_t bitCount, long long position) {
+        uint64_t result = 0;
+        long long wordCount = static_cast<long long>((bitCount + kWordBits - 1) / kWordBits);
+        long long word = position >= 0 ? position / 64 : (position - 63) / 64;
+        unsigned shift = static_cast<unsigned>(position - word * 64);
+        if (word >= 0 && word < wordCount) result = words[word] >> shift;
+        if (shift && word + 1 >= 0 && word + 1 < wordCount) result |= words[word + 1] << (64 - shift);
+        return result;
+    }
+
+    // ------------------------------------------------------------
+    // Method: combine
+    // ------------------------------------------------------------
+    // Flow:
+    //   1. Union / symmetric difference: widen to the hull range
+    //      first, so every key of other has a slot here.
+    //   2. Find the overlap of the two ranges and its first bit in
+    //      each bitmap.
+    //   3. Combine the partial words at either end bit by bit, and
+    //      the whole words between them with the dispatched kernel,
+    //      realigning other's words through a small buffer when
+    //      the two bitmaps' bit positions are not word-aligned.
+    //   4. Intersection: clear everything outside the overlap.
+    // ------------------------------------------------------------
+    PresenceSet& combine(const PresenceSet& other, SetOp op) {
+        bool widens = op == SetOp::Union || op == SetOp::SymmetricDifference;
+        if (!other.hasRange) {
+            if (op == SetOp::Intersection) exists.clearAll();
+            return *this;
+        }
+        if (!hasRange) {
+            if (widens) *this = other;
+            return *this;
+        }
+
+        // Step 1: Widen to the hull.
+        if (widens && (other.base < base || other.top > top)) {
+            PresenceSet hull(std::min(base, other.base), std::max(top, other.top));
+            hull.combine(*this, SetOp::Union);
+            *this = std::move(hull);
+        }
+
+        // Step 2: Overlap.
+        Key low = std::max(base, other.base);
+        Key high = std::min(top, other.top);
+        if (high < low) {
+            if (op == SetOp::Intersection) exists.clearAll();
+            return *this;
+        }
+        size_t first = offsetOf(low);
+        size_t last = offsetOf(high);  // Inclusive.
+        long long shift = static_cast<long long>(other.offsetOf(low)) - static_cast<long long>(first);
+        uint64_t* words = exists.data();
+        const uint64_t* otherWords = other.exists.data();
+        size_t otherBits = other.exists.size();
+
+        // Step 3: Partial end words bit-masked, whole words by kernel.
+        auto apply = [&](size_t wi, uint64_t mask) {
+            uint64_t src = bitsAt(otherWords, otherBits, static_cast<long long>(wi * kWordBits) + shift) & mask;
+            uint64_t w = words[wi];
+            switch (op) {
+                case SetOp::Union:        w |= src; break;
+                case SetOp::Intersection: w &= src | ~mask; break;
+                case SetOp::Difference:   w &= ~src; break;
+                default:                  w ^= src; break;
+            }
+            words[wi] = w;
+        };
+        size_t firstWord = first / kWordBits;
+        size_t lastWord = last / kWordBits;
+        uint64_t headMask = ~uint64_t(0) << (first % kWordBits);
+        uint64_t tailMask = ~uint64_t(0) >> (kWordBits - 1 - last % kWordBits);
+        if (firstWord == lastWord) {
+            apply(firstWord, headMask & tailMask);
+        } else {
+            apply(firstWord, headMask);
+            apply(lastWord, tailMask);
+            size_t bodyBegin = firstWord + 1;
+            size_t bodyEnd = lastWord;
+            long long sourceBit = static_cast<long long>(bodyBegin * kWordBits) + shift;
+            if (sourceBit % 64 == 0) {
+                BitmapKernels::combine(words + bodyBegin, otherWords + sourceBit / 64, bodyEnd - bodyBegin, op);
+            } else {
+                uint64_t aligned[kRealignWords];
+                for (size_t chunk = bodyBegin; chunk < bodyEnd; chunk += kRealignWords) {
+                    size_t count = std::min(kRealignWords, bodyEnd - chunk);
+                    long long position = static_cast<long long>(chunk * kWordBits) + shift;
+                    for (size_t i = 0; i < count; ++i) {
+                        aligned[i] = bitsAt(otherWords, otherBits, position + static_cast<long long>(i * kWordBits));
+                    }
+                    BitmapKernels::combine(words + chunk, aligned, count, op);
+                }
+            }
+        }
+
+        // Step 4: Intersection drops keys outside the overlap.
+        if (op == SetOp::Intersection) {
+            std::fill(words, words + firstWord, uint64_t(0));
+            words[firstWord] &= headMask;
+            words[lastWord] &= tailMask;
+            std::fill(words + lastWord + 1, words + exists.wordCount(), uint64_t(0));
+        }
+        return *this;
+    }
+
+    PresenceBitmap exists;  // One bit per offset key - base.
+    Key base;               // Smallest key of the range.
+    Key top;                // Largest key of the range.
+    bool hasRange;          // False for a default-constructed set.
+};
+
+// ============================================================
+// Struct: SortStats
+// ------------------------------------------------------------
+// Role: Where the time and memory of the last sort() went. Phase
+//       timings are nanoseconds of wall time:
+//         - boundsNs:  Step 1, the min/max scan.
+//         - planNs:    Step 2, choosing a strategy.
+//         - allocNs:   Sizing (and zeroing) the bitmap, counters
+//                      or scratch buffers, page faults included.
+//         - markNs:    Setting bits, counting, inserting into
+//                      containers, or the whole of a radix or
+//                      comparison sort.
+//         - extractNs: Writing the sorted output.
+//         - clearNs:   Leaving the bitmap zeroed for the next sort.
+//       Hardware counters come from perf_event_open when enabled
+//       and permitted; -1 means the counter was unavailable.
+// ============================================================
+struct SortStats {
+    uint64_t boundsNs = 0;
+    uint64_t planNs = 0;
+    uint64_t allocNs = 0;
+    uint64_t markNs = 0;
+    uint64_t extractNs = 0;
+    uint64_t clearNs = 0;
+    uint64_t totalNs = 0;
+    size_t bytesAllocated = 0;       // Heap bytes newly reserved by the sort.
+
+    long long cycles = -1;
+    long long instructions = -1;
+    long long cacheMisses = -1;      // Last-level cache misses.
+    long long branchMisses = -1;
+    long long dtlbMisses = -1;       // Data TLB read misses.
+
+    // ------------------------------------------------------------
+    // Method: toJson
+    // ------------------------------------------------------------
+    // Returns:
+    //   The stats as one JSON object; unavailable counters are null.
+    // ------------------------------------------------------------
+    std::string toJson() const {
+        std::ostringstream json;
+        auto counter = [&](const char* name, long long value) {
+            json << ",\"" << name << "\":";
+            if (value < 0) {
+                json << "null";
+            } else {
+                json << value;
+            }
+        };
+        json << "{\"bounds_ns\":" << boundsNs << ",\"plan_ns\":" << planNs << ",\"alloc_ns\":" << allocNs
+             << ",\"mark_ns\":" << markNs << ",\"extract_ns\":" << extractNs << ",\"clear_ns\":" << clearNs
+             << ",\"total_ns\":" << totalNs << ",\"bytes_allocated\":" << bytesAllocated;
+        counter("cycles", cycles);
+        counter("instructions", instructions);
+        counter("cache_misses", cacheMisses);
+        counter("branch_misses", branchMisses);
+        counter("dtlb_misses", dtlbMisses);
+        json << "}";
+        return json.str();
+    }
+};
+
+// ============================================================
+// Class: PhaseClock
+// ------------------------------------------------------------
+// Role: Steady-clock stopwatch for SortStats. Each lap() returns
+//       the nanoseconds since the previous lap (or construction).
+// ============================================================
+class PhaseClock {
+public:
+    PhaseClock() : last(std::chrono::steady_clock::now()) { }
+
+    uint64_t lap() {
+        auto now = std::chrono::steady_clock::now();
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now - last).count();
+        last = now;
+        return static_cast<uint64_t>(elapsed);
+    }
+
+private:
+    std::chrono::steady_clock::time_point last;
+};
+
+// ============================================================
+// Class: PerfCounters
+// ------------------------------------------------------------
+// Role: Counts hardware events for the calling thread between
+//       start() and stop(), via Linux perf_event_open. Each event
+//       is opened on its own so one the kernel or container
+//       refuses (perf_event_paranoid, missing PMU) does not hide
+//       the others. Elsewhere every counter reads as unavailable.
+// ============================================================
+class PerfCounters {
+public:
+    enum Event { Cycles, Instructions, CacheMisses, BranchMisses, DtlbMisses, kEventCount };
+
+    // ------------------------------------------------------------
+    // Constructor: PerfCounters
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - enabled: Open the counters; when false nothing is opened
+    //              and stop() leaves the stats untouched.
+    // ------------------------------------------------------------
+    explicit PerfCounters(bool enabled) {
+        fds.fill(-1);
+#if defined(__linux__)
+        if (!enabled) return;
+        const std::pair<uint32_t, uint64_t> events[kEventCount] = {
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+            { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+        };
+        for (int e = 0; e < kEventCount; ++e) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = events[e].first;
+            attr.config = events[e].second;
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fds[e] = static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        }
+#else
+        (void)enabled;
+#endif
+    }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    ~PerfCounters() {
+        for (int fd : fds) {
+            if (fd >= 0) ::close(fd);
+        }
+    }
+
+    void start() {
+#if defined(__linux__)
+        for (int fd : fds) {
+            if (fd < 0) continue;
+            ::ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ::ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    // Stops counting and stores each opened counter in stats.
+    void stop(SortStats& stats) {
+        long long* targets[kEventCount] = { &stats.cycles, &stats.instructions, &stats.cacheMisses,
+                                            &stats.branchMisses, &stats.dtlbMisses };
+        for (int e = 0; e < kEventCount; ++e) {
+            if (fds[e] < 0) continue;
+#if defined(__linux__)
+            ::ioctl(fds[e], PERF_EVENT_IOC_DISABLE, 0);
+            long long value = 0;
+            if (::read(fds[e], &value, sizeof(value)) == static_cast<ssize_t>(sizeof(value))) {
+                *targets[e] = value;
+            }
+#endif
+        }
+    }
+
+private:
+    std::array<int, kEventCount> fds;  // One descriptor per event, -1 if not open.
+};
+
+// ============================================================
+// Class: BigSorter
+// ------------------------------------------------------------
+// Role: Implements the "Big Sort" algorithm, which sorts an
+//       array in linear time using a sparse presence bitmap.
+//       It also measures the time taken to perform the sort.
+//
+// Template parameters:
+//   - T:     Element type. Either an integer (sorted by value) or
+//            a record sorted by an integer key.
+//   - KeyFn: Projection from const T& to the integer key; the
+//            default IdentityKey sorts integers by themselves.
+//
+// Any integer key width and signedness is supported: slots are
+// offsets (key - min) taken in the key's unsigned type, which
+// bias-shifts signed keys. 8- and 16-bit integers skip the min/max
+// pass and use a FixedPresenceBitmap over their whole range.
+// Records cannot be rebuilt from a bitmap, so their bitmap path
+// is a stable counting scatter over the same key span.
+// ============================================================
+template <typename T, typename KeyFn = IdentityKey>
+class BigSorter {
+public:
+    using Key = std::decay_t<std::invoke_result_t<const KeyFn&, const T&>>;
+    static_assert(std::is_integral_v<Key> && !std::is_same_v<Key, bool>,
+                  "BigSorter keys must be integers");
+    using UKey = std::make_unsigned_t<Key>;
+
+    // Elements are their own keys, so output can be rebuilt from slots.
+    static constexpr bool kKeysOnly = std::is_same_v<T, Key> && std::is_same_v<KeyFn, IdentityKey>;
+    // Keys narrow enough for a FixedPresenceBitmap over their full range.
+    static constexpr bool kNarrowKeys = sizeof(Key) <= 2;
+
+    // ------------------------------------------------------------
+    // Constructor: BigSorter
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - inputArray: The unsorted array to be processed.
+    //   - keyFn:      Projection from an element to its key.
+    //
+    // Role:
+    //   Stores the original array and initializes timing and
+    //   internal state variables.
+    // ------------------------------------------------------------
+    BigSorter(const std::vector<T>& inputArray, KeyFn keyFn = KeyFn())
+        : originalArray(inputArray), keyOf(keyFn), sortDurationMs(0), existsArraySize(0),
+          threadCount(1), countDuplicates(false), emitRunLengths(false),
+          counterWidth(PresenceCounter::Width::TwoBit),
+          strategyOverride(SortPlanner::Strategy::Auto),
+          chosenPlan{ SortPlanner::Strategy::Auto, 0.0 }, collectHardwareCounters(false),
+          markMode(PresenceBitmap::MarkMode::Auto) { }
+
+    // ------------------------------------------------------------
+    // Method: setThreadCount
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - threads: Worker threads used by sort(); 0 selects one per
+    //              hardware thread. The default of 1 keeps the sort
+    //              single-threaded.
+    //
+    // Role:
+    //   Enables the parallel mode. Inputs smaller than
+    //   kParallelMinElements are still sorted on the calling thread
+    //   because thread start-up would dominate.
+    // ------------------------------------------------------------
+    void setThreadCount(unsigned threads) {
+        threadCount = threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // ------------------------------------------------------------
+    // Method: setCountDuplicates
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - enabled: When true, sort() keeps every occurrence of a
+    //              repeated key (a full, stable multiset sort)
+    //              instead of keeping only the first.
+    //
+    // Role:
+    //   Switches the presence bitmap for a PresenceCounter with the
+    //   narrowest counter width that fits the input. The counting
+    //   mode always runs on the calling thread.
+    // ------------------------------------------------------------
+    void setCountDuplicates(bool enabled) { countDuplicates = enabled; }
+
+    // ------------------------------------------------------------
+    // Method: setRunLengthOutput
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - enabled: When true (and counting duplicates), sort() also
+    //              fills getRunLengths() with (key, count) pairs.
+    // ------------------------------------------------------------
+    void setRunLengthOutput(bool enabled) { emitRunLengths = enabled; }
+
+    // ------------------------------------------------------------
+    // Method: setSummaryBitmap
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - enabled: Give the presence bitmap a summary level (one bit
+    //              per 64-word block) so extraction jumps straight
+    //              to non-empty blocks. Worth it for very sparse
+    //              inputs (n much smaller than k / 4096).
+    // ------------------------------------------------------------
+    void setSummaryBitmap(bool enabled) { exists.setSummaryEnabled(enabled); }
+
+    // ------------------------------------------------------------
+    // Method: setStrategy
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - strategy: Auto (default) lets SortPlanner pick per input;
+    //               any other value forces that path whenever it
+    //               can run the input (see SortPlanner::feasible).
+    // ------------------------------------------------------------
+    void setStrategy(SortPlanner::Strategy strategy) { strategyOverride = strategy; }
+
+    // ------------------------------------------------------------
+    // Method: setHardwareCounters
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - enabled: Also record cycles, instructions, cache, branch
+    //              and TLB misses in getStats() (Linux perf_event;
+    //              costs a few syscalls per sort).
+    // ------------------------------------------------------------
+    void setHardwareCounters(bool enabled) { collectHardwareCounters = enabled; }
+
+    // ------------------------------------------------------------
+    // Method: setBitmapMemoryPolicy
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - policy: How the exists bitmap is allocated: huge pages,
+    //             NUMA placement, prefaulting (BitmapMemoryPolicy).
+    //             With FirstTouch placement the pages are faulted
+    //             in by the sort's own threads. The bitmap is kept
+    //             across sort() calls, so the mapping stays warm.
+    // ------------------------------------------------------------
+    void setBitmapMemoryPolicy(const BitmapMemoryPolicy& policy) { exists.setMemoryPolicy(policy); }
+
+    // ------------------------------------------------------------
+    // Method: setMarkMode
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - mode: Auto (default) marks bitmaps far past LLC size in
+    //           cache-blocked slices (PresenceBitmap::markAllBlocked)
+    //           and the rest directly; Direct or Blocked force one.
+    //           Only the sequential bitmap path is blocked.
+    // ------------------------------------------------------------
+    void setMarkMode(PresenceBitmap::MarkMode mode) { markMode = mode; }
+
+    // ------------------------------------------------------------
+    // Method: calibratePlanner
+    // ------------------------------------------------------------
+    // Role:
+    //   Times each strategy on small synthetic int inputs and
+    //   stores the fitted coefficients in SortPlanner::model(), so
+    //   later Auto plans reflect this machine. Takes a few
+    //   milliseconds.
+    // ------------------------------------------------------------
+    static void calibratePlanner() {
+        const int n = 1 << 16;
+        std::mt19937 rng(12345);
+        auto keysIn = [&](int span) {
+            std::vector<int> keys(n);
+            for (int& key : keys) key = static_cast<int>(rng() % static_cast<unsigned>(span));
+            return keys;
+        };
+        auto timeNs = [](BigSorter<int>& sorter) {
+            double best = 1e300;
+            for (int rep = 0; rep < 3; ++rep) {
+                auto start = std::chrono::steady_clock::now();
+                sorter.sort();
+                auto stop = std::chrono::steady_clock::now();
+                best = std::min(best, static_cast<double>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count()));
+            }
+            return best;
+        };
+        auto timed = [&](SortPlanner::Strategy strategy, int span) {
+            BigSorter<int> sorter(keysIn(span));
+            sorter.setStrategy(strategy);
+            return timeNs(sorter);
+        };
+
+        const double denseSpan = 4.0 * n, sparseSpan = 64.0 * 1024 * 1024;
+        double dense = timed(SortPlanner::Strategy::Bitmap, static_cast<int>(denseSpan));
+        double sparse = timed(SortPlanner::Strategy::Bitmap, static_cast<int>(sparseSpan));
+        double radix = timed(SortPlanner::Strategy::Radix, 1 << 30);
+        double compare = timed(SortPlanner::Strategy::Comparison, 1 << 30);
+        double chunked = timed(SortPlanner::Strategy::Chunked, static_cast<int>(sparseSpan));
+        // At this size the device's fixed cost dominates its time.
+        double gpu = GpuBackend::available() ? timed(SortPlanner::Strategy::Gpu, static_cast<int>(denseSpan)) : 0.0;
+
+        SortPlanner::CostModel& m = SortPlanner::model();
+        m.bitmapPerWord = std::max(0.01, (sparse - dense) / ((sparseSpan - denseSpan) / 64.0));
+        m.bitmapPerElement = std::max(0.01, (dense - m.bitmapPerWord * denseSpan / 64.0) / n);
+        m.radixPerElementPass = radix / (static_cast<double>(n) * (RadixSorter::passesFor((1ULL << 30) - 1) + 1));
+        m.comparePerElementLog = compare / (static_cast<double>(n) * std::log2(static_cast<double>(n)));
+        m.chunkedPerElement = std::max(0.01, (chunked - m.bitmapPerWord * (sparseSpan / 65536.0)) / n);
+        if (gpu > 0.0) m.gpuFixed = std::max(0.0, gpu - m.gpuPerByte * 2.0 * n * sizeof(int));
+    }
+
+    // ------------------------------------------------------------
+    // Method: sort
+    // ------------------------------------------------------------
+    // Role:
+    //   Performs the "Big Sort" algorithm which:
+    //     1. Finds the minimum and maximum keys in a single pass
+    //        to determine the size of an "exists" bitmap that spans
+    //        only [min, max].
+    //     2. Marks the presence of each key in the bitmap, offset
+    //        by the minimum key.
+    //     3. Walks the bitmap a word at a time, skipping empty words,
+    //        to build a compact sorted array shifted back by the minimum.
+    //     4. Measures and records the time taken for this sorting process.
+    //
+    //   In parallel mode each thread reduces min/max over its slice
+    //   of the input and marks it with atomic fetch_or. The bitmap is
+    //   then cut into cache-sized shards; threads popcount their
+    //   shards, an exclusive prefix sum gives every shard its output
+    //   offset, and each thread extracts its shards straight into
+    //   sortedArray, so no merge step is needed.
+    //
+    //   In counting mode steps 2 and 3 count occurrences instead of
+    //   marking them and emit each key as often as it occurred.
+    //
+    //   Once min and max are known, SortPlanner compares the cost of
+    //   the bitmap path (O(n + k)) against radix and comparison sorts
+    //   and the cheapest one runs; an O(k) bitmap is never allocated
+    //   for a handful of widely spread keys.
+    // ------------------------------------------------------------
+    void sort() {
+        using Clock = std::chrono::high_resolution_clock;
+        auto startTime = Clock::now();
+
+        sortedArray.clear();
+        runLengths.clear();
+        existsArraySize = 0;
+        stats = SortStats();
+        if (originalArray.empty()) {
+            sortDurationMs = 0;
+            return;
+        }
+        PerfCounters counters(collectHardwareCounters);
+        counters.start();
+        phases.lap();
+        size_t heldBytes = heldBufferBytes();
+
+        // Narrow keys fit a constexpr-sized bitmap over their whole
+        // range, so the min/max pass and the planner are skipped.
+        if constexpr (kKeysOnly && kNarrowKeys) {
+            if (!countDuplicates && (strategyOverride == SortPlanner::Strategy::Auto ||
+                                     strategyOverride == SortPlanner::Strategy::Bitmap)) {
+                sortWithFixedBitmap();
+                finishStats(counters, heldBytes);
+                recordDuration(startTime);
+                return;
+            }
+        }
+        unsigned threads = originalArray.size() >= kParallelMinElements && !countDuplicates
+                               ? threadCount : 1;
+
+        // Step 1: Determine the minimum and maximum keys in one pass.
+        std::pair<Key, Key> bounds;
+        if (threads > 1) {
+            std::vector<std::pair<Key, Key>> partial(threads, keyBounds(0, 1));
+            parallelFor(threads, originalArray.size(), [&](size_t begin, size_t end, unsigned t) {
+                partial[t] = keyBounds(begin, end);
+            });
+            bounds = partial[0];
+            for (const auto& part : partial) {
+                bounds.first = std::min(bounds.first, part.first);
+                bounds.second = std::max(bounds.second, part.second);
+            }
+        } else {
+            bounds = keyBounds(0, originalArray.size());
+        }
+        stats.boundsNs = phases.lap();
+        Key minKey = bounds.first;
+        // 'exists' bitmap only spans [min, max]. The largest offset is
+        // taken in the unsigned key type so it cannot overflow; a full
+        // 64-bit span saturates.
+        unsigned long long maxOffset = static_cast<UKey>(static_cast<UKey>(bounds.second) -
+                                                         static_cast<UKey>(minKey));
+        unsigned long long span = maxOffset == ~0ULL ? maxOffset : maxOffset + 1;
+        existsArraySize = span;
+
+        // Step 2: Plan. Radix and comparison sorts need no bitmap, so
+        // the exists size is reset when either is chosen.
+        size_t n = originalArray.size();
+        counterWidth = PresenceCounter::chooseWidth(n, static_cast<size_t>(span));
+        unsigned counterBits = !kKeysOnly ? 32 : countDuplicates ? counterBitsOf(counterWidth) : 1;
+        // A summary level shrinks the part of the span the scan touches.
+        SortPlanner::Input shape = { n, span,
+            kKeysOnly && !countDuplicates ? PresenceBitmap::scanSlots(n, span, exists.hasSummary()) : span,
+            counterBits, threads, kKeysOnly && !countDuplicates };
+        if constexpr (kKeysOnly && GpuBackend::supports<Key>()) {
+            if (!countDuplicates) shape.gpuKeyBytes = sizeof(Key);
+        }
+        // A forced strategy that cannot run this input falls back to Auto.
+        chosenPlan = SortPlanner::plan(shape, strategyOverride);
+        stats.planNs = phases.lap();
+
+        // Step 3: Mark or count, then extract; or fall back to a
+        // radix or comparison sort for sparse inputs.
+        switch (chosenPlan.strategy) {
+            case SortPlanner::Strategy::Radix:
+                existsArraySize = 0;
+                sortWithRadix(minKey, maxOffset);
+                break;
+            case SortPlanner::Strategy::Comparison:
+                existsArraySize = 0;
+                sortWithComparison();
+                break;
+            case SortPlanner::Strategy::Chunked:
+                // The planner only picks containers for integer keys.
+                if constexpr (kKeysOnly) {
+                    existsArraySize = 0;
+                    sortWithChunks(minKey, span);
+                }
+                break;
+            case SortPlanner::Strategy::Gpu:
+                // Only offered for 32- and 64-bit keys without counting.
+                if constexpr (kKeysOnly && GpuBackend::supports<Key>()) {
+                    sortedArray.resize(n);
+                    stats.allocNs = phases.lap();
+                    sortedArray.resize(GpuBackend::sort(originalArray.data(), n, minKey, span, sortedArray.data()));
+                    stats.markNs = phases.lap();
+                }
+                break;
+            default:
+                if constexpr (kKeysOnly) {
+                    if (countDuplicates) {
+                        sortWithCounts(minKey);
+                    } else {
+                        sortWithBitmap(minKey, threads);
+                    }
+                } else {
+                    sortWithScatter(minKey);
+                }
+                break;
+        }
+
+        finishStats(counters, heldBytes);
+
+        // Step 4: Record the elapsed time for the sort operation.
+        recordDuration(startTime);
+    }
+
+    // ------------------------------------------------------------
+    // Method: sortTopK
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - k:     Number of leading elements wanted.
+    //   - order: Ascending for the k smallest keys, Descending for
+    //            the k largest (emitted largest first).
+    //
+    // Role:
+    //   Partial sort: getSortedArray() receives only the first k
+    //   elements sort() would produce in that order (duplicate
+    //   handling and run lengths as configured). The thread count
+    //   and forced strategy apply as in sort(): Bitmap and Radix
+    //   are honoured, other strategies sort the kept elements by
+    //   comparison. getStats() and getStrategy() describe this run.
+    //
+    // Flow:
+    //   1. Sample the keys to estimate a cut that about 2k
+    //      elements fall on the wanted side of.
+    //   2. Keep only the elements on that side of the cut; the
+    //      bitmap, if used, spans just their keys.
+    //   3. Scan the bitmap forward (ascending) or backward
+    //      (descending) and stop at the k-th key. Records and
+    //      counting mode radix- or stable-sort the kept elements
+    //      instead.
+    //   4. If the cut left fewer than k elements, repeat once with
+    //      every element.
+    // ------------------------------------------------------------
+    void sortTopK(size_t k, SortOrder order = SortOrder::Ascending) {
+        using Clock = std::chrono::high_resolution_clock;
+        auto startTime = Clock::now();
+
+        sortedArray.clear();
+        runLengths.clear();
+        existsArraySize = 0;
+        stats = SortStats();
+        if (originalArray.empty() || k == 0) {
+            sortDurationMs = 0;
+            return;
+        }
+        PerfCounters counters(collectHardwareCounters);
+        counters.start();
+        phases.lap();
+        size_t heldBytes = heldBufferBytes();
+        bool ascending = order == SortOrder::Ascending;
+
+        // Step 1: Estimate the cut from a sample.
+        Key cut{};
+        bool filtered = sampleTopKCut(k, ascending, cut);
+        stats.boundsNs = phases.lap();
+
+        // Steps 2 & 3: Collect the head, widening to every element
+        // when the sampled cut proved too tight (step 4).
+        for (;;) {
+            if constexpr (kKeysOnly) {
+                if (!countDuplicates) {
+                    topKWithBitmap(k, ascending, filtered, cut);
+                } else {
+                    topKWithCopy(ascending, filtered, cut);
+                }
+            } else {
+                topKWithCopy(ascending, filtered, cut);
+            }
+            if (sortedArray.size() >= k || !filtered) break;
+            filtered = false;
+            sortedArray.clear();
+        }
+        if (sortedArray.size() > k) sortedArray.resize(k);
+        if (countDuplicates && emitRunLengths) appendRunLengths();
+        finishStats(counters, heldBytes);
+
+        recordDuration(startTime);
+    }
+
+    // ------------------------------------------------------------
+    // Method: argsort
+    // ------------------------------------------------------------
+    // Returns:
+    //   The permutation that sorts the original array: element i of
+    //   the sorted order is originalArray[result[i]]. Like sort(), a
+    //   repeated key keeps only its first occurrence unless counting
+    //   duplicates, in which case every index is kept and equal keys
+    //   stay in input order. getSortedArray() is left untouched;
+    //   applyPermutation() reorders keys and payloads with it.
+    //   Index is uint32_t by default, which halves the index
+    //   traffic; argsort<uint64_t>() handles 2^32 or more elements.
+    //
+    // Flow:
+    //   1. Find min and max, and let SortPlanner cost a dense slot
+    //      array of Index entries (8 * sizeof(Index) bits per slot,
+    //      at most two slots per element) against radix and
+    //      comparison sorts of the indices.
+    //   2. Slot path: store index + 1 in slot key - min (first one
+    //      wins), then scan the slots in order and emit the stored
+    //      indices. The counting mode counts per slot, prefix-sums,
+    //      and scatters the indices in input order instead.
+    //   3. Otherwise sort the indices by key, stably, and drop all
+    //      but the first index of each key.
+    // ------------------------------------------------------------
+    template <typename Index = uint32_t>
+    std::vector<Index> argsort() {
+        using Clock = std::chrono::high_resolution_clock;
+        auto startTime = Clock::now();
+        existsArraySize = 0;
+        stats = SortStats();
+        phases.lap();
+        size_t n = originalArray.size();
+        std::vector<Index> order;
+        if (n == 0) {
+            sortDurationMs = 0;
+            return order;
+        }
+        if (n > std::numeric_limits<Index>::max()) {
+            std::cerr << "Error: argsort indices are " << 8 * sizeof(Index) << "-bit; the input has " << n
+                      << " elements (use argsort<uint64_t>()).\n";
+            exit(1);
+        }
+
+        // Step 1: Bounds and plan.
+        std::pair<Key, Key> bounds = keyBounds(0, n);
+        Key minKey = bounds.first;
+        unsigned long long maxOffset = static_cast<UKey>(static_cast<UKey>(bounds.second) -
+                                                         static_cast<UKey>(minKey));
+        unsigned long long span = maxOffset == ~0ULL ? maxOffset : maxOffset + 1;
+        stats.boundsNs = phases.lap();
+        // The slot array costs sizeof(Index) bytes per slot, so it may
+        // use no more than the index sort would (the order and its
+        // radix scratch): at most two slots per element.
+        SortPlanner::Input shape = { n, span, span, 8 * sizeof(Index), 1, false };
+        shape.budgetBytes = 2 * n * sizeof(Index);
+        if (SortPlanner::memoryBudget()) shape.budgetBytes = std::min(shape.budgetBytes, SortPlanner::memoryBudget());
+        chosenPlan = SortPlanner::plan(shape, strategyOverride);
+        stats.planNs = phases.lap();
+        auto slotOf = [&](Index index) {
+            return static_cast<size_t>(offsetOf(keyOf(originalArray[index]), minKey));
+        };
+
+        if (chosenPlan.strategy == SortPlanner::Strategy::Bitmap) {
+            // Step 2: Dense slot array in place of the exists bits.
+            existsArraySize = span;
+            std::vector<Index> slots(static_cast<size_t>(span), 0);
+            stats.bytesAllocated += (slots.capacity() + n) * sizeof(Index);
+            stats.allocNs = phases.lap();
+            if (!countDuplicates) {
+                for (Index i = 0; i < n; ++i) {
+                    Index& slot = slots[slotOf(i)];
+                    if (!slot) slot = i + 1;
+                }
+                stats.markNs = phases.lap();
+                order.resize(n);
+                size_t kept = 0;
+                for (Index slot : slots) {
+                    if (slot) order[kept++] = slot - 1;
+                }
+                order.resize(kept);
+            } else {
+                for (Index i = 0; i < n; ++i) ++slots[slotOf(i)];
+                Index running = 0;
+                for (Index& slot : slots) {
+                    Index slotCount = slot;
+                    slot = running;
+                    running += slotCount;
+                }
+                stats.markNs = phases.lap();
+                order.resize(n);
+                for (Index i = 0; i < n; ++i) order[slots[slotOf(i)]++] = i;
+            }
+            stats.extractNs = phases.lap();
+        } else {
+            // Step 3: Stable index sort, then keep the first of each key.
+            order.resize(n);
+            for (Index i = 0; i < n; ++i) order[i] = i;
+            stats.bytesAllocated += n * sizeof(Index);
+            if (chosenPlan.strategy == SortPlanner::Strategy::Radix) {
+                stats.bytesAllocated += n * sizeof(Index);
+                RadixSorter::sort(order, maxOffset, [&](Index index) {
+                    return static_cast<unsigned long long>(slotOf(index));
+                });
+            } else {
+                std::stable_sort(order.begin(), order.end(), [&](Index a, Index b) {
+                    return keyOf(originalArray[a]) < keyOf(originalArray[b]);
+                });
+            }
+            if (!countDuplicates) {
+                order.erase(std::unique(order.begin(), order.end(), [&](Index a, Index b) {
+                    return keyOf(originalArray[a]) == keyOf(originalArray[b]);
+                }), order.end());
+            }
+            stats.markNs = phases.lap();
+        }
+        stats.totalNs = stats.boundsNs + stats.planNs + stats.allocNs + stats.markNs + stats.extractNs;
+
+        recordDuration(startTime);
+        return order;
+    }
+
+    // ------------------------------------------------------------
+    // Accessor: getSortedArray
+    // ------------------------------------------------------------
+    // Returns:
+    //   A constant reference to the sorted array.
+    // ------------------------------------------------------------
+    const std::vector<T>& getSortedArray() const { return sortedArray; }
+
+    // ------------------------------------------------------------
+    // Method: buildIndex
+    // ------------------------------------------------------------
+    // Returns:
+    //   A PresenceIndex over the distinct keys of the original
+    //   array. It replaces sort() for consumers that only need the
+    //   first few keys, a key range, or rank/select: the bitmap is
+    //   kept and queried in place, and no sorted array is written.
+    // ------------------------------------------------------------
+    PresenceIndex<Key> buildIndex() const {
+        if constexpr (kKeysOnly) {
+            return PresenceIndex<Key>(std::span<const Key>(originalArray));
+        } else {
+            std::vector<Key> keys;
+            keys.reserve(originalArray.size());
+            for (const T& element : originalArray) keys.push_back(keyOf(element));
+            return PresenceIndex<Key>(std::span<const Key>(keys));
+        }
+    }
+
+    // ------------------------------------------------------------
+    // Method: buildSet
+    // ------------------------------------------------------------
+    // Returns:
+    //   A PresenceSet of the distinct keys of the original array,
+    //   for set algebra against other batches without sorting
+    //   either of them.
+    // ------------------------------------------------------------
+    PresenceSet<Key> buildSet() const {
+        if constexpr (kKeysOnly) {
+            return PresenceSet<Key>(std::span<const Key>(originalArray));
+        } else {
+            std::vector<Key> keys;
+            keys.reserve(originalArray.size());
+            for (const T& element : originalArray) keys.push_back(keyOf(element));
+            return PresenceSet<Key>(std::span<const Key>(keys));
+        }
+    }
+
+    // ------------------------------------------------------------
+    // Accessor: getRunLengths
+    // ------------------------------------------------------------
+    // Returns:
+    //   The (key, count) runs of the last counting sort, in
+    //   increasing key order. Empty unless both the counting mode
+    //   and run-length output are enabled.
+    // ------------------------------------------------------------
+    const std::vector<ValueRun<Key>>& getRunLengths() const { return runLengths; }
+
+    // ------------------------------------------------------------
+    // Accessor: getCounterWidth
+    // ------------------------------------------------------------
+    // Returns:
+    //   The counter width picked by the last counting sort.
+    // ------------------------------------------------------------
+    PresenceCounter::Width getCounterWidth() const { return counterWidth; }
+
+    // ------------------------------------------------------------
+    // Accessor: getStats
+    // ------------------------------------------------------------
+    // Returns:
+    //   Phase timings, allocation and hardware counters of the last
+    //   sort() (see SortStats; toJson() gives a JSON dump).
+    // ------------------------------------------------------------
+    const SortStats& getStats() const { return stats; }
+
+    // ------------------------------------------------------------
+    // Accessor: getSortDurationMs
+    // ------------------------------------------------------------
+    // Returns:
+    //   The time taken (in milliseconds) to perform the sorting.
+    // ------------------------------------------------------------
+    long long getSortDurationMs() const { return sortDurationMs; }
+
+    // ------------------------------------------------------------
+    // Accessor: getOriginalArraySize
+    // ------------------------------------------------------------
+    // Returns:
+    //   The number of elements in the original unsorted array.
+    // ------------------------------------------------------------
+    size_t getOriginalArraySize() const { return originalArray.size(); }
+
+    // ------------------------------------------------------------
+    // Accessor: getExistsArraySize
+    // ------------------------------------------------------------
+    // Returns:
+    //   The number of slots in the "exists" bitmap used during sorting.
+    // ------------------------------------------------------------
+    unsigned long long getExistsArraySize() const { return existsArraySize; }
+
+    // ------------------------------------------------------------
+    // Accessor: getStrategy
+    // ------------------------------------------------------------
+    // Returns:
+    //   The strategy used by the last sort().
+    // ------------------------------------------------------------
+    SortPlanner::Strategy getStrategy() const { return chosenPlan.strategy; }
+
+    // ------------------------------------------------------------
+    // Accessor: getCostEstimateNs
+    // ------------------------------------------------------------
+    // Returns:
+    //   The planner's cost estimate, in nanoseconds, for the
+    //   strategy used by the last sort().
+    // ------------------------------------------------------------
+    double getCostEstimateNs() const { return chosenPlan.estimatedNs; }
+
+private:
+    // Returns the min and max key of originalArray[begin, end).
+    std::pair<Key, Key> keyBounds(size_t begin, size_t end) const {
+        Key lo = keyOf(originalArray[begin]);
+        Key hi = lo;
+        for (size_t i = begin + 1; i < end; ++i) {
+            Key key = keyOf(originalArray[i]);
+            lo = std::min(lo, key);
+            hi = std::max(hi, key);
+        }
+        return { lo, hi };
+    }
+
+    // Offset of a key from the minimum, in the unsigned key type.
+    static UKey offsetOf(Key key, Key minKey) {
+        return static_cast<UKey>(static_cast<UKey>(key) - static_cast<UKey>(minKey));
+    }
+
+    // Key stored at a slot offset from the minimum.
+    static Key keyAt(unsigned long long slot, Key minKey) {
+        return static_cast<Key>(static_cast<UKey>(static_cast<UKey>(minKey) + static_cast<UKey>(slot)));
+    }
+
+    template <typename TimePoint>
+    void recordDuration(TimePoint startTime) {
+        auto endTime = std::chrono::high_resolution_clock::now();
+        sortDurationMs = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime).count();
+    }
+
+    // Bytes held by the buffers that persist across sorts.
+    size_t heldBufferBytes() const {
+        return exists.capacityBytes() + sortedArray.capacity() * sizeof(T) +
+               runLengths.capacity() * sizeof(ValueRun<Key>) + markScratch.capacity() * sizeof(uint32_t) +
+               markSlices.capacityBytes();
+    }
+
+    // Closes the stats of one sort(): adds the growth of the
+    // persistent buffers, reads the hardware counters and sums the
+    // phases (plus any time after the last one) into totalNs.
+    void finishStats(PerfCounters& counters, size_t heldBytesBefore) {
+        uint64_t tail = phases.lap();
+        counters.stop(stats);
+        size_t held = heldBufferBytes();
+        if (held > heldBytesBefore) stats.bytesAllocated += held - heldBytesBefore;
+        stats.totalNs = stats.boundsNs + stats.planNs + stats.allocNs + stats.markNs + stats.extractNs +
+                        stats.clearNs + tail;
+    }
+
+    // ------------------------------------------------------------
+    // Method: sortWithFixedBitmap
+    // ------------------------------------------------------------
+    // Role:
+    //   Steps 2 and 3 of sort() for 8- and 16-bit integers, using a
+    //   stack-resident FixedPresenceBitmap over the whole key range.
+    // ------------------------------------------------------------
+    void sortWithFixedBitmap() {
+        if constexpr (kKeysOnly && kNarrowKeys) {
+            FixedPresenceBitmap<Key> fixedExists;
+            for (Key key : originalArray) {
+                fixedExists.set(key);
+            }
+            stats.markNs = phases.lap();
+            existsArraySize = FixedPresenceBitmap<Key>::kBits;
+            SortPlanner::Input shape = { originalArray.size(), existsArraySize, existsArraySize, 1, 1, true };
+            chosenPlan = { SortPlanner::Strategy::Bitmap,
+                           SortPlanner::estimate(SortPlanner::Strategy::Bitmap, shape) };
+            sortedArray.resize(fixedExists.count());
+            fixedExists.extract(sortedArray.data());
+            stats.extractNs = phases.lap();
+        }
+    }
+
+    // ------------------------------------------------------------
+    // Method: sortWithBitmap
+    // ------------------------------------------------------------
+    // Role:
+    //   Steps 2 and 3 of sort() for duplicate-free integer input.
+    // ------------------------------------------------------------
+    void sortWithBitmap(Key minKey, unsigned threads) {
+        // Step 2: Populate the presence bitmap indicating key presence.
+        // The bitmap persists across sort() calls and is left all-zero
+        // after each one, so reuse only pays for the words it touches.
+        if (exists.getMemoryPolicy().placement == BitmapMemoryPolicy::Placement::FirstTouch &&
+            exists.getMemoryPolicy().prefaultThreads != threads) {
+            BitmapMemoryPolicy policy = exists.getMemoryPolicy();
+            policy.prefaultThreads = threads;  // Fault pages in where the shards run.
+            exists.setMemoryPolicy(policy);
+        }
+        exists.resizeClean(static_cast<size_t>(existsArraySize));
+        stats.allocNs = phases.lap();
+        // The dispatched kernel offsets each key by the minimum.
+        if (threads > 1) {
+            parallelFor(threads, originalArray.size(), [&](size_t begin, size_t end, unsigned) {
+                exists.markAllAtomic(originalArray.data() + begin, end - begin, minKey);
+            });
+        } else if (PresenceBitmap::useBlockedMarking(markMode, originalArray.size(), exists.size())) {
+            // Huge bitmaps: partition by L2-sized slice, then mark each.
+            if (markScratch.size() < originalArray.size()) markScratch.resize(originalArray.size());
+            exists.markAllBlocked(originalArray.data(), originalArray.size(), minKey, markScratch.data(),
+                                  markSlices);
+        } else {
+            exists.markAll(originalArray.data(), originalArray.size(), minKey);
+        }
+        stats.markNs = phases.lap();
+
+        // Step 3: Build the sorted array by extracting set bits word by word.
+        // The output is pre-sized from a popcount so extraction writes
+        // directly into it without push_back bookkeeping.
+        if (threads > 1) {
+            size_t shardCount = (exists.wordCount() + kShardWords - 1) / kShardWords;
+            std::vector<size_t> shardOffset(shardCount + 1, 0);
+            parallelFor(threads, shardCount, [&](size_t begin, size_t end, unsigned) {
+                for (size_t shard = begin; shard < end; ++shard) {
+                    shardOffset[shard + 1] = exists.countWords(shard * kShardWords,
+                        std::min(exists.wordCount(), (shard + 1) * kShardWords));
+                }
+            });
+            for (size_t shard = 0; shard < shardCount; ++shard) {
+                shardOffset[shard + 1] += shardOffset[shard]; // Exclusive prefix sum.
+            }
+            sortedArray.resize(shardOffset[shardCount]);
+            Key* out = sortedArray.data();
+            parallelFor(threads, shardCount, [&](size_t begin, size_t end, unsigned) {
+                for (size_t shard = begin; shard < end; ++shard) {
+                    exists.extractWords(shard * kShardWords,
+                                        std::min(exists.wordCount(), (shard + 1) * kShardWords),
+                                        out + shardOffset[shard], out + shardOffset[shard + 1],
+                                        minKey);
+                }
+            });
+        } else {
+            sortedArray.resize(exists.count());
+            exists.extract(sortedArray.data(), sortedArray.data() + sortedArray.size(), minKey);
+        }
+        stats.extractNs = phases.lap();
+
+        // Leave the bitmap clean for the next sort().
+        if (threads > 1) {
+            parallelFor(threads, exists.wordCount(), [&](size_t begin, size_t end, unsigned) {
+                std::fill(exists.data() + begin, exists.data() + end, 0);
+            });
+            exists.clearSummary();
+        } else {
+            exists.clearMarked(originalArray.data(), originalArray.size(), minKey);
+        }
+        stats.clearNs = phases.lap();
+    }
+
+    // ------------------------------------------------------------
+    // Method: sortWithChunks
+    // ------------------------------------------------------------
+    // Role:
+    //   Steps 2 and 3 of sort() with a ChunkedPresenceSet: insert
+    //   each offset, finalize the containers, then iterate them in
+    //   order. Memory follows n instead of k.
+    // ------------------------------------------------------------
+    void sortWithChunks(Key minKey, unsigned long long span) {
+        ChunkedPresenceSet chunks(span);
+        stats.allocNs = phases.lap();
+        for (Key key : originalArray) {
+            chunks.insert(static_cast<uint32_t>(offsetOf(key, minKey)));
+        }
+        chunks.finalize();
+        stats.markNs = phases.lap();
+        stats.bytesAllocated += chunks.memoryBytes();
+        sortedArray.resize(chunks.cardinality());
+        chunks.extract(sortedArray.data(), minKey);
+        stats.extractNs = phases.lap();
+    }
+
+    // ------------------------------------------------------------
+    // Method: sortWithCounts
+    // ------------------------------------------------------------
+    // Role:
+    //   Steps 2 and 3 of sort() in counting mode: counts every
+    //   occurrence, then writes each key as many times as it was
+    //   seen (and optionally its run) in increasing order.
+    // ------------------------------------------------------------
+    void sortWithCounts(Key minKey) {
+        // Step 2: Count occurrences of each key.
+        PresenceCounter counts(static_cast<size_t>(existsArraySize), counterWidth);
+        stats.allocNs = phases.lap();
+        for (Key key : originalArray) {
+            counts.add(static_cast<size_t>(offsetOf(key, minKey)));
+        }
+        stats.markNs = phases.lap();
+        stats.bytesAllocated += counts.memoryBytes();
+
+        // Step 3: Expand the counts. Every element is emitted, so the
+        // output has exactly the input's size.
+        sortedArray.resize(originalArray.size());
+        Key* out = sortedArray.data();
+        counts.forEachRun([&](size_t slot, size_t count) {
+            Key key = keyAt(slot, minKey);
+            out = std::fill_n(out, count, key);
+            if (emitRunLengths) runLengths.push_back({ key, count });
+        });
+        stats.extractNs = phases.lap();
+    }
+
+    // ------------------------------------------------------------
+    // Method: sortWithScatter
+    // ------------------------------------------------------------
+    // Role:
+    //   Steps 2 and 3 of sort() for records: counts keys per slot,
+    //   turns the counts into start offsets with an exclusive
+    //   prefix sum, and scatters each record to its slot in input
+    //   order, so equal keys keep their relative order. Without
+    //   counting mode only the first record of each key is kept.
+    //   Slot starts are 32-bit unless there are 2^32 or more
+    //   records, which halves the slot array for the common case.
+    // ------------------------------------------------------------
+    void sortWithScatter(Key minKey) {
+        if (originalArray.size() < (size_t(1) << 32)) {
+            scatterWith<uint32_t>(minKey);
+        } else {
+            scatterWith<uint64_t>(minKey);
+        }
+    }
+
+    template <typename Start>
+    void scatterWith(Key minKey) {
+        size_t slots = static_cast<size_t>(existsArraySize);
+        std::vector<Start> start(slots, 0);
+        PresenceBitmap seen(countDuplicates ? 0 : slots);
+        stats.allocNs = phases.lap();
+        stats.bytesAllocated += start.capacity() * sizeof(start[0]) + seen.capacityBytes();
+
+        // Step 2: Count records per slot (at most one without counting).
+        for (const T& item : originalArray) {
+            size_t slot = static_cast<size_t>(offsetOf(keyOf(item), minKey));
+            if (countDuplicates) {
+                ++start[slot];
+            } else {
+                start[slot] = 1;
+            }
+        }
+        size_t running = 0;
+        for (Start& slotStart : start) {
+            Start slotCount = slotStart;
+            slotStart = static_cast<Start>(running);
+            running += slotCount;
+        }
+        stats.markNs = phases.lap();
+
+        // Step 3: Scatter records to their slots.
+        sortedArray.resize(running);
+        for (const T& item : originalArray) {
+            size_t slot = static_cast<size_t>(offsetOf(keyOf(item), minKey));
+            if (!countDuplicates) {
+                if (seen.test(slot)) continue;
+                seen.set(slot);
+            }
+            sortedArray[start[slot]++] = item;
+        }
+        if (countDuplicates && emitRunLengths) appendRunLengths();
+        stats.extractNs = phases.lap();
+    }
+
+    // ------------------------------------------------------------
+    // Method: sortWithRadix
+    // ------------------------------------------------------------
+    // Role:
+    //   Sorts by key offset from the minimum with RadixSorter,
+    //   which needs O(n) scratch instead of an O(k) bitmap.
+    //   Integers are sorted as offsets and shifted back; records
+    //   are moved directly.
+    // ------------------------------------------------------------
+    void sortWithRadix(Key minKey, unsigned long long maxOffset) {
+        if constexpr (kKeysOnly) {
+            std::vector<UKey> offsets(originalArray.size());
+            stats.bytesAllocated += 2 * offsets.size() * sizeof(UKey);  // Offsets and radix scratch.
+            for (size_t i = 0; i < offsets.size(); ++i) {
+                offsets[i] = offsetOf(originalArray[i], minKey);
+            }
+            RadixSorter::sort(offsets, maxOffset, [](UKey offset) {
+                return static_cast<unsigned long long>(offset);
+            });
+            sortedArray.resize(offsets.size());
+            for (size_t i = 0; i < offsets.size(); ++i) {
+                sortedArray[i] = keyAt(offsets[i], minKey);
+            }
+        } else {
+            sortedArray = originalArray;
+            stats.bytesAllocated += sortedArray.size() * sizeof(T);  // Radix scratch.
+            RadixSorter::sort(sortedArray, maxOffset, [&](const T& item) {
+                return static_cast<unsigned long long>(offsetOf(keyOf(item), minKey));
+            });
+        }
+        finishSortedCopy();
+        stats.markNs = phases.lap();
+    }
+
+    // ------------------------------------------------------------
+    // Method: sortWithComparison
+    // ------------------------------------------------------------
+    // Role:
+    //   Sorts a copy of the input with std::sort (introsort), or
+    //   std::stable_sort for records so equal keys keep their order.
+    // ------------------------------------------------------------
+    void sortWithComparison() {
+        sortedArray = originalArray;
+        if constexpr (kKeysOnly) {
+            std::sort(sortedArray.begin(), sortedArray.end());
+        } else {
+            std::stable_sort(sortedArray.begin(), sortedArray.end(), [&](const T& a, const T& b) {
+                return keyOf(a) < keyOf(b);
+            });
+        }
+        finishSortedCopy();
+        stats.markNs = phases.lap();
+    }
+
+    // ------------------------------------------------------------
+    // Method: sampleTopKCut
+    // ------------------------------------------------------------
+    // Role:
+    //   Step 1 of sortTopK(). Takes kTopKSamples evenly strided keys
+    //   and picks the one at about twice k's expected share of the
+    //   sample, plus slack, so the cut usually keeps enough
+    //   elements on the first try.
+    //
+    // Returns:
+    //   False when the cut would keep most of the input anyway.
+    // ------------------------------------------------------------
+    bool sampleTopKCut(size_t k, bool ascending, Key& cut) const {
+        size_t n = originalArray.size();
+        if (k >= n / 4) return false;
+        size_t samples = std::min(n, kTopKSamples);
+        double share = static_cast<double>(k) / static_cast<double>(n);
+        size_t position = static_cast<size_t>(share * static_cast<double>(samples) * 2.0) + 16;
+        if (position >= samples / 2) return false;
+
+        std::vector<Key> sample(samples);
+        size_t stride = n / samples;
+        for (size_t i = 0; i < samples; ++i) sample[i] = keyOf(originalArray[i * stride]);
+        if (ascending) {
+            std::nth_element(sample.begin(), sample.begin() + position, sample.end());
+        } else {
+            std::nth_element(sample.begin(), sample.begin() + position, sample.end(), std::greater<Key>());
+        }
+        cut = sample[position];
+        return true;
+    }
+
+    // True if key is on the kept side of a sortTopK() cut.
+    static bool withinCut(Key key, bool ascending, Key cut) {
+        return ascending ? key <= cut : key >= cut;
+    }
+
+    // ------------------------------------------------------------
+    // Method: topKWithBitmap
+    // ------------------------------------------------------------
+    // Role:
+    //   Steps 2 and 3 of sortTopK() for integer keys: marks the kept
+    //   keys over their own [min, max] and extracts the first k set
+    //   bits, from the low end or, using clz, from the high end.
+    //   Large candidate sets are marked on threadCount threads.
+    //   Sparse candidates the planner would not bitmap-sort are
+    //   radix- or comparison-sorted directly instead.
+    // ------------------------------------------------------------
+    void topKWithBitmap(size_t k, bool ascending, bool filtered, Key cut) {
+        if constexpr (kKeysOnly) {
+            // Step 2: Keep the keys on the wanted side of the cut.
+            std::vector<Key> kept;
+            if (filtered) {
+                for (Key key : originalArray) {
+                    if (withinCut(key, ascending, cut)) kept.push_back(key);
+                }
+                stats.bytesAllocated += kept.capacity() * sizeof(Key);
+            }
+            const std::vector<Key>& keys = filtered ? kept : originalArray;
+            if (keys.empty()) return;
+            auto bounds = std::minmax_element(keys.begin(), keys.end());
+            Key minKey = *bounds.first;
+            unsigned long long maxOffset = offsetOf(*bounds.second, minKey);
+            unsigned long long span = maxOffset == ~0ULL ? maxOffset : maxOffset + 1;
+            stats.boundsNs += phases.lap();
+            unsigned threads = keys.size() >= kParallelMinElements ? threadCount : 1;
+            SortPlanner::Input shape = { keys.size(), span,
+                PresenceBitmap::scanSlots(keys.size(), span, exists.hasSummary()), 1, threads, true };
+            chosenPlan = SortPlanner::plan(shape, strategyOverride);
+            stats.planNs += phases.lap();
+            if (chosenPlan.strategy != SortPlanner::Strategy::Bitmap) {
+                sortedArray = keys;
+                if (chosenPlan.strategy == SortPlanner::Strategy::Radix) {
+                    stats.bytesAllocated += sortedArray.size() * sizeof(Key);  // Radix scratch.
+                    RadixSorter::sort(sortedArray, maxOffset, [&](Key key) {
+                        unsigned long long offset = offsetOf(key, minKey);
+                        return ascending ? offset : maxOffset - offset;
+                    });
+                } else {
+                    chosenPlan.strategy = SortPlanner::Strategy::Comparison;
+                    if (ascending) {
+                        std::sort(sortedArray.begin(), sortedArray.end());
+                    } else {
+                        std::sort(sortedArray.begin(), sortedArray.end(), std::greater<Key>());
+                    }
+                }
+                sortedArray.erase(std::unique(sortedArray.begin(), sortedArray.end()), sortedArray.end());
+                stats.markNs += phases.lap();
+                return;
+            }
+
+            // Step 3: Mark, then scan from the wanted end until k keys.
+            existsArraySize = span;
+            exists.resizeClean(static_cast<size_t>(span));
+            stats.allocNs += phases.lap();
+            markKeptKeys(keys, minKey, threads);
+            stats.markNs += phases.lap();
+            sortedArray.reserve(std::min(k, keys.size()));
+            const uint64_t* words = exists.data();
+            size_t wordCount = exists.wordCount();
+            for (size_t step = 0; step < wordCount && sortedArray.size() < k; ++step) {
+                size_t wi = ascending ? step : wordCount - 1 - step;
+                uint64_t w = words[wi];
+                UKey wordBase = static_cast<UKey>(static_cast<UKey>(minKey) +
+                                                  static_cast<UKey>(wi * PresenceBitmap::kWordBits));
+                while (w && sortedArray.size() < k) {
+                    unsigned bit = ascending ? static_cast<unsigned>(__builtin_ctzll(w))
+                                             : 63u - static_cast<unsigned>(__builtin_clzll(w));
+                    sortedArray.push_back(static_cast<Key>(static_cast<UKey>(wordBase + bit)));
+                    w &= ~(uint64_t(1) << bit);
+                }
+            }
+            stats.extractNs += phases.lap();
+            exists.clearMarked(keys.data(), keys.size(), minKey);
+            stats.clearNs += phases.lap();
+        }
+    }
+
+    // Marks the kept keys, on several threads for large sets. Not
+    // inlined: with the parallelFor() closure in topKWithBitmap(),
+    // GCC kept the kept vector in memory and the filter pass over
+    // the whole input ran about 2x slower.
+    __attribute__((noinline)) void markKeptKeys(const std::vector<Key>& keys, Key minKey, unsigned threads) {
+        if (threads > 1) {
+            parallelFor(threads, keys.size(), [&](size_t begin, size_t end, unsigned) {
+                exists.markAllAtomic(keys.data() + begin, end - begin, minKey);
+            });
+        } else {
+            exists.markAll(keys.data(), keys.size(), minKey);
+        }
+    }
+
+    // ------------------------------------------------------------
+    // Method: topKWithCopy
+    // ------------------------------------------------------------
+    // Role:
+    //   Steps 2 and 3 of sortTopK() for records and counting mode:
+    //   copies the kept elements, sorts them stably by key in the
+    //   wanted order (radix when planned or forced, else
+    //   std::stable_sort), and drops repeated keys unless counting.
+    // ------------------------------------------------------------
+    void topKWithCopy(bool ascending, bool filtered, Key cut) {
+        for (const T& element : originalArray) {
+            if (!filtered || withinCut(keyOf(element), ascending, cut)) sortedArray.push_back(element);
+        }
+        if (sortedArray.empty()) return;
+        Key minKey = keyOf(sortedArray[0]);
+        Key maxKey = minKey;
+        for (const T& element : sortedArray) {
+            minKey = std::min(minKey, keyOf(element));
+            maxKey = std::max(maxKey, keyOf(element));
+        }
+        unsigned long long maxOffset = offsetOf(maxKey, minKey);
+        unsigned long long span = maxOffset == ~0ULL ? maxOffset : maxOffset + 1;
+        stats.boundsNs += phases.lap();
+        // Only the radix path sorts copies of records stably besides
+        // std::stable_sort, so the bitmap paths are not offered.
+        SortPlanner::Input shape = { sortedArray.size(), span, span, 32, 1, false };
+        chosenPlan = SortPlanner::plan(shape, strategyOverride);
+        if (chosenPlan.strategy != SortPlanner::Strategy::Radix) {
+            chosenPlan = { SortPlanner::Strategy::Comparison,
+                           SortPlanner::estimate(SortPlanner::Strategy::Comparison, shape) };
+        }
+        stats.planNs += phases.lap();
+        if (chosenPlan.strategy == SortPlanner::Strategy::Radix) {
+            stats.bytesAllocated += sortedArray.size() * sizeof(T);  // Radix scratch.
+            RadixSorter::sort(sortedArray, maxOffset, [&](const T& element) {
+                unsigned long long offset = offsetOf(keyOf(element), minKey);
+                return ascending ? offset : maxOffset - offset;
+            });
+        } else {
+            std::stable_sort(sortedArray.begin(), sortedArray.end(), [&](const T& a, const T& b) {
+                return ascending ? keyOf(a) < keyOf(b) : keyOf(b) < keyOf(a);
+            });
+        }
+        stats.markNs += phases.lap();
+        if (!countDuplicates) {
+            sortedArray.erase(std::unique(sortedArray.begin(), sortedArray.end(),
+                                          [&](const T& a, const T& b) { return keyOf(a) == keyOf(b); }),
+                              sortedArray.end());
+        }
+    }
+
+    // ------------------------------------------------------------
+    // Method: finishSortedCopy
+    // ------------------------------------------------------------
+    // Role:
+    //   Gives a fully sorted copy the same semantics as the bitmap
+    //   path: each key is kept once (its first element) unless
+    //   counting, and the run-length output is filled when requested.
+    // ------------------------------------------------------------
+    void finishSortedCopy() {
+        if (!countDuplicates) {
+            sortedArray.erase(std::unique(sortedArray.begin(), sortedArray.end(),
+                                          [&](const T& a, const T& b) { return keyOf(a) == keyOf(b); }),
+                              sortedArray.end());
+            return;
+        }
+        if (emitRunLengths) appendRunLengths();
+    }
+
+    // Fills runLengths from the sorted array's runs of equal keys.
+    void appendRunLengths() {
+        for (size_t i = 0; i < sortedArray.size();) {
+            Key key = keyOf(sortedArray[i]);
+            size_t j = i + 1;
+            while (j < sortedArray.size() && keyOf(sortedArray[j]) == key) ++j;
+            runLengths.push_back({ key, j - i });
+            i = j;
+        }
+    }
+
+    static unsigned counterBitsOf(PresenceCounter::Width width) {
+        switch (width) {
+            case PresenceCounter::Width::TwoBit: return 2;
+            case PresenceCounter::Width::U8:     return 8;
+            case PresenceCounter::Width::U16:    return 16;
+            default:                             return 32;
+        }
+    }
+
+    // Inputs below this size are always sorted on the calling thread.
+    static constexpr size_t kParallelMinElements = size_t(1) << 16;
+    // Words per extraction shard: 32K words = 256 KB, sized for L2.
+    static constexpr size_t kShardWords = size_t(1) << 15;
+    // Keys sampled to place the sortTopK() cut.
+    static constexpr size_t kTopKSamples = 4096;
+
+    std::vector<T> originalArray;    // The original unsorted array.
+    std::vector<T> sortedArray;      // The resulting sorted array.
+    KeyFn keyOf;                     // Projection from element to key.
+    PresenceBitmap exists;           // Presence bitmap, kept all-zero between sorts.
+    long long sortDurationMs;        // Time taken for sorting in milliseconds.
+    unsigned long long existsArraySize; // Number of slots in the "exists" bitmap.
+    unsigned threadCount;            // Threads used by sort(); 1 = sequential.
+    bool countDuplicates;            // Keep repeated keys (multiset sort).
+    bool emitRunLengths;             // Also build runLengths in counting mode.
+    PresenceCounter::Width counterWidth; // Counter width of the last counting sort.
+    std::vector<ValueRun<Key>> runLengths; // (key, count) runs of the last counting sort.
+    SortPlanner::Strategy strategyOverride; // Forced strategy, or Auto.
+    SortPlanner::Plan chosenPlan;        // Strategy and estimate of the last sort.
+    SortStats stats;                 // Phase timings and counters of the last sort.
+    PhaseClock phases;               // Stopwatch behind the stats phase timings.
+    bool collectHardwareCounters;    // Read perf_event counters during sort().
+    PresenceBitmap::MarkMode markMode;    // Direct or cache-blocked marking.
+    std::vector<uint32_t> markScratch;    // Partitioned offsets for blocked marking.
+    PresenceBitmap::SliceBuffers markSlices; // Per-slice state for blocked marking.
+};
+
+// ============================================================
+// Function: applyPermutation
+// ------------------------------------------------------------
+// Parameters:
+//   - records:     Records to reorder in place (keys, payloads or
+//                  whole structs).
+//   - permutation: A permutation from BigSorter::argsort(), with
+//                  32- or 64-bit indices: slot i of the result takes
+//                  records[permutation[i]]. It may be shorter than
+//                  records (distinct mode); the records no index
+//                  names are dropped.
+//
+// Role: In-place gather for records too large to copy twice. Every
+//       record is moved exactly once (plus one temporary per
+//       cycle), the only extra memory is two bits per record, and
+//       the next record of each chain is prefetched a hop ahead,
+//       so large records cost one streaming read and write each.
+//
+// Flow:
+//   1. Mark which positions are a source, rejecting indices that
+//      are out of range or repeated.
+//   2. Walk each open chain from its head (a destination that is
+//      no one's source) to the first position past the result.
+//   3. Rotate the remaining closed cycles through a temporary.
+//   4. Drop the records past the result.
+// ============================================================
+template <typename T, typename Index>
+void applyPermutation(std::vector<T>& records, std::span<const Index> permutation) {
+    size_t n = records.size();
+    size_t m = permutation.size();
+    if (m > n) {
+        std::cerr << "Error: permutation has " << m << " entries for " << n << " records.\n";
+        exit(1);
+    }
+    auto prefetch = [&](size_t index) {
+        const char* line = reinterpret_cast<const char*>(&records[index]);
+        for (size_t offset = 0; offset < sizeof(T); offset += 64) __builtin_prefetch(line + offset);
+    };
+
+    // Step 1: Sources, checked for a valid injection.
+    PresenceBitmap isSource(n);
+    for (Index source : permutation) {
+        if (source >= n || isSource.test(source)) {
+            std::cerr << "Error: permutation index " << source << " is out of range or repeated.\n";
+            exit(1);
+        }
+        isSource.set(source);
+    }
+
+    // Step 2: Open chains. Position j takes records[permutation[j]],
+    // whose own slot then needs filling; the chain ends once that
+    // slot lies past the result.
+    PresenceBitmap done(m);
+    for (size_t head = 0; head < m; ++head) {
+        if (isSource.test(head)) continue;
+        for (size_t j = head; j < m; j = permutation[j]) {
+            if (permutation[j] < m) prefetch(permutation[permutation[j]]);
+            records[j] = std::move(records[permutation[j]]);
+            done.set(j);
+        }
+    }
+
+    // Step 3: Closed cycles.
+    for (size_t start = 0; start < m; ++start) {
+        if (done.test(start)) continue;
+        T carried = std::move(records[start]);
+        size_t j = start;
+        while (permutation[j] != start) {
+            prefetch(permutation[permutation[j]]);
+            records[j] = std::move(records[permutation[j]]);
+            done.set(j);
+            j = permutation[j];
+        }
+        records[j] = std::move(carried);
+        done.set(j);
+    }
+
+    // Step 4: Keep the result.
+    records.erase(records.begin() + static_cast<std::ptrdiff_t>(m), records.end());
+}
+
+// Overload for the vector argsort() returns.
+template <typename T, typename Index>
+void applyPermutation(std::vector<T>& records, const std::vector<Index>& permutation) {
+    applyPermutation(records, std::span<const Index>(permutation));
+}
+
+// ============================================================
+// Class: SortWorkspace
+// ------------------------------------------------------------
+// Role: Reusable scratch memory for bigSort(). Holds the presence
+//       bitmap, the radix scratch buffer and the blocked-marking
+//       slice buffers between calls; all of them only grow, so
+//       once a workspace has seen the largest batch shape, further
+//       sorts perform no heap allocation. The bitmap is left
+//       all-zero after every sort by clearing only the words its
+//       keys touched, so a small batch never pays to re-zero a
+//       large bitmap. A workspace must not be shared by concurrent
+//       calls.
+// ============================================================
+class SortWorkspace {
+public:
+    // ------------------------------------------------------------
+    // Constructor: SortWorkspace
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - reserveSlots:    Bitmap slots to preallocate.
+    //   - reserveElements: Radix scratch elements (of 8 bytes) to
+    //                      preallocate.
+    //   - bitmapPolicy:    How the bitmap is allocated (huge pages,
+    //                      NUMA placement, prefaulting); the
+    //                      workspace keeps it warm across sorts.
+    // ------------------------------------------------------------
+    explicit SortWorkspace(size_t reserveSlots = 0, size_t reserveElements = 0,
+                           const BitmapMemoryPolicy& bitmapPolicy = BitmapMemoryPolicy())
+        : scratchBytes(reserveElements * sizeof(uint64_t)) {
+        exists.setMemoryPolicy(bitmapPolicy);
+        exists.reset(reserveSlots);
+    }
+
+    // Gives the workspace bitmap a summary level; see PresenceBitmap.
+    // Call before the first sort, or between sorts.
+    void setSummaryEnabled(bool enabled) {
+        exists.clearAll();
+        exists.setSummaryEnabled(enabled);
+    }
+
+    bool hasSummary() const { return exists.hasSummary(); }
+
+    // Returns the all-zero bitmap sized for slotCount slots. The
+    // caller must clearMarked() it once the sort is done.
+    PresenceBitmap& bitmap(size_t slotCount) {
+        exists.resizeClean(slotCount);
+        return exists;
+    }
+
+    // Returns uninitialized scratch space for n trivially copyable items.
+    template <typename Item>
+    Item* scratch(size_t n) {
+        static_assert(std::is_trivially_copyable_v<Item>, "scratch holds trivially copyable items");
+        if (scratchBytes.size() < n * sizeof(Item)) {
+            scratchBytes.resize(n * sizeof(Item));
+        }
+        return reinterpret_cast<Item*>(scratchBytes.data());
+    }
+
+    // Per-slice state for blocked marking, reused like scratch().
+    PresenceBitmap::SliceBuffers& sliceBuffers() { return slices; }
+
+private:
+    PresenceBitmap exists;                   // Reused presence bitmap.
+    std::vector<unsigned char> scratchBytes; // Reused radix scratch.
+    PresenceBitmap::SliceBuffers slices;     // Reused blocked-marking state.
+};
+
+// ============================================================
+// Function: bigSort
+// ------------------------------------------------------------
+// Role: Zero-copy, allocation-free counterpart of BigSorter for
+//       integer keys. Reads the input in place, writes the sorted
+//       distinct keys straight into the caller's output, and takes
+//       all scratch memory from a reusable SortWorkspace.
+//
+// Parameters:
+//   - input:     Keys to sort; not modified.
+//   - output:    Destination; must hold at least input.size() keys.
+//   - workspace: Scratch memory reused across calls.
+//   - bitmapBudget: Byte limit for the bitmap on this call; 0
+//                uses SortPlanner::memoryBudget().
+//
+// Returns:
+//   The number of distinct keys written to the front of output.
+//
+// Flow:
+//   1. Find min and max in one pass.
+//   2. Let SortPlanner choose between the workspace bitmap, a
+//      radix sort using workspace scratch, and an in-place
+//      comparison sort of the output.
+//   3. Write the distinct keys in increasing order.
+// ============================================================
+template <typename Key>
+size_t bigSort(std::span<const Key> input, std::span<Key> output, SortWorkspace& workspace,
+               size_t bitmapBudget = 0) {
+    static_assert(std::is_integral_v<Key> && !std::is_same_v<Key, bool>, "bigSort keys must be integers");
+    using UKey = std::make_unsigned_t<Key>;
+    if (output.size() < input.size()) {
+        std::cerr << "Error: bigSort output holds " << output.size() << " keys but the input has "
+                  << input.size() << ".\n";
+        exit(1);
+    }
+    size_t n = input.size();
+    if (n == 0) return 0;
+
+    // Step 1: Determine the minimum and maximum keys.
+    Key minKey = input[0];
+    Key maxKey = input[0];
+    for (Key key : input) {
+        minKey = std::min(minKey, key);
+        maxKey = std::max(maxKey, key);
+    }
+    unsigned long long maxOffset = static_cast<UKey>(static_cast<UKey>(maxKey) - static_cast<UKey>(minKey));
+    unsigned long long span = maxOffset == ~0ULL ? maxOffset : maxOffset + 1;
+    auto offsetOf = [minKey](Key key) {
+        return static_cast<unsigned long long>(static_cast<UKey>(static_cast<UKey>(key) - static_cast<UKey>(minKey)));
+    };
+
+    // Steps 2 & 3: Sort by the planned strategy.
+    // The chunked containers allocate, so they are not offered here.
+    SortPlanner::Input shape = { n, span, PresenceBitmap::scanSlots(n, span, workspace.hasSummary()),
+                                 1, 1, false };
+    shape.budgetBytes = bitmapBudget;
+    switch (SortPlanner::plan(shape).strategy) {
+        case SortPlanner::Strategy::Bitmap: {
+            PresenceBitmap& exists = workspace.bitmap(static_cast<size_t>(span));
+            if (PresenceBitmap::prefersBlockedMarking(n, exists.size())) {
+                exists.markAllBlocked(input.data(), n, minKey, workspace.scratch<uint32_t>(n),
+                                      workspace.sliceBuffers());
+            } else {
+                exists.markAll(input.data(), n, minKey);
+            }
+            Key* end = exists.extract(output.data(), output.data() + output.size(), minKey);
+            exists.clearMarked(input.data(), n, minKey);
+            return static_cast<size_t>(end - output.data());
+        }
+        case SortPlanner::Strategy::Radix:
+            std::memcpy(output.data(), input.data(), n * sizeof(Key));
+            RadixSorter::sort(output.data(), workspace.scratch<Key>(n), n, maxOffset, offsetOf);
+            break;
+        default:
+            std::memcpy(output.data(), input.data(), n * sizeof(Key));
+            std::sort(output.data(), output.data() + n);
+            break;
+    }
+    return static_cast<size_t>(std::unique(output.data(), output.data() + n) - output.data());
+}
+
+// ============================================================
+// Class: StreamingBigSorter
+// ------------------------------------------------------------
+// Role: Incremental bitmap sort for keys that arrive in batches.
+//       insert() sets presence bits as each batch lands, so the
+//       work is spread across ingest; iterate() and drain() then
+//       only walk the bitmap. The key range is fixed up front and
+//       the summary level is always on, so reading and resetting
+//       a window cost time in proportion to the blocks it touched,
+//       not to the whole range.
+//
+// Usage:
+//   StreamingBigSorter<uint32_t> window(0, 1u << 30);
+//   window.insert(batch);            // any number of times
+//   std::vector<uint32_t> run = window.drain();   // sorted, reset
+// ============================================================
+template <typename Key>
+class StreamingBigSorter {
+public:
+    static_assert(std::is_integral_v<Key>, "StreamingBigSorter requires integer keys");
+
+    // ------------------------------------------------------------
+    // Constructor: StreamingBigSorter
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - minKey, maxKey: Inclusive range every inserted key must
+    //                     fall in. The bitmap is sized for it once.
+    //   - budgetBytes:    Largest bitmap to accept; 0 = no limit.
+    // ------------------------------------------------------------
+    StreamingBigSorter(Key minKey, Key maxKey, size_t budgetBytes = 0)
+        : base(minKey), limit(maxKey), inserted(0) {
+        size_t span = PresenceBitmap::spanFor(minKey, maxKey, budgetBytes);
+        if (span == 0) {
+            std::cerr << "Error: StreamingBigSorter range is empty or too large for a bitmap.\n";
+            exit(1);
+        }
+        exists.setSummaryEnabled(true);
+        exists.reset(span);
+    }
+
+    // ------------------------------------------------------------
+    // Method: insert
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - keys: Next batch of keys, each within [minKey, maxKey].
+    //
+    // Role:
+    //   Marks the batch into the current window. Duplicates, within
+    //   or across batches, collapse to one key.
+    // ------------------------------------------------------------
+    void insert(std::span<const Key> keys) {
+        for (Key key : keys) {
+            if (key < base || key > limit) {
+                std::cerr << "Error: key " << +key << " is outside the StreamingBigSorter range.\n";
+                exit(1);
+            }
+        }
+        exists.markAll(keys.data(), keys.size(), base);
+        inserted += keys.size();
+    }
+
+    // ------------------------------------------------------------
+    // Method: iterate
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - visit: Called as visit(key) for each distinct key of the
+    //            window, in ascending order.
+    //
+    // Role:
+    //   Reads the window without resetting it, extracting through a
+    //   fixed buffer one stretch of kIterateWords words at a time.
+    // ------------------------------------------------------------
+    template <typename Visit>
+    void iterate(Visit visit) const {
+        constexpr size_t kIterateWords = 16 * PresenceBitmap::kBlockWords;
+        std::vector<Key> buffer(kIterateWords * PresenceBitmap::kWordBits);
+        for (size_t wordBegin = 0; wordBegin < exists.wordCount(); wordBegin += kIterateWords) {
+            size_t wordEnd = std::min(exists.wordCount(), wordBegin + kIterateWords);
+            Key* end = exists.extractWords(wordBegin, wordEnd, buffer.data(),
+                                           buffer.data() + buffer.size(), base);
+            for (Key* key = buffer.data(); key != end; ++key) visit(*key);
+        }
+    }
+
+    // ------------------------------------------------------------
+    // Method: drain
+    // ------------------------------------------------------------
+    // Returns:
+    //   The window's distinct keys in ascending order. The window
+    //   is then reset, ready for the next batch.
+    // ------------------------------------------------------------
+    std::vector<Key> drain() {
+        std::vector<Key> sorted(exists.count());
+        exists.extract(sorted.data(), sorted.data() + sorted.size(), base);
+        reset();
+        return sorted;
+    }
+
+    // Discards the current window without reading it.
+    void reset() {
+        exists.clearTouched();
+        inserted = 0;
+    }
+
+    // Keys inserted into the current window, duplicates included.
+    size_t insertedCount() const { return inserted; }
+
+    // Distinct keys in the current window.
+    size_t distinctCount() const { return exists.count(); }
+
+private:
+    PresenceBitmap exists;  // Presence of each key offset in the window.
+    Key base;               // minKey; offsets are key - base.
+    Key limit;              // maxKey.
+    size_t inserted;        // Keys inserted since the last reset.
+};
+
+// ============================================================
+// Class: IntegerWriter
+// ------------------------------------------------------------
+// Role: Buffered integer formatter for bulk output. Values are
+//       formatted with std::to_chars into one large buffer that
+//       is written with a single fwrite when full, instead of one
+//       locale-aware operator<< call per value. A short write is
+//       sticky: flush() and good() report it until the writer is
+//       destroyed, so callers check once at the end.
+// ============================================================
+class IntegerWriter {
+public:
+    static constexpr size_t kDefaultBufferBytes = size_t(1) << 20;
+    static constexpr size_t kMaxValueChars = 24;  // 20 digits, sign, separator.
+
+    explicit IntegerWriter(FILE* output, size_t bufferBytes = kDefaultBufferBytes)
+        : out(output), buffer(std::max(bufferBytes, kMaxValueChars)), used(0), failed(false) { }
+
+    IntegerWriter(const IntegerWriter&) = delete;
+    IntegerWriter& operator=(const IntegerWriter&) = delete;
+
+    ~IntegerWriter() { flush(); }
+
+    // Appends value followed by separator.
+    template <typename Key>
+    void write(Key value, char separator = ' ') {
+        if (buffer.size() - used < kMaxValueChars) flush();
+        char* begin = buffer.data() + used;
+        char* end = std::to_chars(begin, buffer.data() + buffer.size(), value).ptr;
+        *end++ = separator;
+        used = static_cast<size_t>(end - buffer.data());
+    }
+
+    template <typename Key>
+    void writeAll(std::span<const Key> values, char separator = ' ') {
+        for (Key value : values) write(value, separator);
+    }
+
+    void writeText(const std::string& text) {
+        if (buffer.size() - used < text.size()) flush();
+        if (text.size() > buffer.size()) {
+            writeOut(text.data(), text.size());
+            return;
+        }
+        std::memcpy(buffer.data() + used, text.data(), text.size());
+        used += text.size();
+    }
+
+    // Writes out everything buffered. Returns false if this or any
+    // earlier write came up short.
+    bool flush() {
+        writeOut(buffer.data(), used);
+        used = 0;
+        if (std::fflush(out) != 0) failed = true;
+        return !failed;
+    }
+
+    // False once any write has come up short.
+    bool good() const { return !failed; }
+
+private:
+    void writeOut(const char* data, size_t bytes) {
+        if (bytes && std::fwrite(data, 1, bytes, out) != bytes) failed = true;
+    }
+
+    FILE* out;                 // Destination stream.
+    std::vector<char> buffer;  // Formatted text not yet written.
+    size_t used;               // Bytes of buffer in use.
+    bool failed;               // A write came up short.
+};
+
+// ============================================================
+// Class: ChunkRing
+// ------------------------------------------------------------
+// Role: Bounded multi-producer / single-consumer ring of
+//       preallocated chunks, consumed in chunk order. Chunk c
+//       lives in slot c % depth; its producer may fill it once
+//       chunk c - depth has been consumed, and the consumer takes
+//       chunk c once it is committed. Producers working on
+//       different chunks never share a slot, and memory stays at
+//       depth * chunkElements keys.
+// ============================================================
+template <typename Key>
+class ChunkRing {
+public:
+    ChunkRing(size_t depth, size_t chunkElements, size_t producers = 1)
+        : slots(std::max<size_t>(depth, 2), std::vector<Key>(chunkElements)),
+          counts(slots.size(), 0), ready(slots.size(), false), consumed(0),
+          openProducers(std::max<size_t>(producers, 1)) { }
+
+    size_t chunkElements() const { return slots[0].size(); }
+
+    // Producer: waits until chunk's slot is free and returns it to fill.
+    Key* acquireWrite(size_t chunk) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [&] { return chunk < consumed + slots.size(); });
+        return slots[chunk % slots.size()].data();
+    }
+
+    // Producer: publishes chunk from acquireWrite() with count keys.
+    void commitWrite(size_t chunk, size_t count) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            counts[chunk % slots.size()] = count;
+            ready[chunk % slots.size()] = true;
+        }
+        notEmpty.notify_one();
+    }
+
+    // Producer: this producer has committed all of its chunks.
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            --openProducers;
+        }
+        notEmpty.notify_one();
+    }
+
+    // Consumer: waits for the next chunk in order; false once every
+    // producer has closed and the ring is drained.
+    bool acquireRead(const Key*& chunk, size_t& count) {
+        std::unique_lock<std::mutex> lock(mutex);
+        size_t slot = consumed % slots.size();
+        notEmpty.wait(lock, [&] { return ready[slot] || openProducers == 0; });
+        if (!ready[slot]) return false;
+        chunk = slots[slot].data();
+        count = counts[slot];
+        return true;
+    }
+
+    // Consumer: hands the slot from acquireRead() back to the producers.
+    void releaseRead() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ready[consumed % slots.size()] = false;
+            ++consumed;
+        }
+        notFull.notify_all();
+    }
+
+private:
+    std::vector<std::vector<Key>> slots;  // Preallocated chunk buffers.
+    std::vector<size_t> counts;           // Keys in each filled slot.
+    std::vector<bool> ready;              // Slot holds a committed chunk.
+    size_t consumed;                      // Chunks consumed so far.
+    size_t openProducers;                 // Producers not yet closed.
+    std::mutex mutex;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+};
+
+// ============================================================
+// Class: PipelinedSortDriver
+// ------------------------------------------------------------
+// Role: End-to-end generate -> (print) -> sort pipeline for the
+//       CLI. Producer threads draw the input chunk by chunk with
+//       RandomArrayGenerator::Sampler into a ChunkRing, chunk c on
+//       producer c % producers, while the calling thread takes the
+//       chunks in order, optionally prints each one and marks it
+//       into a StreamingBigSorter. Generation, formatting and
+//       marking overlap, and only the bitmap and the ring are
+//       resident, never the whole input.
+//
+// Usage:
+//   PipelinedSortDriver<int> driver;
+//   std::vector<int> sorted = driver.run(n, 1, max, Distribution::Sparse, seed);
+// ============================================================
+template <typename Key>
+class PipelinedSortDriver {
+public:
+    static constexpr size_t kChunkElements = size_t(1) << 16;
+    static constexpr size_t kRingDepth = 8;
+
+    // ------------------------------------------------------------
+    // Constructor: PipelinedSortDriver
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - chunkElements: Keys per ring slot.
+    //   - ringDepth:     Slots in the ring; raised to two per
+    //                    producer so every producer can run ahead.
+    //   - producers:     Generator threads; 0 means one per
+    //                    hardware thread, less the consumer.
+    // ------------------------------------------------------------
+    explicit PipelinedSortDriver(size_t chunkElements = kChunkElements, size_t ringDepth = kRingDepth,
+                                 unsigned producers = 0)
+        : chunkSize(std::max<size_t>(chunkElements, 1)),
+          producerCount(producers ? producers : std::max(2u, std::thread::hardware_concurrency()) - 1),
+          depth(std::max<size_t>(ringDepth, 2 * size_t(producerCount))), producerNs(0), consumerNs(0) { }
+
+    // ------------------------------------------------------------
+    // Method: run
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - size, minValue, maxValue, distribution, seed:
+    //       The input, as for RandomArrayGenerator::generate(); the
+    //       same seed gives the same keys.
+    //   - echo: If set, each input key is printed through it in
+    //       arrival order (the "Original Array" listing).
+    //
+    // Returns:
+    //   The distinct input keys in ascending order.
+    // ------------------------------------------------------------
+    std::vector<Key> run(size_t size, Key minValue, Key maxValue,
+                         RandomArrayGenerator::Distribution distribution, uint64_t seed,
+                         IntegerWriter* echo = nullptr) {
+        RandomArrayGenerator::Sampler<Key> sampler(size, minValue, maxValue, distribution, seed);
+        StreamingBigSorter<Key> window(minValue, maxValue);
+        size_t chunks = (size + chunkSize - 1) / chunkSize;
+        unsigned producers = static_cast<unsigned>(std::clamp<size_t>(chunks, 1, producerCount));
+        ChunkRing<Key> ring(depth, chunkSize, producers);
+
+        // Producers: producer t draws chunks t, t + producers, ...
+        // The sampler is a pure function of the index, so the
+        // chunks match a single-threaded draw exactly.
+        PhaseClock clock;
+        std::vector<uint64_t> finishNs(producers, 0);
+        std::vector<std::thread> pool;
+        pool.reserve(producers);
+        for (unsigned t = 0; t < producers; ++t) {
+            pool.emplace_back([&, t] {
+                PhaseClock producerClock = clock;
+                for (size_t chunk = t; chunk < chunks; chunk += producers) {
+                    size_t first = chunk * chunkSize;
+                    size_t count = std::min(chunkSize, size - first);
+                    sampler.fill(ring.acquireWrite(chunk), first, count);
+                    ring.commitWrite(chunk, count);
+                }
+                ring.close();
+                finishNs[t] = producerClock.lap();
+            });
+        }
+
+        // Consumer: print and mark each chunk in order as it lands.
+        const Key* chunk = nullptr;
+        size_t count = 0;
+        while (ring.acquireRead(chunk, count)) {
+            if (echo) echo->writeAll(std::span<const Key>(chunk, count));
+            window.insert(std::span<const Key>(chunk, count));
+            ring.releaseRead();
+        }
+        for (std::thread& producer : pool) producer.join();
+        std::vector<Key> sorted = window.drain();
+        consumerNs = clock.lap();
+        producerNs = *std::max_element(finishNs.begin(), finishNs.end());
+        return sorted;
+    }
+
+    // Wall time until the last producer finished and of the
+    // consumer (which includes waiting for chunks) in the last run().
+    uint64_t getProducerNs() const { return producerNs; }
+    uint64_t getConsumerNs() const { return consumerNs; }
+
+    // Generator threads used by run().
+    unsigned getProducerCount() const { return producerCount; }
+
+private:
+    size_t chunkSize;        // Keys per ring slot.
+    unsigned producerCount;  // Generator threads.
+    size_t depth;            // Slots in the ring.
+    uint64_t producerNs;     // Last run's producer time.
+    uint64_t consumerNs;     // Last run's consumer time.
+};
+
+// ============================================================
+// Class: ExternalSorter
+// ------------------------------------------------------------
+// Role: Out-of-core BigSort for files of raw little-endian
+//       uint64 keys that do not fit in memory. All file access is
+//       sequential and resident memory stays within the budget.
+//       Like BigSorter's default mode, the output holds each
+//       distinct key once.
+//
+// Flow:
+//   1. Stream the input once for count, min and max. If the keys
+//      fit in memory, sort them there and stop.
+//   2. Stream it again into a 65536-bin histogram over [min, max].
+//   3. Group adjacent bins into range buckets: a bucket's keys
+//      must fit in memory, and a dense bucket (at least one key
+//      per 64 slots) must also fit its bitmap, so it gets the
+//      bitmap path. Sparse buckets only need their keys to fit.
+//   4. Stream the input a third time, appending each key to its
+//      bucket file through per-bucket write buffers (at most
+//      kMaxOpenBuckets files per pass).
+//   5. Sort each bucket in memory in key order and append it to
+//      the output, so concatenation is the final merge. A bucket
+//      that is still too large (one very hot bin) is sorted
+//      recursively with the same procedure.
+// ============================================================
+class ExternalSorter {
+public:
+    static constexpr size_t kHistogramBins = size_t(1) << 16;
+    static constexpr size_t kMaxOpenBuckets = 256;
+    static constexpr size_t kMinMemoryBytes = size_t(4) << 20;
+
+    // ------------------------------------------------------------
+    // Constructor: ExternalSorter
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - memoryBytes:   Memory budget for keys, bitmaps and I/O
+    //                    buffers (at least kMinMemoryBytes).
+    //   - tempDirectory: Directory for the bucket files; it must
+    //                    exist and have room for one copy of the
+    //                    input.
+    // ------------------------------------------------------------
+    ExternalSorter(size_t memoryBytes, std::string tempDirectory)
+        : memoryBudget(std::max(memoryBytes, kMinMemoryBytes)), tempDir(std::move(tempDirectory)),
+          keysWritten(0), bucketSerial(0) { }
+
+    // ------------------------------------------------------------
+    // Method: sortFile
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - inputPath:  File of uint64 keys.
+    //   - outputPath: File to receive the sorted distinct keys.
+    //
+    // Returns:
+    //   The number of keys written to outputPath.
+    // ------------------------------------------------------------
+    unsigned long long sortFile(const std::string& inputPath, const std::string& outputPath) {
+        FILE* out = openFile(outputPath, "wb");
+        keysWritten = 0;
+        sortRange(inputPath, out, scanBounds(inputPath));
+        closeFile(out, outputPath);
+        return keysWritten;
+    }
+
+    // ------------------------------------------------------------
+    // Method: parseByteSize
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - text: A byte count with an optional K, M or G suffix
+    //           (powers of 1024), e.g. "512M".
+    //
+    // Returns:
+    //   The size in bytes, or 0 if text is not a valid size.
+    // ------------------------------------------------------------
+    static size_t parseByteSize(const std::string& text) {
+        char* end = nullptr;
+        unsigned long long value = std::strtoull(text.c_str(), &end, 10);
+        if (end == text.c_str()) return 0;
+        switch (*end) {
+            case 'k': case 'K': value <<= 10; ++end; break;
+            case 'm': case 'M': value <<= 20; ++end; break;
+            case 'g': case 'G': value <<= 30; ++end; break;
+            default: break;
+        }
+        return *end == '\0' ? static_cast<size_t>(value) : 0;
+    }
+
+private:
+    // Count and bounds of the keys in one file.
+    struct Bounds {
+        unsigned long long count;
+        uint64_t minKey;
+        uint64_t maxKey;
+    };
+
+    // A run of histogram bins sorted as one unit.
+    struct Bucket {
+        uint64_t firstKey;
+        uint64_t lastKey;
+        unsigned long long count;
+    };
+
+    static FILE* openFile(const std::string& path, const char* mode) {
+        FILE* file = std::fopen(path.c_str(), mode);
+        if (!file) {
+            std::cerr << "Error: cannot open " << path << ".\n";
+            exit(1);
+        }
+        return file;
+    }
+
+    static void closeFile(FILE* file, const std::string& path) {
+        if (std::fclose(file) != 0) {
+            std::cerr << "Error: cannot write " << path << ".\n";
+            exit(1);
+        }
+    }
+
+    static void writeKeys(FILE* file, const uint64_t* keys, size_t n) {
+        if (n && std::fwrite(keys, sizeof(uint64_t), n, file) != n) {
+            std::cerr << "Error: short write while sorting out of core.\n";
+            exit(1);
+        }
+    }
+
+    // Streams a file through a budget-sized buffer, calling
+    // visit(keys, n) for each chunk in order.
+    template <typename Visit>
+    void forEachChunk(const std::string& path, size_t bufferBytes, Visit visit) {
+        FILE* in = openFile(path, "rb");
+        std::vector<uint64_t> buffer(std::max<size_t>(bufferBytes / sizeof(uint64_t), 1));
+        size_t got;
+        while ((got = std::fread(buffer.data(), sizeof(uint64_t), buffer.size(), in)) > 0) {
+            visit(buffer.data(), got);
+        }
+        std::fclose(in);
+    }
+
+    // Step 1: count, min and max of a file.
+    Bounds scanBounds(const std::string& path) {
+        Bounds bounds = { 0, ~uint64_t(0), 0 };
+        forEachChunk(path, memoryBudget / 4, [&](const uint64_t* keys, size_t n) {
+            bounds.count += n;
+            for (size_t i = 0; i < n; ++i) {
+                bounds.minKey = std::min(bounds.minKey, keys[i]);
+                bounds.maxKey = std::max(bounds.maxKey, keys[i]);
+            }
+        });
+        return bounds;
+    }
+
+    // Keys that may be held in memory at once: sortInMemory() keeps
+    // the input, the output and bigSort()'s scratch (radix or
+    // blocked marking), up to 8 bytes per key each.
+    static constexpr size_t kResidentBytesPerKey = 3 * sizeof(uint64_t);
+    unsigned long long maxResidentKeys() const { return memoryBudget / kResidentBytesPerKey; }
+
+    // ------------------------------------------------------------
+    // Method: sortRange
+    // ------------------------------------------------------------
+    // Role:
+    //   Sorts every key of path (with the given bounds) onto the
+    //   end of out, in memory when it fits and through range
+    //   buckets otherwise.
+    // ------------------------------------------------------------
+    void sortRange(const std::string& path, FILE* out, const Bounds& bounds) {
+        if (bounds.count == 0) return;
+        if (bounds.minKey == bounds.maxKey) {
+            writeKeys(out, &bounds.minKey, 1);
+            ++keysWritten;
+            return;
+        }
+        if (bounds.count <= maxResidentKeys()) {
+            sortInMemory(path, static_cast<size_t>(bounds.count), out);
+            return;
+        }
+
+        // Step 2: Histogram the keys over [min, max].
+        uint64_t maxOffset = bounds.maxKey - bounds.minKey;
+        uint64_t binWidth = maxOffset / kHistogramBins + 1;
+        std::vector<unsigned long long> bins(static_cast<size_t>(maxOffset / binWidth) + 1, 0);
+        forEachChunk(path, memoryBudget / 4, [&](const uint64_t* keys, size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+                ++bins[static_cast<size_t>((keys[i] - bounds.minKey) / binWidth)];
+            }
+        });
+
+        // Step 3: Group bins into buckets.
+        std::vector<Bucket> buckets = planBuckets(bins, bounds, binWidth);
+        bins = std::vector<unsigned long long>();
+
+        // Steps 4 & 5: Partition a group of buckets per pass, then sort them.
+        for (size_t first = 0; first < buckets.size(); first += kMaxOpenBuckets) {
+            size_t last = std::min(buckets.size(), first + kMaxOpenBuckets);
+            std::vector<std::string> paths = partition(path, buckets, first, last);
+            for (size_t b = first; b < last; ++b) {
+                const std::string& bucketPath = paths[b - first];
+                if (buckets[b].count <= maxResidentKeys()) {
+                    sortInMemory(bucketPath, static_cast<size_t>(buckets[b].count), out);
+                } else {
+                    sortRange(bucketPath, out, scanBounds(bucketPath));
+                }
+                std::remove(bucketPath.c_str());
+            }
+        }
+    }
+
+    // ------------------------------------------------------------
+    // Method: planBuckets
+    // ------------------------------------------------------------
+    // Role:
+    //   Greedily merges adjacent non-empty bins while the merged
+    //   bucket still fits: its keys must fit in memory, and while
+    //   it is dense (one key per 64 slots or more) its bitmap must
+    //   fit alongside them.
+    // ------------------------------------------------------------
+    std::vector<Bucket> planBuckets(const std::vector<unsigned long long>& bins, const Bounds& bounds,
+                                    uint64_t binWidth) const {
+        auto fits = [&](unsigned long long count, uint64_t span) {
+            double keyBytes = static_cast<double>(count) * kResidentBytesPerKey;
+            bool dense = static_cast<double>(count) * 64 >= static_cast<double>(span);
+            double bitmapBytes = dense ? static_cast<double>(span) / 8 : 0;
+            return keyBytes + bitmapBytes <= static_cast<double>(memoryBudget);
+        };
+        std::vector<Bucket> buckets;
+        for (size_t bin = 0; bin < bins.size(); ++bin) {
+            if (!bins[bin]) continue;
+            uint64_t binFirst = bounds.minKey + bin * binWidth;
+            uint64_t binLast = std::min<uint64_t>(bounds.maxKey, binFirst + (binWidth - 1));
+            if (!buckets.empty()) {
+                Bucket& open = buckets.back();
+                if (fits(open.count + bins[bin], binLast - open.firstKey + 1)) {
+                    open.lastKey = binLast;
+                    open.count += bins[bin];
+                    continue;
+                }
+            }
+            buckets.push_back({ binFirst, binLast, bins[bin] });
+        }
+        return buckets;
+    }
+
+    // ------------------------------------------------------------
+    // Method: partition
+    // ------------------------------------------------------------
+    // Role:
+    //   Streams path once and appends every key that falls in
+    //   buckets [first, last) to that bucket's file, through write
+    //   buffers that share half of the memory budget.
+    //
+    // Returns:
+    //   The bucket file paths, in bucket order.
+    // ------------------------------------------------------------
+    std::vector<std::string> partition(const std::string& path, const std::vector<Bucket>& buckets,
+                                       size_t first, size_t last) {
+        size_t groupSize = last - first;
+        size_t bufferKeys = std::max<size_t>(memoryBudget / 2 / sizeof(uint64_t) / groupSize, 512);
+        std::vector<std::string> paths;
+        std::vector<FILE*> files;
+        std::vector<std::vector<uint64_t>> buffers(groupSize);
+        for (size_t b = 0; b < groupSize; ++b) {
+            paths.push_back(tempDir + "/bigsort-bucket-" + std::to_string(bucketSerial++) + ".bin");
+            files.push_back(openFile(paths.back(), "wb"));
+            buffers[b].reserve(bufferKeys);
+        }
+        uint64_t groupFirst = buckets[first].firstKey;
+        uint64_t groupLast = buckets[last - 1].lastKey;
+        forEachChunk(path, memoryBudget / 4, [&](const uint64_t* keys, size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+                uint64_t key = keys[i];
+                if (key < groupFirst || key > groupLast) continue;
+                // Buckets are sorted by range: binary search the owner.
+                size_t b = static_cast<size_t>(
+                    std::upper_bound(buckets.begin() + first, buckets.begin() + last, key,
+                                     [](uint64_t k, const Bucket& bucket) { return k < bucket.firstKey; }) -
+                    (buckets.begin() + first)) - 1;
+                std::vector<uint64_t>& buffer = buffers[b];
+                buffer.push_back(key);
+                if (buffer.size() == bufferKeys) {
+                    writeKeys(files[b], buffer.data(), buffer.size());
+                    buffer.clear();
+                }
+            }
+        });
+        for (size_t b = 0; b < groupSize; ++b) {
+            writeKeys(files[b], buffers[b].data(), buffers[b].size());
+            closeFile(files[b], paths[b]);
+        }
+        return paths;
+    }
+
+    // ------------------------------------------------------------
+    // Method: sortInMemory
+    // ------------------------------------------------------------
+    // Role:
+    //   Loads count keys from path and sorts them with bigSort().
+    //   The bitmap path is allowed whatever memory the keys and
+    //   scratch leave free, passed to bigSort() as its budget, so
+    //   dense buckets get the O(n + k) sort and sparse ones fall
+    //   back to radix or comparison sorting.
+    // ------------------------------------------------------------
+    void sortInMemory(const std::string& path, size_t count, FILE* out) {
+        std::vector<uint64_t> keys(count);
+        FILE* in = openFile(path, "rb");
+        if (std::fread(keys.data(), sizeof(uint64_t), count, in) != count) {
+            std::cerr << "Error: short read from " << path << ".\n";
+            exit(1);
+        }
+        std::fclose(in);
+
+        std::vector<uint64_t> sorted(count);
+        size_t residentBytes = count * kResidentBytesPerKey;
+        size_t bitmapBudget = std::max<size_t>(1, memoryBudget - std::min(memoryBudget, residentBytes));
+        SortWorkspace workspace;
+        size_t distinct = bigSort(std::span<const uint64_t>(keys), std::span<uint64_t>(sorted), workspace,
+                                  bitmapBudget);
+
+        writeKeys(out, sorted.data(), distinct);
+        keysWritten += distinct;
+    }
+
+    size_t memoryBudget;              // Bytes the sort may keep resident.
+    std::string tempDir;              // Directory for bucket files.
+    unsigned long long keysWritten;   // Keys written to the output so far.
+    unsigned long long bucketSerial;  // Counter for unique bucket file names.
+};
+
+// ============================================================
+// Function: sortMappedFile
+// ------------------------------------------------------------
+// Parameters:
+//   - inputPath:  Raw little-endian file of Key values.
+//   - outputPath: File to receive the sorted distinct keys in the
+//                 same format.
+//
+// Returns:
+//   The number of keys written.
+//
+// Role: Maps both files and runs bigSort() from one mapping into
+//       the other. The output is created at the input's size and
+//       truncated to the distinct count afterwards, so it must not
+//       be the input file (checked by device and inode).
+// ============================================================
+template <typename Key>
+size_t sortMappedFile(const std::string& inputPath, const std::string& outputPath) {
+    MappedFile input = MappedFile::openRead(inputPath);
+    std::span<const Key> keys = input.as<const Key>();
+    if (input.isSameFile(outputPath)) {
+        // Truncating the output would pull the pages out from under the input mapping.
+        std::cerr << "Error: output " << outputPath << " is the input file; write to a different file.\n";
+        exit(1);
+    }
+    MappedFile output = MappedFile::create(outputPath, input.size());
+    SortWorkspace workspace;
+    size_t distinct = keys.empty() ? 0 : bigSort(keys, output.as<Key>(), workspace);
+    output.truncate(distinct * sizeof(Key));
+    return distinct;
+}
+
+// ============================================================
+// Class: IntegerParser
+// ------------------------------------------------------------
+// Role: Reader half of IntegerWriter for decimal text. Parses
+//       whitespace-separated integers with std::from_chars straight
+//       out of a (memory-mapped) buffer, with no stream, locale or
+//       per-value allocation, and cuts the buffer at newlines so
+//       threads can parse disjoint pieces.
+// ============================================================
+class IntegerParser {
+public:
+    // ------------------------------------------------------------
+    // Method: splitLines
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - text:   The whole buffer.
+    //   - pieces: Number of pieces wanted.
+    //
+    // Returns:
+    //   pieces + 1 ascending offsets; piece i is [cuts[i], cuts[i+1]).
+    //   Every inner cut lies just past a '\n', so no token is split.
+    //   Pieces may be empty when lines are long.
+    // ------------------------------------------------------------
+    static std::vector<size_t> splitLines(std::string_view text, unsigned pieces) {
+        pieces = std::max(1u, pieces);
+        std::vector<size_t> cuts(pieces + 1, text.size());
+        cuts[0] = 0;
+        for (unsigned i = 1; i < pieces; ++i) {
+            size_t target = std::max(cuts[i - 1], text.size() / pieces * i);
+            size_t newline = text.find('\n', target);
+            cuts[i] = newline == std::string_view::npos ? text.size() : newline + 1;
+        }
+        return cuts;
+    }
+
+    // ------------------------------------------------------------
+    // Method: parse
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - text:  Whitespace-separated decimal integers.
+    //   - visit: Called with each value in order.
+    //
+    // Returns:
+    //   The offset of the first token that is not a Key (bad digits
+    //   or out of range), or std::string_view::npos if all parsed.
+    // ------------------------------------------------------------
+    template <typename Key, typename Visit>
+    static size_t parse(std::string_view text, Visit visit) {
+        const char* p = text.data();
+        const char* end = p + text.size();
+        while (true) {
+            while (p < end && isSpace(*p)) ++p;
+            if (p == end) return std::string_view::npos;
+            Key value;
+            auto [next, error] = std::from_chars(p, end, value);
+            if (error != std::errc() || (next < end && !isSpace(*next))) {
+                return static_cast<size_t>(p - text.data());
+            }
+            visit(value);
+            p = next;
+        }
+    }
+
+private:
+    static bool isSpace(char c) { return c == ' ' || c == '\n' || c == '\r' || c == '\t'; }
+};
+
+// ============================================================
+// Function: sortTextFile
+// ------------------------------------------------------------
+// Parameters:
+//   - inputPath:  Whitespace- (usually newline-) separated decimal
+//                 Key values.
+//   - outputPath: File to receive the distinct keys, ascending,
+//                 one per line.
+//   - threads:    Parser / formatter threads; 0 = all.
+//
+// Returns:
+//   The number of keys written.
+//
+// Role: Text counterpart of sortMappedFile(). The input is mapped
+//       and cut into per-thread pieces at newlines.
+//
+// Flow:
+//   1. Each thread parses its piece for min, max and count.
+//   2. If SortPlanner picks the bitmap, each thread parses its
+//      piece again and marks small batches of keys straight into
+//      one shared bitmap (markAllAtomic when threaded), so the
+//      keys are never collected. Otherwise the keys are parsed
+//      into one array and sorted with bigSort().
+//   3. The output is formatted in rounds: each thread renders one
+//      chunk of bitmap words into its own buffer with to_chars,
+//      then the buffers are written in order.
+// ============================================================
+template <typename Key>
+size_t sortTextFile(const std::string& inputPath, const std::string& outputPath, unsigned threads = 0) {
+    using UKey = std::make_unsigned_t<Key>;
+    constexpr size_t kParseBatch = 4096;
+    constexpr size_t kFormatWords = size_t(1) << 14;
+    constexpr size_t kMaxValueChars = IntegerWriter::kMaxValueChars;
+    if (!threads) threads = std::max(1u, std::thread::hardware_concurrency());
+
+    MappedFile input = MappedFile::openRead(inputPath);
+    std::span<const char> bytes = input.as<const char>();
+    std::string_view text(bytes.data(), bytes.size());
+    std::vector<size_t> cuts = IntegerParser::splitLines(text, threads);
+    auto piece = [&](size_t i) { return text.substr(cuts[i], cuts[i + 1] - cuts[i]); };
+    auto checkParsed = [&](const std::vector<size_t>& bad) {
+        for (size_t i = 0; i < bad.size(); ++i) {
+            if (bad[i] != std::string_view::npos) {
+                std::cerr << "Error: " << inputPath << " has a malformed integer at byte "
+                          << cuts[i] + bad[i] << ".\n";
+                exit(1);
+            }
+        }
+    };
+
+    // Step 1: Bounds and count, one piece per thread.
+    std::vector<Key> mins(threads, std::numeric_limits<Key>::max());
+    std::vector<Key> maxs(threads, std::numeric_limits<Key>::min());
+    std::vector<size_t> counts(threads, 0), bad(threads);
+    parallelFor(threads, threads, [&](size_t begin, size_t end, unsigned) {
+        for (size_t i = begin; i < end; ++i) {
+            bad[i] = IntegerParser::parse<Key>(piece(i), [&](Key key) {
+                mins[i] = std::min(mins[i], key);
+                maxs[i] = std::max(maxs[i], key);
+                ++counts[i];
+            });
+        }
+    });
+    checkParsed(bad);
+    size_t n = 0;
+    Key minKey = std::numeric_limits<Key>::max();
+    Key maxKey = std::numeric_limits<Key>::min();
+    for (unsigned i = 0; i < threads; ++i) {
+        n += counts[i];
+        minKey = std::min(minKey, mins[i]);
+        maxKey = std::max(maxKey, maxs[i]);
+    }
+
+    FILE* out = std::fopen(outputPath.c_str(), "w");
+    if (!out) {
+        std::cerr << "Error: cannot create " << outputPath << ".\n";
+        exit(1);
+    }
+    size_t written = 0;
+    bool complete = true;  // Every write so far went through in full.
+    unsigned long long maxOffset = static_cast<UKey>(static_cast<UKey>(maxKey) - static_cast<UKey>(minKey));
+    unsigned long long span = maxOffset == ~0ULL ? maxOffset : maxOffset + 1;
+    SortPlanner::Input shape = { n, span, PresenceBitmap::scanSlots(n, span, false), 1, threads, true };
+
+    if (n && SortPlanner::plan(shape).strategy == SortPlanner::Strategy::Bitmap) {
+        // Step 2: Parse again, marking batches straight into the bitmap.
+        PresenceBitmap exists;
+        exists.reset(static_cast<size_t>(span));
+        parallelFor(threads, threads, [&](size_t begin, size_t end, unsigned) {
+            Key batch[kParseBatch];
+            size_t used = 0;
+            auto flush = [&] {
+                if (threads > 1) {
+                    exists.markAllAtomic(batch, used, minKey);
+                } else {
+                    exists.markAll(batch, used, minKey);
+                }
+                used = 0;
+            };
+            for (size_t i = begin; i < end; ++i) {
+                IntegerParser::parse<Key>(piece(i), [&](Key key) {
+                    batch[used++] = key;
+                    if (used == kParseBatch) flush();
+                });
+            }
+            flush();
+        });
+
+        // Step 3: Format rounds of chunks in parallel, write in order.
+        std::vector<std::vector<char>> buffers(threads);
+        size_t words = exists.wordCount();
+        const uint64_t* bits = exists.data();
+        for (size_t round = 0; round < words; round += kFormatWords * threads) {
+            parallelFor(threads, threads, [&](size_t begin, size_t end, unsigned) {
+                for (size_t t = begin; t < end; ++t) {
+                    size_t wordBegin = std::min(words, round + t * kFormatWords);
+                    size_t wordEnd = std::min(words, wordBegin + kFormatWords);
+                    std::vector<char>& buffer = buffers[t];
+                    buffer.resize(exists.countWords(wordBegin, wordEnd) * kMaxValueChars);
+                    char* p = buffer.data();
+                    for (size_t wi = wordBegin; wi < wordEnd; ++wi) {
+                        for (uint64_t w = bits[wi]; w; w &= w - 1) {
+                            UKey slot = static_cast<UKey>(wi * 64 + static_cast<unsigned>(__builtin_ctzll(w)));
+                            Key key = static_cast<Key>(static_cast<UKey>(static_cast<UKey>(minKey) + slot));
+                            p = std::to_chars(p, buffer.data() + buffer.size(), key).ptr;
+                            *p++ = '\n';
+                        }
+                    }
+                    buffer.resize(static_cast<size_t>(p - buffer.data()));
+                }
+            });
+            for (const std::vector<char>& buffer : buffers) {
+                if (!buffer.empty() && std::fwrite(buffer.data(), 1, buffer.size(), out) != buffer.size()) {
+                    complete = false;
+                }
+            }
+            if (!complete) break;
+        }
+        written = exists.count();
+    } else if (n) {
+        // Step 2 (no bitmap): parse into one array at per-piece offsets.
+        std::vector<Key> keys(n);
+        std::vector<size_t> starts(threads, 0);
+        for (unsigned i = 1; i < threads; ++i) starts[i] = starts[i - 1] + counts[i - 1];
+        parallelFor(threads, threads, [&](size_t begin, size_t end, unsigned) {
+            for (size_t i = begin; i < end; ++i) {
+                Key* slot = keys.data() + starts[i];
+                IntegerParser::parse<Key>(piece(i), [&](Key key) { *slot++ = key; });
+            }
+        });
+        SortWorkspace workspace;
+        std::vector<Key> sorted(n);
+        written = bigSort(std::span<const Key>(keys), std::span<Key>(sorted), workspace);
+        IntegerWriter writer(out);
+        writer.writeAll(std::span<const Key>(sorted.data(), written), '\n');
+        complete = writer.flush();
+    }
+    if (std::fclose(out) != 0 || !complete) {
+        std::cerr << "Error: failed writing " << outputPath << ".\n";
+        exit(1);
+    }
+    return written;
+}
+
+// ============================================================
+// Class: TcpTransport
+// ------------------------------------------------------------
+// Role: Minimal all-to-all transport for DistributedSorter over a
+//       full mesh of TCP connections, for clusters without MPI.
+//       Every node gets the same host file (one "host:port" line
+//       per rank) and its own rank; rank r listens on its line's
+//       port, connects to every lower rank and accepts every
+//       higher one. Failures are fatal (cerr + exit), like the
+//       rest of the file modes.
+// ============================================================
+class TcpTransport {
+public:
+    static constexpr int kConnectTimeoutSeconds = 60;
+
+    TcpTransport(const std::string& hostFile, int selfRank) : self(selfRank) {
+        std::vector<std::pair<std::string, std::string>> hosts = readHosts(hostFile);
+        if (self < 0 || self >= static_cast<int>(hosts.size())) {
+            std::cerr << "Error: rank " << self << " is not in " << hostFile << ".\n";
+            exit(1);
+        }
+        peers.assign(hosts.size(), -1);
+
+        // Lower ranks are already listening (or will be soon): dial them.
+        for (int peer = 0; peer < self; ++peer) {
+            peers[peer] = dial(hosts[peer].first, hosts[peer].second);
+            uint32_t rank = static_cast<uint32_t>(self);
+            sendAll(peers[peer], &rank, sizeof(rank));
+        }
+
+        // Higher ranks dial us and announce themselves.
+        if (self + 1 < size()) {
+            int listener = listenOn(hosts[self].second);
+            for (int accepted = self + 1; accepted < size(); ++accepted) {
+                int socket = ::accept(listener, nullptr, nullptr);
+                if (socket < 0) fail("accept failed");
+                uint32_t rank = 0;
+                recvAll(socket, &rank, sizeof(rank));
+                if (rank <= static_cast<uint32_t>(self) || rank >= peers.size() || peers[rank] != -1) {
+                    fail("unexpected peer rank " + std::to_string(rank));
+                }
+                peers[rank] = socket;
+                tune(socket);
+            }
+            ::close(listener);
+        }
+    }
+
+    TcpTransport(const TcpTransport&) = delete;
+    TcpTransport& operator=(const TcpTransport&) = delete;
+
+    ~TcpTransport() {
+        for (int socket : peers) {
+            if (socket >= 0) ::close(socket);
+        }
+    }
+
+    int rank() const { return self; }
+    int size() const { return static_cast<int>(peers.size()); }
+
+    // ------------------------------------------------------------
+    // Method: exchange
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - outgoing: One buffer per rank; outgoing[r] goes to rank r
+    //               (outgoing[rank()] stays local).
+    //
+    // Returns:
+    //   One buffer per rank; result[r] is what rank r sent here.
+    //
+    // Flow:
+    //   Pairwise schedule on a sender thread and the calling thread:
+    //   in step s this node sends to rank + s and receives from
+    //   rank - s. Each buffer is a 64-bit length and the bytes.
+    //   Every node walks the steps in the same order, so blocking
+    //   sends and receives cannot deadlock.
+    // ------------------------------------------------------------
+    std::vector<std::vector<char>> exchange(const std::vector<std::vector<char>>& outgoing) {
+        int nodes = size();
+        std::vector<std::vector<char>> incoming(nodes);
+        incoming[self] = outgoing[self];
+        std::thread sender([&] {
+            for (int step = 1; step < nodes; ++step) {
+                int socket = peers[(self + step) % nodes];
+                const std::vector<char>& buffer = outgoing[(self + step) % nodes];
+                uint64_t bytes = buffer.size();
+                sendAll(socket, &bytes, sizeof(bytes));
+                sendAll(socket, buffer.data(), buffer.size());
+            }
+        });
+        for (int step = 1; step < nodes; ++step) {
+            int from = (self - step + nodes) % nodes;
+            uint64_t bytes = 0;
+            recvAll(peers[from], &bytes, sizeof(bytes));
+            incoming[from].resize(static_cast<size_t>(bytes));
+            recvAll(peers[from], incoming[from].data(), incoming[from].size());
+        }
+        sender.join();
+        return incoming;
+    }
+
+private:
+    [[noreturn]] static void fail(const std::string& what) {
+        std::cerr << "Error: TCP transport: " << what << ".\n";
+        exit(1);
+    }
+
+    static std::vector<std::pair<std::string, std::string>> readHosts(const std::string& path) {
+        FILE* file = std::fopen(path.c_str(), "r");
+        if (!file) fail("cannot open host file " + path);
+        std::vector<std::pair<std::string, std::string>> hosts;
+        char line[512];
+        while (std::fgets(line, sizeof(line), file)) {
+            std::string entry(line);
+            entry.erase(entry.find_last_not_of(" \t\r\n") + 1);
+            if (entry.empty() || entry[0] == '#') continue;
+            size_t colon = entry.rfind(':');
+            if (colon == std::string::npos || colon == 0 || colon + 1 == entry.size()) {
+                std::fclose(file);
+                fail("host file line \"" + entry + "\" is not host:port");
+            }
+            hosts.emplace_back(entry.substr(0, colon), entry.substr(colon + 1));
+        }
+        std::fclose(file);
+        if (hosts.empty()) fail("host file " + path + " lists no hosts");
+        return hosts;
+    }
+
+    static void tune(int socket) {
+        int on = 1;
+        ::setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+
+    static int listenOn(const std::string& port) {
+        addrinfo hints{};
+        hints.ai_family = AF_INET6;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        addrinfo* found = nullptr;
+        if (::getaddrinfo(nullptr, port.c_str(), &hints, &found) != 0) {
+            hints.ai_family = AF_INET;
+            if (::getaddrinfo(nullptr, port.c_str(), &hints, &found) != 0) fail("bad port " + port);
+        }
+        int listener = ::socket(found->ai_family, found->ai_socktype, found->ai_protocol);
+        int on = 1, off = 0;
+        ::setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (found->ai_family == AF_INET6) ::setsockopt(listener, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+        bool bound = listener >= 0 && ::bind(listener, found->ai_addr, found->ai_addrlen) == 0 &&
+                     ::listen(listener, SOMAXCONN) == 0;
+        ::freeaddrinfo(found);
+        if (!bound) fail("cannot listen on port " + port);
+        return listener;
+    }
+
+    // Connects to host:port, retrying while the peer starts up.
+    static int dial(const std::string& host, const std::string& port) {
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(kConnectTimeoutSeconds);
+        while (true) {
+            addrinfo* found = nullptr;
+            if (::getaddrinfo(host.c_str(), port.c_str(), &hints, &found) == 0) {
+                for (addrinfo* a = found; a; a = a->ai_next) {
+                    int socket = ::socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+                    if (socket < 0) continue;
+                    if (::connect(socket, a->ai_addr, a->ai_addrlen) == 0) {
+                        ::freeaddrinfo(found);
+                        tune(socket);
+                        return socket;
+                    }
+                    ::close(socket);
+                }
+                ::freeaddrinfo(found);
+            }
+            if (std::chrono::steady_clock::now() > deadline) fail("cannot reach " + host + ":" + port);
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    }
+
+    static void sendAll(int socket, const void* data, size_t bytes) {
+        const char* p = static_cast<const char*>(data);
+        while (bytes) {
+            ssize_t sent = ::send(socket, p, bytes, MSG_NOSIGNAL);
+            if (sent < 0 && errno == EINTR) continue;
+            if (sent <= 0) fail("send failed");
+            p += sent;
+            bytes -= static_cast<size_t>(sent);
+        }
+    }
+
+    static void recvAll(int socket, void* data, size_t bytes) {
+        char* p = static_cast<char*>(data);
+        while (bytes) {
+            ssize_t got = ::recv(socket, p, bytes, 0);
+            if (got < 0 && errno == EINTR) continue;
+            if (got <= 0) fail("peer closed the connection");
+            p += got;
+            bytes -= static_cast<size_t>(got);
+        }
+    }
+
+    int self;                // This node's rank.
+    std::vector<int> peers;  // Socket per rank; -1 for self.
+};
+
+#ifdef BIGSORT_WITH_MPI
+// ============================================================
+// Class: MpiTransport
+// ------------------------------------------------------------
+// Role: DistributedSorter transport over MPI_COMM_WORLD, for
+//       builds with -DBIGSORT_WITH_MPI (compile with mpicxx). The
+//       caller owns MPI_Init / MPI_Finalize. Buffers of any size
+//       are moved in rounds that fit MPI's int counts.
+// ============================================================
+class MpiTransport {
+public:
+    MpiTransport() {
+        MPI_Comm_rank(MPI_COMM_WORLD, &self);
+        MPI_Comm_size(MPI_COMM_WORLD, &nodes);
+    }
+
+    int rank() const { return self; }
+    int size() const { return nodes; }
+
+    // Same contract as TcpTransport::exchange(): one all-to-all of
+    // 64-bit byte counts, then MPI_Alltoallv rounds of at most
+    // INT_MAX / size() bytes per peer, so MPI's int counts and
+    // displacements never overflow however large the buffers are.
+    std::vector<std::vector<char>> exchange(const std::vector<std::vector<char>>& outgoing) {
+        // Step 1: Byte totals, and the round count every rank agrees on.
+        std::vector<uint64_t> sendTotals(nodes), recvTotals(nodes);
+        for (int peer = 0; peer < nodes; ++peer) sendTotals[peer] = outgoing[peer].size();
+        MPI_Alltoall(sendTotals.data(), 1, MPI_UINT64_T, recvTotals.data(), 1, MPI_UINT64_T, MPI_COMM_WORLD);
+        uint64_t largest = 0;
+        for (int peer = 0; peer < nodes; ++peer) largest = std::max({ largest, sendTotals[peer], recvTotals[peer] });
+        MPI_Allreduce(MPI_IN_PLACE, &largest, 1, MPI_UINT64_T, MPI_MAX, MPI_COMM_WORLD);
+        std::vector<std::vector<char>> incoming(nodes);
+        for (int peer = 0; peer < nodes; ++peer) incoming[peer].resize(static_cast<size_t>(recvTotals[peer]));
+
+        // Step 2: Rounds; each moves the next slice of every buffer.
+        uint64_t slice = static_cast<uint64_t>(std::numeric_limits<int>::max()) / nodes;
+        std::vector<int> sendCounts(nodes), recvCounts(nodes), sendOffsets(nodes), recvOffsets(nodes);
+        std::vector<char> sendBytes, recvBytes;
+        for (uint64_t done = 0; done < largest; done += slice) {
+            auto part = [&](uint64_t total) {
+                return static_cast<int>(total > done ? std::min(slice, total - done) : 0);
+            };
+            sendBytes.clear();
+            int received = 0;
+            for (int peer = 0; peer < nodes; ++peer) {
+                sendCounts[peer] = part(sendTotals[peer]);
+                sendOffsets[peer] = static_cast<int>(sendBytes.size());
+                const char* from = outgoing[peer].data() + (sendCounts[peer] ? done : 0);
+                sendBytes.insert(sendBytes.end(), from, from + sendCounts[peer]);
+                recvCounts[peer] = part(recvTotals[peer]);
+                recvOffsets[peer] = received;
+                received += recvCounts[peer];
+            }
+            recvBytes.resize(static_cast<size_t>(received));
+            MPI_Alltoallv(sendBytes.data(), sendCounts.data(), sendOffsets.data(), MPI_BYTE,
+                          recvBytes.data(), recvCounts.data(), recvOffsets.data(), MPI_BYTE, MPI_COMM_WORLD);
+            for (int peer = 0; peer < nodes; ++peer) {
+                if (recvCounts[peer]) {
+                    std::memcpy(incoming[peer].data() + done, recvBytes.data() + recvOffsets[peer],
+                                static_cast<size_t>(recvCounts[peer]));
+                }
+            }
+        }
+        return incoming;
+    }
+
+private:
+    int self;   // MPI rank.
+    int nodes;  // MPI world size.
+};
+#endif // BIGSORT_WITH_MPI
+
+// ============================================================
+// Class: DistributedSorter
+// ------------------------------------------------------------
+// Role: Multi-node sample sort with a local bitmap sort per node.
+//       Each node holds an arbitrary share of the keys; afterwards
+//       each node holds the distinct keys of one contiguous value
+//       range, in rank order, so the nodes' outputs concatenated
+//       are globally sorted with no merge. No node ever needs a
+//       bitmap for more than its own range, so the total span can
+//       exceed one node's memory.
+//
+//       Transport supplies rank(), size() and exchange() (one
+//       all-to-all of byte buffers): TcpTransport, or MpiTransport
+//       with BIGSORT_WITH_MPI.
+//
+// Usage:
+//   TcpTransport net("hosts.txt", rank);
+//   DistributedSorter<uint64_t, TcpTransport> sorter(net);
+//   std::vector<uint64_t> slice = sorter.sort(localKeys);
+// ============================================================
+template <typename Key, typename Transport>
+class DistributedSorter {
+public:
+    static constexpr size_t kSamplesPerNode = 1024;
+
+    explicit DistributedSorter(Transport& network) : net(network) { }
+
+    // ------------------------------------------------------------
+    // Method: sort
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - localKeys: This node's share of the input.
+    //
+    // Returns:
+    //   This node's slice of the distinct keys, ascending. Every
+    //   key of rank r's slice is below every key of rank r + 1's.
+    //
+    // Flow:
+    //   1. Draw kSamplesPerNode keys at random and all-gather them.
+    //   2. Every node sorts the same sample and takes the same
+    //      size() - 1 splitters at its quantiles.
+    //   3. Bucket the local keys by splitter and exchange the
+    //      buckets, so node r receives every key in its range.
+    //   4. Sort the received keys locally with bigSort() (bitmap,
+    //      radix or comparison, as SortPlanner decides).
+    // ------------------------------------------------------------
+    std::vector<Key> sort(std::span<const Key> localKeys) {
+        int nodes = net.size();
+
+        // Step 1: Local random sample, sent to everyone.
+        std::vector<Key> sample;
+        if (!localKeys.empty()) {
+            std::mt19937_64 rng(0x9e3779b97f4a7c15ULL ^ static_cast<uint64_t>(net.rank()));
+            std::uniform_int_distribution<size_t> pick(0, localKeys.size() - 1);
+            size_t draws = std::min(kSamplesPerNode, localKeys.size());
+            for (size_t i = 0; i < draws; ++i) sample.push_back(localKeys[pick(rng)]);
+        }
+        std::vector<std::vector<char>> everyone(nodes, toBytes(std::span<const Key>(sample)));
+        std::vector<std::vector<char>> samples = net.exchange(everyone);
+
+        // Step 2: Identical splitters on every node.
+        std::vector<Key> pooled;
+        for (const std::vector<char>& bytes : samples) {
+            std::vector<Key> keys = fromBytes(bytes);
+            pooled.insert(pooled.end(), keys.begin(), keys.end());
+        }
+        std::sort(pooled.begin(), pooled.end());
+        std::vector<Key> splitters;
+        for (int r = 1; r < nodes && !pooled.empty(); ++r) {
+            splitters.push_back(pooled[pooled.size() * static_cast<size_t>(r) / static_cast<size_t>(nodes)]);
+        }
+
+        // Step 3: Node r owns keys in [splitter r-1, splitter r).
+        std::vector<std::vector<char>> buckets(nodes);
+        if (splitters.empty()) {
+            buckets[0] = toBytes(localKeys);
+        } else {
+            std::vector<size_t> counts(nodes, 0);
+            std::vector<int> owner(localKeys.size());
+            for (size_t i = 0; i < localKeys.size(); ++i) {
+                owner[i] = static_cast<int>(std::upper_bound(splitters.begin(), splitters.end(), localKeys[i]) -
+                                            splitters.begin());
+                ++counts[owner[i]];
+            }
+            std::vector<Key*> cursors(nodes);
+            for (int r = 0; r < nodes; ++r) {
+                buckets[r].resize(counts[r] * sizeof(Key));
+                cursors[r] = reinterpret_cast<Key*>(buckets[r].data());
+            }
+            for (size_t i = 0; i < localKeys.size(); ++i) {
+                std::memcpy(cursors[owner[i]]++, &localKeys[i], sizeof(Key));
+            }
+        }
+        std::vector<std::vector<char>> received = net.exchange(buckets);
+        buckets.clear();
+
+        // Step 4: Local sort of this node's range.
+        std::vector<Key> mine;
+        for (const std::vector<char>& bytes : received) {
+            std::vector<Key> keys = fromBytes(bytes);
+            mine.insert(mine.end(), keys.begin(), keys.end());
+        }
+        received.clear();
+        std::vector<Key> slice(mine.size());
+        slice.resize(bigSort(std::span<const Key>(mine), std::span<Key>(slice), workspace));
+        return slice;
+    }
+
+private:
+    static std::vector<char> toBytes(std::span<const Key> keys) {
+        std::vector<char> bytes(keys.size() * sizeof(Key));
+        if (!keys.empty()) std::memcpy(bytes.data(), keys.data(), bytes.size());
+        return bytes;
+    }
+
+    static std::vector<Key> fromBytes(const std::vector<char>& bytes) {
+        std::vector<Key> keys(bytes.size() / sizeof(Key));
+        if (!keys.empty()) std::memcpy(keys.data(), bytes.data(), keys.size() * sizeof(Key));
+        return keys;
+    }
+
+    Transport& net;           // All-to-all transport.
+    SortWorkspace workspace;  // Local sort scratch, reused across sorts.
+};
+
+// ============================================================
+// Function: sortDistributedFile
+// ------------------------------------------------------------
+// Parameters:
+//   - network:    The node's transport.
+//   - inputPath:  This node's share of the keys, raw little-endian
+//                 uint64 (as in --mmap mode).
+//   - outputPath: File to receive this node's slice, same format.
+//
+// Returns:
+//   The number of keys this node wrote.
+// ============================================================
+template <typename Transport>
+size_t sortDistributedFile(Transport& network, const std::string& inputPath, const std::string& outputPath) {
+    MappedFile input = MappedFile::openRead(inputPath);
+    DistributedSorter<uint64_t, Transport> sorter(network);
+    std::vector<uint64_t> slice = sorter.sort(input.as<const uint64_t>());
+    MappedFile output = MappedFile::create(outputPath, slice.size() * sizeof(uint64_t));
+    if (!slice.empty()) std::memcpy(output.as<uint64_t>().data(), slice.data(), slice.size() * sizeof(uint64_t));
+    return slice.size();
+}
+
+// ============================================================
+// Class: BatchCommand
+// ------------------------------------------------------------
+// Role: Non-interactive, flag-driven front end for scripted runs
+//       and parameter sweeps. Parses the flags, builds or reads
+//       the input, sorts it --warmup + --repeat times with one
+//       BigSorter, and reports the same figures the interactive
+//       mode prints as one JSON object or as CSV rows (one per
+//       measured run). Bad flags print the usage and exit(1).
+//
+// Usage:
+//   bigsort --n 1000000 --max 100000000 --seed 7 --repeat 5 --no-print
+// ============================================================
+class BatchCommand {
+public:
+    using Key = int64_t;  // Keys read, generated and sorted.
+
+    enum class Format { Json, Csv };
+
+    struct Options {
+        size_t n = 0;                    // Keys to generate (--n).
+        Key max = 0;                     // Generated keys lie in [1, max] (--max).
+        uint64_t seed = 0;               // Generator seed (--seed).
+        bool seeded = false;             // --seed given; otherwise drawn at random.
+        unsigned threads = 0;            // Sort threads, 0 = all (--threads).
+        SortPlanner::Strategy strategy = SortPlanner::Strategy::Auto;  // --strategy.
+        std::string inputPath;           // Whitespace-separated keys (--input).
+        std::string outputPath;          // Sorted keys, one per line (--output).
+        unsigned repeat = 1;             // Measured sorts (--repeat).
+        unsigned warmup = 0;             // Unmeasured sorts before them (--warmup).
+        bool print = true;               // Echo both arrays to stdout (--no-print clears).
+        Format format = Format::Json;    // Report format (--format).
+    };
+
+    explicit BatchCommand(const Options& runOptions) : options(runOptions) { }
+
+    // ------------------------------------------------------------
+    // Method: parse
+    // ------------------------------------------------------------
+    // Parameters:
+    //   - argc, argv: The program's arguments; all of them are flags.
+    //
+    // Returns:
+    //   The parsed options. Exits with the usage on a bad flag, and
+    //   when neither --input nor both --n and --max are given.
+    // ------------------------------------------------------------
+    static Options parse(int argc, char** argv) {
+        Options parsed;
+        bool haveN = false, haveMax = false;
+        for (int i = 1; i < argc; ++i) {
+            std::string flag = argv[i];
+            auto value = [&]() -> std::string {
+                if (i + 1 >= argc) usage(argv[0], "missing value for " + flag);
+                return argv[++i];
+            };
+            if (flag == "--n") {
+                parsed.n = static_cast<size_t>(number(argv[0], flag, value()));
+                haveN = true;
+            } else if (flag == "--max") {
+                unsigned long long max = number(argv[0], flag, value());
+                if (max < 1 || max > static_cast<unsigned long long>(std::numeric_limits<Key>::max()))
+                    usage(argv[0], "--max must lie in [1, 2^63 - 1]");
+                parsed.max = static_cast<Key>(max);
+                haveMax = true;
+            } else if (flag == "--seed") {
+                parsed.seed = number(argv[0], flag, value());
+                parsed.seeded = true;
+            } else if (flag == "--threads") {
+                parsed.threads = static_cast<unsigned>(number(argv[0], flag, value()));
+            } else if (flag == "--strategy") {
+                std::string name = value();
+                if (!SortPlanner::parseStrategy(name, parsed.strategy))
+                    usage(argv[0], "unknown strategy " + name);
+            } else if (flag == "--input") {
+                parsed.inputPath = value();
+            } else if (flag == "--output") {
+                parsed.outputPath = value();
+            } else if (flag == "--repeat") {
+                parsed.repeat = static_cast<unsigned>(number(argv[0], flag, value()));
+                if (!parsed.repeat) usage(argv[0], "--repeat must be at least 1");
+            } else if (flag == "--warmup") {
+                parsed.warmup = static_cast<unsigned>(number(argv[0], flag, value()));
+            } else if (flag == "--no-print") {
+                parsed.print = false;
+            } else if (flag == "--format") {
+                std::string name = value();
+                if (name == "json") {
+                    parsed.format = Format::Json;
+                } else if (name == "csv") {
+                    parsed.format = Format::Csv;
+                } else {
+                    usage(argv[0], "--format must be json or csv");
+                }
+            } else {
+                usage(argv[0], "unknown option " + flag);
+            }
+        }
+        if (parsed.inputPath.empty()) {
+            if (!haveN || !haveMax) usage(argv[0], "give --input, or both --n and --max");
+            if (parsed.n > static_cast<unsigned long long>(parsed.max)) {
+                std::cerr << "Error: Array size (" << parsed.n
+                          << ") is greater than the number of unique values in the range [1, "
+                          << parsed.max << "].\n";
+                exit(1);
+            }
+        }
+        return parsed;
+    }
+
+    // ------------------------------------------------------------
+    // Method: run
+    // ------------------------------------------------------------
+    // Returns:
+    //   The process exit code.
     //
     // Flow:
-    //   1. Check if the range is sufficient for the requested size.
-    //   2. Create a vector containing all numbers from minValue to maxValue.
-    //   3. Shuffle the vector using a modern random generator.
-    //   4. Return the first 'size' numbers from the shuffled vector.
+    //   1. Read --input, or generate --n keys in [1, --max].
+    //   2. Sort --warmup times unmeasured, then --repeat times,
+    //      keeping each run's SortStats.
+    //   3. Print the arrays (unless --no-print), write --output,
+    //      and emit the report.
     // ------------------------------------------------------------
-    static std::vector<int> generateUniqueRandomArray(int size, int minValue, int maxValue) {
-        int range = maxValue - minValue + 1;
-        if (size > range) {
-            std::cerr << "Error: Array size cannot be larger than the number of unique values in the range.\n";
+    int run() {
+        // Step 1: Build the input.
+        if (!options.threads) options.threads = std::max(1u, std::thread::hardware_concurrency());
+        if (!options.seeded) {
+            std::random_device rd;
+            options.seed = (static_cast<uint64_t>(rd()) << 32) | rd();
+        }
+        std::vector<Key> input = options.inputPath.empty()
+            ? RandomArrayGenerator::generate<Key>(options.n, 1, options.max,
+                                                  RandomArrayGenerator::Distribution::Sparse, options.seed)
+            : readKeys(options.inputPath);
+
+        // Step 2: Warm up, then measure.
+        BigSorter sorter(input);
+        sorter.setThreadCount(options.threads);
+        sorter.setStrategy(options.strategy);
+        for (unsigned i = 0; i < options.warmup; ++i) sorter.sort();
+        std::vector<SortStats> runs;
+        runs.reserve(options.repeat);
+        for (unsigned i = 0; i < options.repeat; ++i) {
+            sorter.sort();
+            runs.push_back(sorter.getStats());
+        }
+        const std::vector<Key>& sorted = sorter.getSortedArray();
+
+        // Step 3: Arrays, output file, report.
+        std::cout << std::flush;
+        if (options.print) {
+            IntegerWriter writer(stdout);
+            writer.writeText("Original Array: ");
+            writer.writeAll(std::span<const Key>(input));
+            writer.writeText("\nCompact Sorted Array: ");
+            writer.writeAll(std::span<const Key>(sorted));
+            writer.writeText("\n");
+            if (!writer.flush()) {
+                std::cerr << "Error: failed writing the arrays to stdout.\n";
+                return 1;
+            }
+        }
+        if (!options.outputPath.empty()) writeKeys(options.outputPath, sorted);
+        std::string report = options.format == Format::Json ? jsonReport(sorter, runs) : csvReport(sorter, runs);
+        std::fwrite(report.data(), 1, report.size(), stdout);
+        std::fflush(stdout);
+        return 0;
+    }
+
+private:
+    [[noreturn]] static void usage(const char* program, const std::string& problem) {
+        std::cerr << "Error: " << problem << ".\n"
+                  << "Usage: " << program << " (--n N --max MAX [--seed S] | --input FILE)"
+                  << " [--output FILE] [--threads T] [--strategy auto|bitmap|radix|comparison|chunked|gpu]"
+                  << " [--repeat R] [--warmup W] [--no-print] [--format json|csv]\n";
+        exit(1);
+    }
+
+    static unsigned long long number(const char* program, const std::string& flag, const std::string& text) {
+        unsigned long long value = 0;
+        auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+        if (error != std::errc() || end != text.data() + text.size())
+            usage(program, "invalid value " + text + " for " + flag);
+        return value;
+    }
+
+    static std::vector<Key> readKeys(const std::string& path) {
+        MappedFile file = MappedFile::openRead(path);
+        std::span<const char> bytes = file.as<const char>();
+        std::vector<Key> keys;
+        size_t bad = IntegerParser::parse<Key>(std::string_view(bytes.data(), bytes.size()),
+                                               [&](Key key) { keys.push_back(key); });
+        if (bad != std::string_view::npos) {
+            std::cerr << "Error: " << path << " has a malformed integer at byte " << bad << ".\n";
             exit(1);
         }
+        return keys;
+    }
 
-        // Step 2: Populate a vector with all numbers in the range.
-        std::vector<int> allNumbers;
-        allNumbers.reserve(range);
-        for (int num = minValue; num <= maxValue; ++num) {
-            allNumbers.push_back(num);
+    static void writeKeys(const std::string& path, const std::vector<Key>& keys) {
+        FILE* file = std::fopen(path.c_str(), "w");
+        if (!file) {
+            std::cerr << "Error: cannot create " << path << ".\n";
+            exit(1);
         }
-        
-        // Step 3: Shuffle the vector using a modern random generator.
-        std::random_device rd;
-        std::mt19937 g(rd());
-        std::shuffle(allNumbers.begin(), allNumbers.end(), g);
-        
-        // Step 4: Build the resulting array by taking the first 'size' numbers.
-        std::vector<int> arr;
-        arr.reserve(size);
-        for (int i = 0; i < size; ++i) {
-            arr.push_back(allNumbers[i]);
+        bool complete;
+        {
+            IntegerWriter writer(file);
+            writer.writeAll(std::span<const Key>(keys), '\n');
+            complete = writer.flush();
+        }
+        if (std::fclose(file) != 0 || !complete) {
+            std::cerr << "Error: failed writing " << path << ".\n";
+            exit(1);
+        }
+    }
+
+    static std::string jsonString(const std::string& text) {
+        std::string quoted = "\"";
+        for (char c : text) {
+            if (c == '"' || c == '\\') quoted += '\\';
+            quoted += c;
+        }
+        return quoted + "\"";
+    }
+
+    // Sort times of the measured runs, ascending.
+    static std::vector<uint64_t> sortedTimes(const std::vector<SortStats>& runs) {
+        std::vector<uint64_t> times;
+        for (const SortStats& run : runs) times.push_back(run.totalNs);
+        std::sort(times.begin(), times.end());
+        return times;
+    }
+
+    std::string jsonReport(const BigSorter<Key>& sorter, const std::vector<SortStats>& runs) const {
+        std::vector<uint64_t> times = sortedTimes(runs);
+        uint64_t sum = 0;
+        for (uint64_t t : times) sum += t;
+        std::ostringstream json;
+        json << "{\"n\":" << sorter.getOriginalArraySize() << ",\"max\":" << options.max
+             << ",\"seed\":" << options.seed << ",\"input\":" << jsonString(options.inputPath)
+             << ",\"threads\":" << options.threads
+             << ",\"strategy\":\"" << SortPlanner::strategyName(sorter.getStrategy()) << "\""
+             << ",\"estimated_ns\":" << sorter.getCostEstimateNs()
+             << ",\"original_size\":" << sorter.getOriginalArraySize()
+             << ",\"exists_size\":" << sorter.getExistsArraySize()
+             << ",\"sorted_size\":" << sorter.getSortedArray().size()
+             << ",\"warmup\":" << options.warmup << ",\"repeat\":" << options.repeat
+             << ",\"sort_ns\":{\"min\":" << times.front() << ",\"median\":" << times[times.size() / 2]
+             << ",\"mean\":" << sum / times.size() << ",\"max\":" << times.back() << "}"
+             << ",\"runs\":[";
+        for (size_t i = 0; i < runs.size(); ++i) json << (i ? "," : "") << runs[i].toJson();
+        json << "]}\n";
+        return json.str();
+    }
+
+    std::string csvReport(const BigSorter<Key>& sorter, const std::vector<SortStats>& runs) const {
+        std::ostringstream csv;
+        csv << "run,n,max,seed,threads,strategy,original_size,exists_size,sorted_size,"
+               "sort_ns,bounds_ns,plan_ns,alloc_ns,mark_ns,extract_ns,clear_ns,bytes_allocated\n";
+        for (size_t i = 0; i < runs.size(); ++i) {
+            const SortStats& run = runs[i];
+            csv << i << "," << sorter.getOriginalArraySize() << "," << options.max << "," << options.seed << ","
+                << options.threads << "," << SortPlanner::strategyName(sorter.getStrategy()) << ","
+                << sorter.getOriginalArraySize() << "," << sorter.getExistsArraySize() << ","
+                << sorter.getSortedArray().size() << "," << run.totalNs << "," << run.boundsNs << ","
+                << run.planNs << "," << run.allocNs << "," << run.markNs << "," << run.extractNs << ","
+                << run.clearNs << "," << run.bytesAllocated << "\n";
         }
-        return arr;
+        return csv.str();
     }
+
+    Options options;  // Parsed flags; the seed is filled in by run() if absent.
 };
 
 // ============================================================
-// Class: BigSorter
+// Class: SelfTest
 // ------------------------------------------------------------
-// Role: Implements the "Big Sort" algorithm, which sorts an
-//       array in linear time using a sparse presence vector.
-//       It also measures the time taken to perform the sort.
+// Role: The "--self-test" mode. Runs the sorters and the bitmap
+//       structures on randomized inputs and compares each result
+//       with the standard library (std::sort and std::unique),
+//       once per BitmapKernels level the CPU supports, so a build
+//       can be checked on the machine it will run on. Failures go
+//       to stderr with the seed and iteration that reproduce them.
+//
+// Usage:
+//   SelfTest test(seed, iterations, tempDir);
+//   int status = test.run();  // 0 when every check passed
 // ============================================================
-class BigSorter {
+class SelfTest {
 public:
+    SelfTest(uint64_t seed, unsigned iterations, std::string tempDirectory)
+        : baseSeed(seed), rounds(std::max(iterations, 1u)), tempDir(std::move(tempDirectory)),
+          checks(0), failures(0), currentSection("") { }
+
     // ------------------------------------------------------------
-    // Constructor: BigSorter
+    // Method: run
+    // ------------------------------------------------------------
+    // Returns:
+    //   0 if every check passed, 1 otherwise. One line per section
+    //   and kernel level goes to stdout.
+    // ------------------------------------------------------------
+    int run() {
+        std::cout << "Self-test: seed " << baseSeed << ", " << rounds << " iterations\n";
+        BitmapKernels::Level best = BitmapKernels::detect();
+        for (BitmapKernels::Level level :
+             { BitmapKernels::Level::Scalar, BitmapKernels::Level::AVX2, BitmapKernels::Level::AVX512 }) {
+            if (static_cast<int>(level) > static_cast<int>(best)) continue;
+            BitmapKernels::setLevel(level);
+            section("kernels", [&](unsigned i) { checkKernels(i); });
+            section("strategies", [&](unsigned i) {
+                checkStrategies<int32_t>(i);
+                checkStrategies<uint32_t>(i);
+                checkStrategies<int64_t>(i);
+                checkStrategies<uint64_t>(i);
+                checkStrategies<int16_t>(i);
+                checkRecords(i);
+            });
+            section("set algebra", [&](unsigned i) {
+                checkSetAlgebra<int32_t>(i);
+                checkSetAlgebra<uint64_t>(i);
+                checkSetAlgebra<int16_t>(i);
+            });
+        }
+        BitmapKernels::setLevel(best);
+        section("external", [&](unsigned i) { checkExternal(i); });
+        section("mmap", [&](unsigned i) { checkMappedFile(i); });
+        section("streaming", [&](unsigned i) { checkStreaming(i); });
+        section("index", [&](unsigned i) {
+            checkIndex<int32_t>(i);
+            checkIndex<uint64_t>(i);
+            checkIndex<int16_t>(i);
+        });
+        section("top-k", [&](unsigned i) {
+            checkTopK<int32_t>(i);
+            checkTopK<uint64_t>(i);
+        });
+        section("generator", [&](unsigned i) { checkGenerator(i); });
+        section("pipeline", [&](unsigned i) { checkPipeline(i); });
+        section("text", [&](unsigned i) { checkText(i); });
+        section("distributed", [&](unsigned i) { checkDistributed(i); });
+        section("argsort", [&](unsigned i) {
+            checkArgsort<int32_t>(i);
+            checkArgsort<uint64_t>(i);
+        });
+        std::cout << "Self-test " << (failures ? "FAILED" : "passed") << ": " << checks << " checks, "
+                  << failures << " failures\n";
+        return failures ? 1 : 0;
+    }
+
+private:
+    // Runs body(i) for every iteration and prints one summary line.
+    template <typename Body>
+    void section(const char* name, Body body) {
+        unsigned long long failuresBefore = failures;
+        unsigned long long checksBefore = checks;
+        currentSection = name;
+        for (unsigned i = 0; i < rounds; ++i) body(i);
+        std::cout << "  " << name << " [" << BitmapKernels::levelName(BitmapKernels::active()) << "]: "
+                  << (failures == failuresBefore ? "ok" : "FAILED") << " (" << checks - checksBefore
+                  << " checks)\n";
+    }
+
+    // Records one check; a failure is reported with what it compared.
+    void expect(bool ok, const std::string& what, unsigned iteration) {
+        ++checks;
+        if (ok) return;
+        if (++failures <= kMaxReported) {
+            std::cerr << "FAIL: " << currentSection << " [" << BitmapKernels::levelName(BitmapKernels::active())
+                      << "] " << what << " (--seed " << baseSeed << ", iteration " << iteration << ")\n";
+        }
+    }
+
+    // Generator for one check of one iteration, so any failure
+    // replays from the seed and iteration alone.
+    std::mt19937_64 rngFor(unsigned iteration, uint64_t salt) const {
+        return std::mt19937_64(baseSeed * 0x9e3779b97f4a7c15ULL + iteration * 0x100000001b3ULL + salt);
+    }
+
+    // The key at position u of Key's ascending order, so a run of
+    // consecutive u is a run of consecutive keys for signed types too.
+    template <typename Key>
+    static Key orderedKey(std::make_unsigned_t<Key> u) {
+        using UKey = std::make_unsigned_t<Key>;
+        constexpr UKey kSignBit = std::is_signed_v<Key> ? static_cast<UKey>(UKey(1) << (8 * sizeof(Key) - 1)) : 0;
+        return static_cast<Key>(static_cast<UKey>(u ^ kSignBit));
+    }
+
+    // ------------------------------------------------------------
+    // Method: randomKeys
+    // ------------------------------------------------------------
+    // Returns:
+    //   Up to 20000 keys (70000 to 100000 every fifth iteration, so
+    //   the parallel paths run) drawn from a span that cycles
+    //   through tiny, dense, sparse and full-width, from a random
+    //   base. Full-width spans include both extremes of Key.
+    // ------------------------------------------------------------
+    template <typename Key>
+    static std::vector<Key> randomKeys(std::mt19937_64& rng, unsigned iteration) {
+        using UKey = std::make_unsigned_t<Key>;
+        size_t n = iteration % 5 == 4 ? 70000 + rng() % 30001 : rng() % 20001;
+        unsigned long long spans[] = { 16, n + 1, 64ULL * n + 1, 0 };
+        unsigned long long span = spans[iteration % 4];
+        if (span && span - 1 > std::numeric_limits<UKey>::max()) span = 0;
+        UKey base = static_cast<UKey>(rng());
+        if (span && base > static_cast<UKey>(std::numeric_limits<UKey>::max() - (span - 1))) {
+            base = static_cast<UKey>(std::numeric_limits<UKey>::max() - (span - 1));
+        }
+        std::vector<Key> keys(n);
+        for (Key& key : keys) {
+            key = orderedKey<Key>(span ? static_cast<UKey>(base + rng() % span) : static_cast<UKey>(rng()));
+        }
+        if (!span && n >= 2) {
+            keys[0] = std::numeric_limits<Key>::min();
+            keys[n - 1] = std::numeric_limits<Key>::max();
+        }
+        return keys;
+    }
+
+    template <typename Key>
+    static std::vector<Key> sortedDistinct(std::vector<Key> keys) {
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+        return keys;
+    }
+
+    // ------------------------------------------------------------
+    // Method: checkKernels
     // ------------------------------------------------------------
-    // Parameters:
-    //   - inputArray: The unsorted array to be processed.
-    //
     // Role:
-    //   Stores the original array and initializes timing and
-    //   internal state variables.
+    //   Compares the active level's mark, extract, combine and
+    //   popcount kernels with plain loops, on word counts and
+    //   output buffers that end at every vector tail.
     // ------------------------------------------------------------
-    BigSorter(const std::vector<int>& inputArray)
-        : originalArray(inputArray), sortDurationMs(0), existsArraySize(0) { }
+    void checkKernels(unsigned iteration) {
+        std::mt19937_64 rng = rngFor(iteration, 1);
+        size_t wordCount = 1 + rng() % 300;
+        uint32_t base = static_cast<uint32_t>(rng() % 1000000);
+        std::vector<uint32_t> values(rng() % (wordCount * 96));
+        for (uint32_t& value : values) value = base + static_cast<uint32_t>(rng() % (wordCount * 64));
+
+        std::vector<uint64_t> words(wordCount, 0), reference(wordCount, 0);
+        BitmapKernels::mark(words.data(), values.data(), values.size(), base);
+        for (uint32_t value : values) reference[(value - base) >> 6] |= uint64_t(1) << ((value - base) & 63);
+        expect(words == reference, "mark", iteration);
+
+        size_t bits = 0;
+        for (uint64_t word : reference) bits += static_cast<size_t>(__builtin_popcountll(word));
+        expect(BitmapKernels::popcount(words.data(), wordCount) == bits, "popcount", iteration);
+
+        std::vector<uint32_t> extracted(bits), expected;
+        for (size_t i = 0; i < wordCount * 64; ++i) {
+            if (reference[i >> 6] >> (i & 63) & 1) expected.push_back(base + static_cast<uint32_t>(i));
+        }
+        uint32_t* end = BitmapKernels::extract(words.data(), wordCount, extracted.data(),
+                                               extracted.data() + extracted.size(), base);
+        expect(end == extracted.data() + bits && extracted == expected, "extract", iteration);
+
+        std::vector<uint64_t> other(wordCount);
+        for (uint64_t& word : other) word = rng() & rng();
+        for (BitmapKernels::SetOp op : { BitmapKernels::SetOp::Union, BitmapKernels::SetOp::Intersection,
+                                         BitmapKernels::SetOp::Difference,
+                                         BitmapKernels::SetOp::SymmetricDifference }) {
+            std::vector<uint64_t> combined = words;
+            BitmapKernels::combine(combined.data(), other.data(), wordCount, op);
+            bool same = true;
+            for (size_t i = 0; i < wordCount; ++i) {
+                uint64_t want = op == BitmapKernels::SetOp::Union          ? words[i] | other[i]
+                              : op == BitmapKernels::SetOp::Intersection   ? words[i] & other[i]
+                              : op == BitmapKernels::SetOp::Difference     ? words[i] & ~other[i]
+                                                                           : words[i] ^ other[i];
+                same = same && combined[i] == want;
+            }
+            expect(same, "combine op " + std::to_string(static_cast<int>(op)), iteration);
+        }
+    }
 
     // ------------------------------------------------------------
-    // Method: sort
+    // Method: checkStrategies
     // ------------------------------------------------------------
     // Role:
-    //   Performs the "Big Sort" algorithm which:
-    //     1. Finds the maximum element to determine the size of a
-    //        boolean "exists" vector.
-    //     2. Marks the presence of each number in the boolean vector.
-    //     3. Iterates through the boolean vector to build a compact,
-    //        sorted array.
-    //     4. Measures and records the time taken for this sorting process.
+    //   Sorts one random input with every forced SortPlanner
+    //   strategy, with and without duplicate counting, on one and
+    //   four threads, with blocked marking and with the summary
+    //   level, then with bigSort() through a reused SortWorkspace,
+    //   with and without its summary. Every result must equal
+    //   std::sort (plus std::unique unless counting).
+    //   Forcing the bitmap on a full-width span is skipped: it
+    //   would need 2^64 / 8 bytes and is not a correctness case.
     // ------------------------------------------------------------
-    void sort() {
-        using Clock = std::chrono::high_resolution_clock;
-        auto startTime = Clock::now();
+    template <typename Key>
+    void checkStrategies(unsigned iteration) {
+        std::mt19937_64 rng = rngFor(iteration, 2);
+        std::vector<Key> keys = randomKeys<Key>(rng, iteration);
+        std::vector<Key> all = keys;
+        std::sort(all.begin(), all.end());
+        std::vector<Key> distinct = sortedDistinct(all);
+        bool fullWidth = iteration % 4 == 3 && sizeof(Key) > 2;
+        std::string type = std::string(std::is_signed_v<Key> ? "int" : "uint") + std::to_string(8 * sizeof(Key));
 
-        // Step 1: Determine the maximum element in the array.
-        int maxElement = *std::max_element(originalArray.begin(), originalArray.end());
-        existsArraySize = maxElement; // 'exists' vector will have a size equal to the maximum element.
+        for (SortPlanner::Strategy strategy :
+             { SortPlanner::Strategy::Auto, SortPlanner::Strategy::Bitmap, SortPlanner::Strategy::Radix,
+               SortPlanner::Strategy::Comparison, SortPlanner::Strategy::Chunked, SortPlanner::Strategy::Gpu }) {
+            if (fullWidth && strategy != SortPlanner::Strategy::Auto && strategy != SortPlanner::Strategy::Radix &&
+                strategy != SortPlanner::Strategy::Comparison) {
+                continue;
+            }
+            for (int variant = 0; variant < 5; ++variant) {
+                BigSorter<Key> sorter(keys);
+                sorter.setStrategy(strategy);
+                sorter.setCountDuplicates(variant & 1);
+                sorter.setThreadCount(variant == 2 ? 4 : 1);
+                sorter.setSummaryBitmap(variant == 3);
+                sorter.setMarkMode(variant == 4 ? PresenceBitmap::MarkMode::Blocked : PresenceBitmap::MarkMode::Direct);
+                sorter.sort();
+                expect(sorter.getSortedArray() == ((variant & 1) ? all : distinct),
+                       type + " " + SortPlanner::strategyName(strategy) + " variant " + std::to_string(variant),
+                       iteration);
+            }
+        }
 
-        // Step 2: Create and populate a boolean vector indicating number presence.
-        std::vector<bool> exists(existsArraySize, false);
-        for (int value : originalArray) {
-            exists[value - 1] = true; // Adjust index for zero-based vector.
+        std::vector<Key> output(keys.size());
+        for (int pass = 0; pass < 2; ++pass) {
+            workspace.setSummaryEnabled(pass == 1);
+            size_t written = bigSort(std::span<const Key>(keys), std::span<Key>(output), workspace);
+            expect(written == distinct.size() && std::equal(distinct.begin(), distinct.end(), output.begin()),
+                   type + " bigSort pass " + std::to_string(pass), iteration);
         }
+    }
 
-        // Step 3: Build the sorted array by iterating over the 'exists' vector.
-        sortedArray.clear();
-        sortedArray.reserve(originalArray.size());
-        for (size_t i = 0; i < exists.size(); ++i) {
-            if (exists[i]) {
-                sortedArray.push_back(static_cast<int>(i + 1)); // Adjust index back.
+    // ------------------------------------------------------------
+    // Method: checkRecords
+    // ------------------------------------------------------------
+    // Role:
+    //   Sorts records by a projected key with every strategy and
+    //   compares them, payloads included, with std::stable_sort
+    //   (plus std::unique on the key unless counting): equal keys
+    //   keep input order and distinct mode keeps the first record.
+    // ------------------------------------------------------------
+    void checkRecords(unsigned iteration) {
+        struct Record {
+            int64_t key;
+            uint32_t id;
+            bool operator==(const Record&) const = default;
+        };
+        std::mt19937_64 rng = rngFor(iteration, 7);
+        std::vector<int64_t> keys = randomKeys<int64_t>(rng, iteration);
+        std::vector<Record> records(keys.size());
+        for (size_t i = 0; i < keys.size(); ++i) records[i] = { keys[i], static_cast<uint32_t>(i) };
+        auto byKey = [](const Record& a, const Record& b) { return a.key < b.key; };
+        std::vector<Record> all = records;
+        std::stable_sort(all.begin(), all.end(), byKey);
+        std::vector<Record> distinct = all;
+        distinct.erase(std::unique(distinct.begin(), distinct.end(),
+                                   [](const Record& a, const Record& b) { return a.key == b.key; }),
+                       distinct.end());
+
+        for (SortPlanner::Strategy strategy : { SortPlanner::Strategy::Auto, SortPlanner::Strategy::Bitmap,
+                                                SortPlanner::Strategy::Radix, SortPlanner::Strategy::Comparison }) {
+            if (iteration % 4 == 3 && strategy == SortPlanner::Strategy::Bitmap) continue;
+            for (bool counting : { false, true }) {
+                BigSorter sorter(records, [](const Record& record) { return record.key; });
+                sorter.setStrategy(strategy);
+                sorter.setCountDuplicates(counting);
+                sorter.sort();
+                expect(sorter.getSortedArray() == (counting ? all : distinct),
+                       std::string("records ") + SortPlanner::strategyName(strategy) + (counting ? " counting" : ""),
+                       iteration);
             }
         }
+    }
 
-        // Step 4: Record the elapsed time for the sort operation.
-        auto endTime = Clock::now();
-        sortDurationMs = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime).count();
+    // Path of a scratch file in the temp directory.
+    std::string tempPath(const char* name) const {
+        return tempDir + "/bigsort-selftest-" + std::to_string(::getpid()) + "-" + name;
+    }
+
+    // Writes bytes to a scratch file; a failure counts as a failed check.
+    bool writeFile(const std::string& path, const void* data, size_t bytes, unsigned iteration) {
+        FILE* file = std::fopen(path.c_str(), "wb");
+        bool written = file && (bytes == 0 || std::fwrite(data, 1, bytes, file) == bytes);
+        if (file) written = std::fclose(file) == 0 && written;
+        expect(written, "cannot write " + path, iteration);
+        return written;
+    }
+
+    // The whole of a file, or "" if it cannot be read.
+    static std::string readFile(const std::string& path) {
+        std::string bytes;
+        FILE* file = std::fopen(path.c_str(), "rb");
+        if (!file) return bytes;
+        char buffer[1 << 16];
+        size_t got;
+        while ((got = std::fread(buffer, 1, sizeof(buffer), file)) > 0) bytes.append(buffer, got);
+        std::fclose(file);
+        return bytes;
     }
 
     // ------------------------------------------------------------
-    // Accessor: getSortedArray
+    // Method: checkExternal
     // ------------------------------------------------------------
-    // Returns:
-    //   A constant reference to the sorted array.
+    // Role:
+    //   Sorts a key file of up to 400000 keys out of core with the
+    //   minimum budget (about 170000 resident keys), so it takes
+    //   the bucket path, and compares the output file with the
+    //   keys sorted in memory. The span cycles through dense
+    //   (bitmap buckets), sparse, full-width and one hot key mixed
+    //   into a wide span (a bucket that must be split again).
     // ------------------------------------------------------------
-    const std::vector<int>& getSortedArray() const { return sortedArray; }
+    void checkExternal(unsigned iteration) {
+        std::mt19937_64 rng = rngFor(iteration, 3);
+        size_t n = 1 + rng() % 400000;
+        unsigned long long span = iteration % 4 == 0 ? n : iteration % 4 == 1 ? 64ULL * n : 0;
+        uint64_t base = rng() >> 2;
+        std::vector<uint64_t> keys(n);
+        for (uint64_t& key : keys) {
+            key = iteration % 4 == 3 && rng() % 4 ? base : span ? base + rng() % span : rng();
+        }
+
+        std::string inputPath = tempPath("external.in");
+        std::string outputPath = tempPath("external.out");
+        if (!writeFile(inputPath, keys.data(), n * sizeof(uint64_t), iteration)) return;
+
+        ExternalSorter sorter(ExternalSorter::kMinMemoryBytes, tempDir);
+        unsigned long long count = sorter.sortFile(inputPath, outputPath);
+        std::vector<uint64_t> expected = sortedDistinct(keys);
+        std::string bytes = readFile(outputPath);
+        std::vector<uint64_t> output(bytes.size() / sizeof(uint64_t));
+        std::memcpy(output.data(), bytes.data(), output.size() * sizeof(uint64_t));
+        expect(count == expected.size() && bytes.size() == expected.size() * sizeof(uint64_t) &&
+               output == expected, "sortFile of " + std::to_string(n) + " keys", iteration);
+        std::remove(inputPath.c_str());
+        std::remove(outputPath.c_str());
+    }
 
     // ------------------------------------------------------------
-    // Accessor: getSortDurationMs
+    // Method: checkMappedFile
     // ------------------------------------------------------------
-    // Returns:
-    //   The time taken (in milliseconds) to perform the sorting.
+    // Role:
+    //   Sorts a raw key file (32-bit keys on even iterations, 64-bit
+    //   on odd) between two mappings with sortMappedFile() and
+    //   compares the output file with the sorted distinct keys.
+    //   Also checks MappedFile::isSameFile(), which guards against
+    //   an output that is the input, directly and via a symlink.
     // ------------------------------------------------------------
-    long long getSortDurationMs() const { return sortDurationMs; }
+    void checkMappedFile(unsigned iteration) {
+        if (iteration % 2) {
+            checkMappedFileOf<uint64_t>(iteration);
+        } else {
+            checkMappedFileOf<uint32_t>(iteration);
+        }
+    }
+
+    template <typename Key>
+    void checkMappedFileOf(unsigned iteration) {
+        std::mt19937_64 rng = rngFor(iteration, 9);
+        std::vector<Key> keys = randomKeys<Key>(rng, iteration);
+        if (keys.empty()) keys.push_back(static_cast<Key>(rng()));
+        std::string inputPath = tempPath("mmap.in");
+        std::string outputPath = tempPath("mmap.out");
+        std::string linkPath = tempPath("mmap.link");
+        if (!writeFile(inputPath, keys.data(), keys.size() * sizeof(Key), iteration)) return;
+
+        size_t written = sortMappedFile<Key>(inputPath, outputPath);
+        std::vector<Key> expected = sortedDistinct(keys);
+        std::string bytes = readFile(outputPath);
+        std::vector<Key> output(bytes.size() / sizeof(Key));
+        std::memcpy(output.data(), bytes.data(), output.size() * sizeof(Key));
+        expect(written == expected.size() && bytes.size() == expected.size() * sizeof(Key) && output == expected,
+               std::to_string(8 * sizeof(Key)) + "-bit sortMappedFile of " + std::to_string(keys.size()) + " keys",
+               iteration);
+
+        MappedFile input = MappedFile::openRead(inputPath);
+        bool linked = ::symlink(inputPath.c_str(), linkPath.c_str()) == 0;
+        expect(input.isSameFile(inputPath) && !input.isSameFile(outputPath) && (!linked || input.isSameFile(linkPath)),
+               "isSameFile", iteration);
+        std::remove(linkPath.c_str());
+        std::remove(inputPath.c_str());
+        std::remove(outputPath.c_str());
+    }
 
     // ------------------------------------------------------------
-    // Accessor: getOriginalArraySize
+    // Method: checkStreaming
     // ------------------------------------------------------------
-    // Returns:
-    //   The number of elements in the original unsorted array.
+    // Role:
+    //   Feeds random batches into one StreamingBigSorter over two
+    //   windows: each drain() must return the distinct keys of its
+    //   window's batches only, and insertedCount() /
+    //   distinctCount() must match before draining.
     // ------------------------------------------------------------
-    int getOriginalArraySize() const { return static_cast<int>(originalArray.size()); }
+    void checkStreaming(unsigned iteration) {
+        std::mt19937_64 rng = rngFor(iteration, 10);
+        int64_t low = static_cast<int64_t>(rng() % 2000000) - 1000000;
+        int64_t high = low + static_cast<int64_t>(rng() % (iteration % 2 ? 5000 : 5000000));
+        StreamingBigSorter<int64_t> window(low, high);
+        for (int pass = 0; pass < 2; ++pass) {
+            std::vector<int64_t> all;
+            for (unsigned batch = static_cast<unsigned>(rng() % 5); batch > 0; --batch) {
+                std::vector<int64_t> keys(rng() % 5000);
+                for (int64_t& key : keys) key = low + static_cast<int64_t>(rng() % static_cast<uint64_t>(high - low + 1));
+                window.insert(std::span<const int64_t>(keys));
+                all.insert(all.end(), keys.begin(), keys.end());
+            }
+            std::vector<int64_t> expected = sortedDistinct(all);
+            expect(window.insertedCount() == all.size() && window.distinctCount() == expected.size(),
+                   "window " + std::to_string(pass) + " counts", iteration);
+            expect(window.drain() == expected, "window " + std::to_string(pass) + " drain", iteration);
+        }
+    }
 
     // ------------------------------------------------------------
-    // Accessor: getExistsArraySize
+    // Method: checkSetAlgebra
     // ------------------------------------------------------------
-    // Returns:
-    //   The size of the boolean "exists" vector used during sorting.
+    // Role:
+    //   Builds two PresenceSets over overlapping ranges that start
+    //   at unrelated bit offsets (either may be empty) and compares
+    //   |, &, - and ^ with std::set_union, set_intersection,
+    //   set_difference and set_symmetric_difference, through
+    //   toSortedVector(), forEach(), size() and contains().
     // ------------------------------------------------------------
-    int getExistsArraySize() const { return existsArraySize; }
+    template <typename Key>
+    void checkSetAlgebra(unsigned iteration) {
+        using UKey = std::make_unsigned_t<Key>;
+        std::mt19937_64 rng = rngFor(iteration, 5);
+        unsigned long long span = std::min<unsigned long long>(1 + rng() % 40000, std::numeric_limits<UKey>::max());
+        UKey base = static_cast<UKey>(rng());
+        if (base > static_cast<UKey>(std::numeric_limits<UKey>::max() - 2 * span)) base = 0;
+        auto draw = [&](bool empty) {
+            UKey first = static_cast<UKey>(base + rng() % span);
+            std::vector<Key> keys(empty ? 0 : rng() % 6000);
+            for (Key& key : keys) key = orderedKey<Key>(static_cast<UKey>(first + rng() % span));
+            return keys;
+        };
+        std::vector<Key> a = draw(iteration % 7 == 6), b = draw(iteration % 5 == 4);
+        PresenceSet<Key> left{std::span<const Key>(a)}, right{std::span<const Key>(b)};
+        std::vector<Key> x = sortedDistinct(a), y = sortedDistinct(b);
 
-private:
-    std::vector<int> originalArray;  // The original unsorted array.
-    std::vector<int> sortedArray;    // The resulting sorted array.
-    long long sortDurationMs;        // Time taken for sorting in milliseconds.
-    int existsArraySize;             // Size of the boolean "exists" vector.
+        auto same = [&](const PresenceSet<Key>& result, const std::vector<Key>& expected, const char* op) {
+            std::vector<Key> visited;
+            result.forEach([&](Key key) { visited.push_back(key); });
+            expect(result.toSortedVector() == expected && visited == expected && result.size() == expected.size(),
+                   std::to_string(8 * sizeof(Key)) + "-bit " + op, iteration);
+        };
+        std::vector<Key> expected;
+        std::set_union(x.begin(), x.end(), y.begin(), y.end(), std::back_inserter(expected));
+        same(left | right, expected, "union");
+        expected.clear();
+        std::set_intersection(x.begin(), x.end(), y.begin(), y.end(), std::back_inserter(expected));
+        same(left & right, expected, "intersection");
+        expected.clear();
+        std::set_difference(x.begin(), x.end(), y.begin(), y.end(), std::back_inserter(expected));
+        same(left - right, expected, "difference");
+        expected.clear();
+        std::set_symmetric_difference(x.begin(), x.end(), y.begin(), y.end(), std::back_inserter(expected));
+        same(left ^ right, expected, "symmetric difference");
+
+        bool members = true;
+        for (Key key : b) members = members && left.contains(key) == std::binary_search(x.begin(), x.end(), key);
+        expect(members, std::to_string(8 * sizeof(Key)) + "-bit contains", iteration);
+    }
+
+    // ------------------------------------------------------------
+    // Method: checkIndex
+    // ------------------------------------------------------------
+    // Role:
+    //   Saves a PresenceIndex of random keys (sometimes none) under
+    //   --tmp, loads it back as a mapping, and compares iteration,
+    //   size(), rank(), select(), contains() and lower_bound() with
+    //   the sorted distinct keys. Then merges a second batch, whose
+    //   range may start below the first, and checks the merged
+    //   index before and after another save/load round trip.
+    // ------------------------------------------------------------
+    template <typename Key>
+    void checkIndex(unsigned iteration) {
+        using UKey = std::make_unsigned_t<Key>;
+        std::mt19937_64 rng = rngFor(iteration, 6);
+        std::string type = std::to_string(8 * sizeof(Key)) + "-bit ";
+        unsigned long long span = std::min<unsigned long long>(1 + rng() % 3000000,
+                                                               std::numeric_limits<UKey>::max() / 4);
+        UKey base = static_cast<UKey>(span + rng() % (std::numeric_limits<UKey>::max() - 3 * span));
+        auto draw = [&](UKey first, size_t n) {
+            std::vector<Key> keys(n);
+            for (Key& key : keys) key = orderedKey<Key>(static_cast<UKey>(first + rng() % span));
+            return keys;
+        };
+        std::vector<Key> keys = draw(base, iteration % 6 == 5 ? 0 : rng() % 20000);
+
+        // Compares an index with the keys it should hold.
+        auto same = [&](const PresenceIndex<Key>& index, const std::vector<Key>& expected, const std::string& what) {
+            bool ok = index.size() == expected.size() && std::equal(index.begin(), index.end(),
+                                                                    expected.begin(), expected.end());
+            for (size_t i = 0; ok && i < expected.size(); i += 1 + expected.size() / 64) {
+                ok = index.select(i) == expected[i] && index.rank(expected[i]) == i && index.contains(expected[i]);
+                if (expected[i] == std::numeric_limits<Key>::max()) continue;
+                Key probe = static_cast<Key>(expected[i] + 1);
+                auto next = std::lower_bound(expected.begin(), expected.end(), probe);
+                ok = ok && (next == expected.end() ? index.lower_bound(probe) == index.end()
+                                                   : *index.lower_bound(probe) == *next);
+            }
+            expect(ok, type + what, iteration);
+        };
+
+        std::string path = tempPath("index.bin");
+        std::vector<Key> expected = sortedDistinct(keys);
+        PresenceIndex<Key>{std::span<const Key>(keys)}.save(path);
+        PresenceIndex<Key> loaded = PresenceIndex<Key>::load(path);
+        expect(loaded.isMapped(), type + "load maps the file", iteration);
+        same(loaded, expected, "save/load");
+
+        UKey batchBase = static_cast<UKey>(base - span + rng() % (2 * span));
+        std::vector<Key> batch = draw(batchBase, rng() % 20000);
+        loaded.merge(std::span<const Key>(batch));
+        keys.insert(keys.end(), batch.begin(), batch.end());
+        expected = sortedDistinct(keys);
+        same(loaded, expected, "merge");
+        loaded.save(path);
+        same(PresenceIndex<Key>::load(path), expected, "merge save/load");
+        std::remove(path.c_str());
+    }
+
+    // ------------------------------------------------------------
+    // Method: checkTopK
+    // ------------------------------------------------------------
+    // Role:
+    //   Runs sortTopK() in both orders with k from 0 past the input
+    //   size, with and without counting, on one and four threads
+    //   and with each forced strategy; the result must be the first
+    //   k elements of the full sort in that order.
+    // ------------------------------------------------------------
+    template <typename Key>
+    void checkTopK(unsigned iteration) {
+        std::mt19937_64 rng = rngFor(iteration, 11);
+        std::vector<Key> keys = randomKeys<Key>(rng, iteration);
+        std::vector<Key> all = keys;
+        std::sort(all.begin(), all.end());
+        std::vector<Key> distinct = sortedDistinct(all);
+        size_t k = rng() % 3 ? rng() % 200 : rng() % (keys.size() + 2);
+        std::string type = std::to_string(8 * sizeof(Key)) + "-bit k=" + std::to_string(k);
+
+        for (SortPlanner::Strategy strategy : { SortPlanner::Strategy::Auto, SortPlanner::Strategy::Bitmap,
+                                                SortPlanner::Strategy::Radix, SortPlanner::Strategy::Comparison }) {
+            if (iteration % 4 == 3 && strategy == SortPlanner::Strategy::Bitmap) continue;
+            for (int variant = 0; variant < 8; ++variant) {
+                bool counting = variant & 1;
+                bool descending = variant & 2;
+                std::vector<Key> expected = counting ? all : distinct;
+                if (descending) std::reverse(expected.begin(), expected.end());
+                expected.resize(std::min(k, expected.size()));
+
+                BigSorter<Key> sorter(keys);
+                sorter.setStrategy(strategy);
+                sorter.setCountDuplicates(counting);
+                sorter.setThreadCount(variant & 4 ? 4 : 1);
+                sorter.sortTopK(k, descending ? SortOrder::Descending : SortOrder::Ascending);
+                expect(sorter.getSortedArray() == expected,
+                       type + " " + SortPlanner::strategyName(strategy) + " variant " + std::to_string(variant),
+                       iteration);
+            }
+        }
+    }
+
+    // ------------------------------------------------------------
+    // Method: checkGenerator
+    // ------------------------------------------------------------
+    // Role:
+    //   Checks generate() for every distribution: the size, the
+    //   range, no repeats for the unique distributions, the same
+    //   array for the same seed on one or four threads, and that
+    //   Sampler::fill() of any slice matches it.
+    // ------------------------------------------------------------
+    void checkGenerator(unsigned iteration) {
+        using Distribution = RandomArrayGenerator::Distribution;
+        std::mt19937_64 rng = rngFor(iteration, 8);
+        size_t n = iteration % 5 == 4 ? 70000 + rng() % 30001 : rng() % 20001;
+        int64_t low = static_cast<int64_t>(rng() % 2000000) - 1000000;
+        for (Distribution distribution : { Distribution::Dense, Distribution::Sparse, Distribution::Clustered,
+                                           Distribution::Zipf }) {
+            int64_t high = low + static_cast<int64_t>(distribution == Distribution::Dense ? n : 64 * n + 1);
+            std::string name = "distribution " + std::to_string(static_cast<int>(distribution));
+            std::vector<int64_t> values =
+                RandomArrayGenerator::generate<int64_t>(n, low, high, distribution, rng(), 1);
+            bool inRange = values.size() == n;
+            for (int64_t value : values) inRange = inRange && value >= low && value <= high;
+            expect(inRange, name + " size and range", iteration);
+            if (distribution != Distribution::Zipf) {
+                expect(sortedDistinct(values).size() == n, name + " has no repeats", iteration);
+            }
+
+            uint64_t seed = rng();
+            std::vector<int64_t> single = RandomArrayGenerator::generate<int64_t>(n, low, high, distribution, seed, 1);
+            expect(single == RandomArrayGenerator::generate<int64_t>(n, low, high, distribution, seed, 4),
+                   name + " is independent of the thread count", iteration);
+            size_t first = n ? rng() % n : 0;
+            size_t count = n ? rng() % (n - first + 1) : 0;
+            std::vector<int64_t> slice(count);
+            RandomArrayGenerator::Sampler<int64_t>(n, low, high, distribution, seed).fill(slice.data(), first, count);
+            expect(std::equal(slice.begin(), slice.end(), single.begin() + static_cast<std::ptrdiff_t>(first)),
+                   name + " Sampler slice", iteration);
+        }
+    }
+
+    // ------------------------------------------------------------
+    // Method: checkPipeline
+    // ------------------------------------------------------------
+    // Role:
+    //   Runs PipelinedSortDriver with random chunk sizes, ring
+    //   depths and 1 to 4 producers over each distribution, echoing
+    //   the input through an IntegerWriter into a scratch file. The
+    //   echo must be generate()'s array in order and the result its
+    //   sorted distinct keys.
+    // ------------------------------------------------------------
+    void checkPipeline(unsigned iteration) {
+        using Distribution = RandomArrayGenerator::Distribution;
+        std::mt19937_64 rng = rngFor(iteration, 12);
+        Distribution distribution = static_cast<Distribution>(iteration % 4);
+        size_t n = iteration % 5 == 4 ? 70000 + rng() % 30001 : rng() % 20001;
+        int64_t low = static_cast<int64_t>(rng() % 2000000) - 1000000;
+        int64_t high = low + static_cast<int64_t>(distribution == Distribution::Dense ? n : 64 * n + 1);
+        uint64_t seed = rng();
+        std::vector<int64_t> input = RandomArrayGenerator::generate<int64_t>(n, low, high, distribution, seed);
+
+        std::string echoPath = tempPath("pipeline.txt");
+        FILE* echoFile = std::fopen(echoPath.c_str(), "w");
+        expect(echoFile != nullptr, "cannot create " + echoPath, iteration);
+        if (!echoFile) return;
+        PipelinedSortDriver<int64_t> driver(1 + rng() % 5000, 1 + rng() % 4, 1 + iteration % 4);
+        std::vector<int64_t> sorted;
+        bool flushed;
+        {
+            IntegerWriter echo(echoFile);
+            sorted = driver.run(n, low, high, distribution, seed, &echo);
+            flushed = echo.flush();
+        }
+        bool closed = std::fclose(echoFile) == 0;
+
+        std::vector<int64_t> echoed;
+        std::string text = readFile(echoPath);
+        size_t bad = IntegerParser::parse<int64_t>(text, [&](int64_t key) { echoed.push_back(key); });
+        expect(flushed && closed && bad == std::string_view::npos && echoed == input,
+               std::to_string(driver.getProducerCount()) + " producers echo", iteration);
+        expect(sorted == sortedDistinct(input), std::to_string(driver.getProducerCount()) + " producers sort",
+               iteration);
+        std::remove(echoPath.c_str());
+    }
+
+    // ------------------------------------------------------------
+    // Method: checkText
+    // ------------------------------------------------------------
+    // Role:
+    //   Writes random keys as text with mixed separators (spaces,
+    //   tabs, LF and CRLF, blank lines), then checks that
+    //   IntegerParser reads them back in order, that it reports a
+    //   malformed token at its offset, and that sortTextFile() on 1
+    //   to 4 threads writes the sorted distinct keys one per line.
+    // ------------------------------------------------------------
+    void checkText(unsigned iteration) {
+        std::mt19937_64 rng = rngFor(iteration, 13);
+        std::vector<int64_t> keys = randomKeys<int64_t>(rng, iteration);
+        const char* separators[] = { "\n", " ", "\t", "\r\n", "\n\n" };
+        std::string text = iteration % 3 ? "" : "  \n";
+        for (int64_t key : keys) {
+            text += std::to_string(key);
+            text += separators[rng() % 5];
+        }
+
+        std::vector<int64_t> parsed;
+        size_t bad = IntegerParser::parse<int64_t>(text, [&](int64_t key) { parsed.push_back(key); });
+        expect(bad == std::string_view::npos && parsed == keys, "parse", iteration);
+        std::string broken = text + (iteration % 2 ? "12x 5\n" : "99999999999999999999\n");
+        expect(IntegerParser::parse<int64_t>(broken, [](int64_t) { }) == text.size(), "parse error offset",
+               iteration);
+
+        std::string inputPath = tempPath("text.in");
+        std::string outputPath = tempPath("text.out");
+        if (!writeFile(inputPath, text.data(), text.size(), iteration)) return;
+        unsigned threads = 1 + iteration % 4;
+        size_t written = sortTextFile<int64_t>(inputPath, outputPath, threads);
+        std::vector<int64_t> expected = sortedDistinct(keys), output;
+        std::string sortedText = readFile(outputPath);
+        IntegerParser::parse<int64_t>(sortedText, [&](int64_t key) { output.push_back(key); });
+        std::string lines;
+        for (int64_t key : expected) lines += std::to_string(key) + "\n";
+        expect(written == expected.size() && sortedText == lines,
+               "sortTextFile on " + std::to_string(threads) + " threads", iteration);
+        std::remove(inputPath.c_str());
+        std::remove(outputPath.c_str());
+    }
+
+    // ------------------------------------------------------------
+    // Class: LoopbackTransport
+    // ------------------------------------------------------------
+    // Role: In-process stand-in for TcpTransport: every rank is a
+    //       thread, and exchange() swaps buffers through a shared
+    //       Hub between two barriers, so DistributedSorter can be
+    //       checked without sockets or a host file.
+    // ------------------------------------------------------------
+    class LoopbackTransport {
+    public:
+        // State shared by the ranks of one cluster.
+        struct Hub {
+            explicit Hub(int nodes) : mail(nodes, std::vector<std::vector<char>>(nodes)), arrived(0), round(0) { }
+
+            std::vector<std::vector<std::vector<char>>> mail;  // mail[to][from].
+            int arrived;                                       // Ranks at the barrier.
+            unsigned long long round;                          // Barriers completed.
+            std::mutex mutex;
+            std::condition_variable released;
+        };
+
+        LoopbackTransport(Hub& sharedHub, int selfRank) : hub(sharedHub), self(selfRank) { }
+
+        int rank() const { return self; }
+        int size() const { return static_cast<int>(hub.mail.size()); }
+
+        // Same contract as TcpTransport::exchange().
+        std::vector<std::vector<char>> exchange(const std::vector<std::vector<char>>& outgoing) {
+            std::unique_lock<std::mutex> lock(hub.mutex);
+            for (int peer = 0; peer < size(); ++peer) hub.mail[peer][self] = outgoing[peer];
+            wait(lock);
+            std::vector<std::vector<char>> incoming(size());
+            incoming.swap(hub.mail[self]);
+            wait(lock);
+            return incoming;
+        }
+
+    private:
+        // Blocks until every rank has reached the same barrier.
+        void wait(std::unique_lock<std::mutex>& lock) {
+            unsigned long long entered = hub.round;
+            if (++hub.arrived == size()) {
+                hub.arrived = 0;
+                ++hub.round;
+                hub.released.notify_all();
+            } else {
+                hub.released.wait(lock, [&] { return hub.round != entered; });
+            }
+        }
+
+        Hub& hub;
+        int self;
+    };
+
+    // ------------------------------------------------------------
+    // Method: checkDistributed
+    // ------------------------------------------------------------
+    // Role:
+    //   Deals random keys to 1 to 4 loopback ranks (unevenly, some
+    //   empty), runs DistributedSorter on each rank's thread, and
+    //   checks that the slices concatenated in rank order equal
+    //   the distinct keys sorted in memory.
+    // ------------------------------------------------------------
+    void checkDistributed(unsigned iteration) {
+        std::mt19937_64 rng = rngFor(iteration, 4);
+        int nodes = 1 + static_cast<int>(iteration % 4);
+        std::vector<uint64_t> keys = randomKeys<uint64_t>(rng, iteration);
+        std::vector<std::vector<uint64_t>> shares(nodes);
+        for (uint64_t key : keys) shares[rng() % (rng() % 3 ? nodes : 1)].push_back(key);
+
+        LoopbackTransport::Hub hub(nodes);
+        std::vector<std::vector<uint64_t>> slices(nodes);
+        std::vector<std::thread> ranks;
+        for (int r = 0; r < nodes; ++r) {
+            ranks.emplace_back([&, r] {
+                LoopbackTransport net(hub, r);
+                DistributedSorter<uint64_t, LoopbackTransport> sorter(net);
+                slices[r] = sorter.sort(std::span<const uint64_t>(shares[r]));
+            });
+        }
+        for (std::thread& rank : ranks) rank.join();
+
+        std::vector<uint64_t> gathered;
+        for (const std::vector<uint64_t>& slice : slices) gathered.insert(gathered.end(), slice.begin(), slice.end());
+        expect(gathered == sortedDistinct(keys), std::to_string(nodes) + " ranks, " + std::to_string(keys.size()) +
+               " keys", iteration);
+    }
+
+    // ------------------------------------------------------------
+    // Method: checkArgsort
+    // ------------------------------------------------------------
+    // Role:
+    //   Compares argsort() with 32- and 64-bit indices and every
+    //   forced strategy against a stable index sort (first index of
+    //   each key unless counting), then applies the permutation to
+    //   a copy of the records with applyPermutation().
+    // ------------------------------------------------------------
+    template <typename Key>
+    void checkArgsort(unsigned iteration) {
+        std::mt19937_64 rng = rngFor(iteration, 14);
+        std::vector<Key> keys = randomKeys<Key>(rng, iteration);
+        std::vector<uint32_t> all(keys.size());
+        for (size_t i = 0; i < all.size(); ++i) all[i] = static_cast<uint32_t>(i);
+        std::stable_sort(all.begin(), all.end(), [&](uint32_t a, uint32_t b) { return keys[a] < keys[b]; });
+        std::vector<uint32_t> distinct = all;
+        distinct.erase(std::unique(distinct.begin(), distinct.end(),
+                                   [&](uint32_t a, uint32_t b) { return keys[a] == keys[b]; }),
+                       distinct.end());
+        std::string type = std::to_string(8 * sizeof(Key)) + "-bit ";
+
+        for (SortPlanner::Strategy strategy : { SortPlanner::Strategy::Auto, SortPlanner::Strategy::Bitmap,
+                                                SortPlanner::Strategy::Radix, SortPlanner::Strategy::Comparison }) {
+            for (bool counting : { false, true }) {
+                const std::vector<uint32_t>& expected = counting ? all : distinct;
+                BigSorter<Key> sorter(keys);
+                sorter.setStrategy(strategy);
+                sorter.setCountDuplicates(counting);
+                std::vector<uint32_t> order = sorter.argsort();
+                std::vector<uint64_t> wide = sorter.template argsort<uint64_t>();
+                std::string what = type + SortPlanner::strategyName(strategy) + (counting ? " counting" : "");
+                expect(order == expected && std::equal(wide.begin(), wide.end(), expected.begin(), expected.end()),
+                       what, iteration);
+
+                std::vector<Key> gathered = keys;
+                applyPermutation(gathered, std::span<const uint32_t>(order));
+                bool same = gathered.size() == expected.size();
+                for (size_t i = 0; same && i < expected.size(); ++i) same = gathered[i] == keys[expected[i]];
+                expect(same, what + " applyPermutation", iteration);
+            }
+        }
+    }
+    static constexpr unsigned long long kMaxReported = 20;
+
+    uint64_t baseSeed;               // --seed.
+    unsigned rounds;                 // Iterations per section (--iterations).
+    std::string tempDir;             // Directory for scratch files (--tmp).
+    unsigned long long checks;       // Checks run so far.
+    unsigned long long failures;     // Checks failed so far.
+    const char* currentSection;      // Section being run, for reports.
+    SortWorkspace workspace;         // Reused across bigSort() checks.
 };
 
 // ============================================================
@@ -173,52 +7270,278 @@ private:
 //       3. Displays the original unsorted array.
 //       4. Instantiates BigSorter to sort the array and measure sorting time.
 //       5. Displays the sorted array and timing details.
+//
+//       With "--external IN OUT [--mem SIZE] [--tmp DIR]" it instead
+//       sorts a file of uint64 keys out of core with ExternalSorter,
+//       with "--mmap IN OUT [--width 32|64]" it sorts a binary key
+//       file between two memory mappings, with "--text IN OUT" it
+//       sorts decimal text the same way (sortTextFile), with
+//       "--distributed HOSTFILE RANK IN OUT" (or "--mpi IN OUT" in
+//       BIGSORT_WITH_MPI builds) it runs one node of a
+//       DistributedSorter, and with "--pipeline SIZE MAX" it
+//       overlaps generation and sorting (PipelinedSortDriver).
+//       "--self-test [--seed S] [--iterations N] [--tmp DIR]" checks
+//       the build against the standard library (SelfTest).
+//       Any other flags select the non-interactive BatchCommand.
+//
+//       Defining BIGSORT_NO_MAIN before including this file leaves
+//       main() out, so other programs (bigsort_bench.cpp) can reuse
+//       the sorters.
 // ------------------------------------------------------------
-int main() {
-    int size;
+#ifndef BIGSORT_NO_MAIN
+int main(int argc, char** argv) {
+    if (argc > 1 && std::string(argv[1]) == "--external") {
+        if (argc < 4) {
+            std::cerr << "Usage: " << argv[0] << " --external IN OUT [--mem SIZE] [--tmp DIR]\n";
+            return 1;
+        }
+        size_t memoryBytes = size_t(1) << 30;
+        std::string tempDir = ".";
+        for (int i = 4; i + 1 < argc; i += 2) {
+            std::string flag = argv[i];
+            if (flag == "--mem") {
+                memoryBytes = ExternalSorter::parseByteSize(argv[i + 1]);
+                if (!memoryBytes) {
+                    std::cerr << "Error: invalid --mem value " << argv[i + 1] << ".\n";
+                    return 1;
+                }
+            } else if (flag == "--tmp") {
+                tempDir = argv[i + 1];
+            } else {
+                std::cerr << "Error: unknown option " << flag << ".\n";
+                return 1;
+            }
+        }
+        auto startTime = std::chrono::steady_clock::now();
+        ExternalSorter sorter(memoryBytes, tempDir);
+        unsigned long long written = sorter.sortFile(argv[2], argv[3]);
+        auto endTime = std::chrono::steady_clock::now();
+        std::cout << "Sorted keys written: " << written << "\n";
+        std::cout << "Time taken to sort: "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime).count()
+                  << " milliseconds\n";
+        return 0;
+    }
+
+    if (argc > 1 && std::string(argv[1]) == "--mmap") {
+        if (argc != 4 && !(argc == 6 && std::string(argv[4]) == "--width")) {
+            std::cerr << "Usage: " << argv[0] << " --mmap IN OUT [--width 32|64]\n";
+            return 1;
+        }
+        std::string width = argc == 6 ? argv[5] : "64";
+        if (width != "32" && width != "64") {
+            std::cerr << "Error: --width must be 32 or 64.\n";
+            return 1;
+        }
+        auto startTime = std::chrono::steady_clock::now();
+        size_t written = width == "32" ? sortMappedFile<uint32_t>(argv[2], argv[3])
+                                       : sortMappedFile<uint64_t>(argv[2], argv[3]);
+        auto endTime = std::chrono::steady_clock::now();
+        std::cout << "Sorted keys written: " << written << "\n";
+        std::cout << "Time taken to sort: "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime).count()
+                  << " milliseconds\n";
+        return 0;
+    }
+
+    if (argc > 1 && std::string(argv[1]) == "--text") {
+        std::string width = "64";
+        unsigned threads = 0;
+        bool valid = argc >= 4 && argc % 2 == 0;
+        for (int i = 4; valid && i + 1 < argc; i += 2) {
+            std::string flag = argv[i];
+            if (flag == "--width") {
+                width = argv[i + 1];
+            } else if (flag == "--threads") {
+                threads = static_cast<unsigned>(std::strtoul(argv[i + 1], nullptr, 10));
+            } else {
+                valid = false;
+            }
+        }
+        if (!valid || (width != "32" && width != "64")) {
+            std::cerr << "Usage: " << argv[0] << " --text IN OUT [--width 32|64] [--threads T]\n";
+            return 1;
+        }
+        auto startTime = std::chrono::steady_clock::now();
+        size_t written = width == "32" ? sortTextFile<int32_t>(argv[2], argv[3], threads)
+                                       : sortTextFile<int64_t>(argv[2], argv[3], threads);
+        auto endTime = std::chrono::steady_clock::now();
+        std::cout << "Sorted keys written: " << written << "\n";
+        std::cout << "Time taken to sort: "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime).count()
+                  << " milliseconds\n";
+        return 0;
+    }
+
+    if (argc > 1 && std::string(argv[1]) == "--distributed") {
+        if (argc != 6) {
+            std::cerr << "Usage: " << argv[0] << " --distributed HOSTFILE RANK IN OUT\n";
+            return 1;
+        }
+        TcpTransport network(argv[2], std::atoi(argv[3]));
+        auto startTime = std::chrono::steady_clock::now();
+        size_t written = sortDistributedFile(network, argv[4], argv[5]);
+        auto endTime = std::chrono::steady_clock::now();
+        std::cout << "Rank " << network.rank() << " of " << network.size()
+                  << ": sorted keys written: " << written << "\n";
+        std::cout << "Time taken to sort: "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime).count()
+                  << " milliseconds\n";
+        return 0;
+    }
+
+#ifdef BIGSORT_WITH_MPI
+    if (argc > 1 && std::string(argv[1]) == "--mpi") {
+        if (argc != 4) {
+            std::cerr << "Usage: mpirun " << argv[0] << " --mpi IN OUT\n";
+            return 1;
+        }
+        MPI_Init(&argc, &argv);
+        size_t written = 0;
+        {
+            MpiTransport network;
+            written = sortDistributedFile(network, argv[2], argv[3]);
+            std::cout << "Rank " << network.rank() << " of " << network.size()
+                      << ": sorted keys written: " << written << "\n";
+        }
+        MPI_Finalize();
+        return 0;
+    }
+#endif // BIGSORT_WITH_MPI
+
+    if (argc > 1 && std::string(argv[1]) == "--self-test") {
+        uint64_t seed = 1;
+        unsigned iterations = 20;
+        std::string tempDir = ".";
+        for (int i = 2; i < argc; ++i) {
+            std::string flag = argv[i];
+            if (flag == "--seed" && i + 1 < argc) {
+                seed = std::strtoull(argv[++i], nullptr, 10);
+            } else if (flag == "--iterations" && i + 1 < argc) {
+                iterations = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+            } else if (flag == "--tmp" && i + 1 < argc) {
+                tempDir = argv[++i];
+            } else {
+                std::cerr << "Usage: " << argv[0] << " --self-test [--seed S] [--iterations N] [--tmp DIR]\n";
+                return 1;
+            }
+        }
+        SelfTest test(seed, iterations, tempDir);
+        return test.run();
+    }
+
+    if (argc > 1 && std::string(argv[1]) == "--pipeline") {
+        if (argc < 4) {
+            std::cerr << "Usage: " << argv[0] << " --pipeline SIZE MAX [--seed S] [--threads N] [--print]\n";
+            return 1;
+        }
+        size_t size = std::strtoull(argv[2], nullptr, 10);
+        long long max = std::strtoll(argv[3], nullptr, 10);
+        uint64_t seed = 0;
+        unsigned producers = 0;
+        bool print = false;
+        for (int i = 4; i < argc; ++i) {
+            std::string flag = argv[i];
+            if (flag == "--seed" && i + 1 < argc) {
+                seed = std::strtoull(argv[++i], nullptr, 10);
+            } else if (flag == "--threads" && i + 1 < argc) {
+                producers = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+            } else if (flag == "--print") {
+                print = true;
+            } else {
+                std::cerr << "Error: unknown option " << flag << ".\n";
+                return 1;
+            }
+        }
+        if (max < 1 || size > static_cast<unsigned long long>(max)) {
+            std::cerr << "Error: Array size (" << size
+                      << ") is greater than the number of unique values in the range [1, " << max << "].\n";
+            return 1;
+        }
+
+        std::cout << std::flush;
+        IntegerWriter writer(stdout);
+        if (print) writer.writeText("Original Array: ");
+        auto startTime = std::chrono::steady_clock::now();
+        PipelinedSortDriver<int64_t> driver(PipelinedSortDriver<int64_t>::kChunkElements,
+                                            PipelinedSortDriver<int64_t>::kRingDepth, producers);
+        std::vector<int64_t> sorted = driver.run(size, 1, max, RandomArrayGenerator::Distribution::Sparse,
+                                                 seed, print ? &writer : nullptr);
+        auto endTime = std::chrono::steady_clock::now();
+        if (print) {
+            writer.writeText("\nCompact Sorted Array: ");
+            writer.writeAll(std::span<const int64_t>(sorted));
+            writer.writeText("\n");
+        }
+        if (!writer.flush()) {
+            std::cerr << "Error: failed writing the arrays to stdout.\n";
+            return 1;
+        }
+        std::cout << "Sorted array size: " << sorted.size() << "\n";
+        std::cout << "Time taken to generate and sort: "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime).count()
+                  << " milliseconds (producer " << driver.getProducerNs() / 1000000
+                  << " ms, consumer " << driver.getConsumerNs() / 1000000 << " ms)\n";
+        return 0;
+    }
+
+    if (argc > 1) {
+        BatchCommand command(BatchCommand::parse(argc, argv));
+        return command.run();
+    }
+
+    size_t size = 0;
     std::cout << "Enter array size: ";
     std::cin >> size;
 
-    int max;
+    int64_t max = 0;
     std::cout << "Enter max element value: ";
     std::cin >> max;
 
     // Validate that the array size does not exceed the range of unique values.
-    if (size > max) {
+    if (!std::cin || max < 1 || size > static_cast<uint64_t>(max)) {
         std::cerr << "Error: Array size (" << size 
                   << ") is greater than the number of unique values in the range [1, " << max << "].\n";
         return 1;
     }
 
     // Step 1 & 2: Generate the original unsorted array with unique random values.
-    std::vector<int> arr = RandomArrayGenerator::generateUniqueRandomArray(size, 1, max);
+    std::vector<int64_t> arr = RandomArrayGenerator::generateUniqueRandomArray<int64_t>(size, 1, max);
 
     // Step 3: Print the original unsorted array.
-    std::cout << "Original Array: ";
-    for (int value : arr) {
-        std::cout << value << " ";
-    }
-    std::cout << "\n";
+    std::cout << std::flush;
+    IntegerWriter writer(stdout);
+    writer.writeText("Original Array: ");
+    writer.writeAll(std::span<const int64_t>(arr));
+    writer.writeText("\n");
+    writer.flush();
 
     // Step 4: Create an instance of BigSorter to perform the sort.
     BigSorter sorter(arr);
+    sorter.setThreadCount(0); // Use every hardware thread for large inputs.
     sorter.sort();
 
     // Retrieve the sorted array.
-    const std::vector<int>& sorted = sorter.getSortedArray();
+    const std::vector<int64_t>& sorted = sorter.getSortedArray();
 
     // Step 5: Display the sorted array.
-    std::cout << "Compact Sorted Array: ";
-    for (int value : sorted) {
-        std::cout << value << " ";
+    writer.writeText("Compact Sorted Array: ");
+    writer.writeAll(std::span<const int64_t>(sorted));
+    writer.writeText("\n");
+    if (!writer.flush()) {
+        std::cerr << "Error: failed writing the arrays to stdout.\n";
+        return 1;
     }
-    std::cout << "\n";
 
     // Display additional performance details.
     std::cout << "Original array size: " << sorter.getOriginalArraySize() << "\n";
     std::cout << "Exists array size: " << sorter.getExistsArraySize() << "\n";
     std::cout << "Sorted array size: " << sorted.size() << "\n";
     std::cout << "Time taken to sort: " << sorter.getSortDurationMs() << " milliseconds\n";
+    std::cout << "Bitmap kernel: " << BitmapKernels::levelName(BitmapKernels::active()) << "\n";
+    std::cout << "Strategy: " << SortPlanner::strategyName(sorter.getStrategy())
+              << " (estimated " << sorter.getCostEstimateNs() << " ns)\n";
 
     return 0;
 }
+#endif // BIGSORT_NO_MAIN
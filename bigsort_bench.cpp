@@ -0,0 +1,237 @@
+// ============================================================
+// File: bigsort_bench.cpp
+// ------------------------------------------------------------
+// Role: Google Benchmark suite for BigSort. Sweeps the input size
+//       n, the key span to size ratio k/n and the input
+//       distribution, and runs every BigSorter strategy, the
+//       zero-copy bigSort() and the std::sort / std::stable_sort
+//       baselines on the same uint32 keys.
+//
+// Build:
+//   g++ -std=c++20 -O3 -march=native -pthread bigsort_bench.cpp -lbenchmark -o bigsort_bench
+//
+// Run:
+//   ./bigsort_bench [--max_n=N] [--benchmark_filter=REGEX] ...
+//   --max_n caps the sweep (default 2^30); every standard Google
+//   Benchmark flag is accepted as well.
+//
+// Reported counters:
+//   - time/elem:  Wall time per input element.
+//   - bytes/elem: Bytes one cold sort allocates, per element
+//                 (bitmap, counters, scratch and output): operator
+//                 new plus BitmapBuffer's calloc/mmap allocations.
+//   - bytes_per_second: Input bytes sorted per second (GB/s).
+//
+// The std baselines sort in place, so each iteration includes a
+// copy of the input into their buffer, the same read and write of
+// n keys bigSort() pays to fill its output.
+// ============================================================
+#define BIGSORT_NO_MAIN
+#include "bigsort.cpp"
+
+#include <benchmark/benchmark.h>
+#include <atomic>
+#include <new>
+
+// ============================================================
+// Allocation accounting
+// ------------------------------------------------------------
+// Role: Global operator new/delete replacements that count the
+//       bytes requested, for the bytes/elem counter. Bitmap words
+//       come from calloc or mmap instead, and are counted by
+//       BitmapBuffer::allocatedBytes().
+// ============================================================
+static std::atomic<size_t> allocatedBytes{0};
+
+// GCC pairs the malloc() below with the delete overloads and warns.
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void* operator new(size_t bytes) {
+    allocatedBytes.fetch_add(bytes, std::memory_order_relaxed);
+    if (void* p = std::malloc(bytes ? bytes : 1)) return p;
+    throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+namespace {
+
+using Key = uint32_t;
+using Distribution = RandomArrayGenerator::Distribution;
+
+const char* distributionName(Distribution distribution) {
+    switch (distribution) {
+        case Distribution::Dense: return "dense";
+        case Distribution::Sparse: return "sparse";
+        case Distribution::Clustered: return "clustered";
+        case Distribution::Zipf: return "zipf";
+    }
+    return "?";
+}
+
+// ------------------------------------------------------------
+// Function: makeInput
+// ------------------------------------------------------------
+// Role:
+//   Builds the benchmark input for one (n, k/n, distribution)
+//   point. The span is clipped to the 32-bit key range; Dense
+//   ignores the ratio (its span is n).
+// ------------------------------------------------------------
+std::vector<Key> makeInput(size_t n, uint64_t ratio, Distribution distribution) {
+    uint64_t span = std::min<uint64_t>(static_cast<uint64_t>(n) * ratio, uint64_t(1) << 32);
+    return RandomArrayGenerator::generate<Key>(n, 0, static_cast<Key>(span - 1), distribution, 0xb165047);
+}
+
+// Sets the counters shared by every benchmark.
+void reportCounters(benchmark::State& state, size_t n, size_t coldBytes) {
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * n));
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * n * sizeof(Key)));
+    state.counters["time/elem"] = benchmark::Counter(static_cast<double>(n),
+        benchmark::Counter::kIsIterationInvariantRate | benchmark::Counter::kInvert);
+    state.counters["bytes/elem"] = static_cast<double>(coldBytes) / static_cast<double>(n);
+}
+
+// Bytes allocated while running work() once, bitmaps included.
+template <typename Work>
+size_t measureAllocation(Work work) {
+    size_t before = allocatedBytes.load(std::memory_order_relaxed) + BitmapBuffer::allocatedBytes();
+    work();
+    return allocatedBytes.load(std::memory_order_relaxed) + BitmapBuffer::allocatedBytes() - before;
+}
+
+// ------------------------------------------------------------
+// Benchmark: BigSorter with a fixed strategy (Auto plans per input)
+// ------------------------------------------------------------
+void benchBigSorter(benchmark::State& state, SortPlanner::Strategy strategy, size_t n, uint64_t ratio,
+                    Distribution distribution) {
+    std::vector<Key> input = makeInput(n, ratio, distribution);
+    size_t coldBytes = 0;
+    {
+        BigSorter<Key> cold(input);
+        cold.setStrategy(strategy);
+        coldBytes = measureAllocation([&] { cold.sort(); });
+    }
+    BigSorter<Key> sorter(input);
+    sorter.setStrategy(strategy);
+    for (auto _ : state) {
+        sorter.sort();
+        benchmark::DoNotOptimize(sorter.getSortedArray().data());
+        benchmark::ClobberMemory();
+    }
+    state.SetLabel(SortPlanner::strategyName(sorter.getStrategy()));
+    reportCounters(state, n, coldBytes);
+}
+
+// ------------------------------------------------------------
+// Benchmark: zero-copy bigSort() with a reused SortWorkspace
+// ------------------------------------------------------------
+void benchBigSortSpan(benchmark::State& state, size_t n, uint64_t ratio, Distribution distribution) {
+    std::vector<Key> input = makeInput(n, ratio, distribution);
+    std::vector<Key> output(n);
+    size_t coldBytes = measureAllocation([&] {
+        SortWorkspace cold;
+        bigSort(std::span<const Key>(input), std::span<Key>(output), cold);
+    });
+    SortWorkspace workspace;
+    for (auto _ : state) {
+        size_t distinct = bigSort(std::span<const Key>(input), std::span<Key>(output), workspace);
+        benchmark::DoNotOptimize(distinct);
+        benchmark::ClobberMemory();
+    }
+    reportCounters(state, n, coldBytes);
+}
+
+// ------------------------------------------------------------
+// Benchmark: std::sort / std::stable_sort baselines
+// ------------------------------------------------------------
+template <bool Stable>
+void benchStdSort(benchmark::State& state, size_t n, uint64_t ratio, Distribution distribution) {
+    std::vector<Key> input = makeInput(n, ratio, distribution);
+    std::vector<Key> buffer(n);
+    auto run = [&] {
+        std::copy(input.begin(), input.end(), buffer.begin());
+        if constexpr (Stable) {
+            std::stable_sort(buffer.begin(), buffer.end());
+        } else {
+            std::sort(buffer.begin(), buffer.end());
+        }
+    };
+    size_t coldBytes = measureAllocation(run);
+    for (auto _ : state) {
+        run();
+        benchmark::DoNotOptimize(buffer.data());
+        benchmark::ClobberMemory();
+    }
+    reportCounters(state, n, coldBytes);
+}
+
+// ------------------------------------------------------------
+// Function: registerSweep
+// ------------------------------------------------------------
+// Role:
+//   Registers every benchmark over n = 1K, 8K, ... below maxN
+//   and then maxN itself (so the default sweep ends at 1B = 2^30),
+//   k/n in {1, 16, 1024} and the four distributions (Dense only
+//   at k/n = 1, since its span is always n).
+// ------------------------------------------------------------
+void registerSweep(size_t maxN) {
+    const std::pair<const char*, SortPlanner::Strategy> strategies[] = {
+        { "BigSorter/auto", SortPlanner::Strategy::Auto },
+        { "BigSorter/bitmap", SortPlanner::Strategy::Bitmap },
+        { "BigSorter/radix", SortPlanner::Strategy::Radix },
+        { "BigSorter/comparison", SortPlanner::Strategy::Comparison },
+        { "BigSorter/chunked", SortPlanner::Strategy::Chunked },
+    };
+    std::vector<size_t> sizes;
+    for (size_t n = size_t(1) << 10; n < maxN; n *= 8) sizes.push_back(n);
+    if (maxN) sizes.push_back(maxN);
+    for (size_t n : sizes) {
+        for (uint64_t ratio : { 1, 16, 1024 }) {
+            for (Distribution distribution : { Distribution::Dense, Distribution::Sparse,
+                                               Distribution::Clustered, Distribution::Zipf }) {
+                if (distribution == Distribution::Dense && ratio != 1) continue;
+                std::string point = "/n:" + std::to_string(n) + "/k_n:" + std::to_string(ratio) + "/" +
+                                    distributionName(distribution);
+                for (const auto& [name, strategy] : strategies) {
+                    benchmark::RegisterBenchmark((name + point).c_str(), benchBigSorter, strategy, n, ratio,
+                                                 distribution)->Unit(benchmark::kMillisecond);
+                }
+                benchmark::RegisterBenchmark(("bigSort/span" + point).c_str(), benchBigSortSpan, n, ratio,
+                                             distribution)->Unit(benchmark::kMillisecond);
+                benchmark::RegisterBenchmark(("std::sort" + point).c_str(), benchStdSort<false>, n, ratio,
+                                             distribution)->Unit(benchmark::kMillisecond);
+                benchmark::RegisterBenchmark(("std::stable_sort" + point).c_str(), benchStdSort<true>, n,
+                                             ratio, distribution)->Unit(benchmark::kMillisecond);
+            }
+        }
+    }
+}
+
+} // namespace
+
+// ============================================================
+// Function: main
+// ------------------------------------------------------------
+// Role: Strips --max_n, registers the sweep, then hands the
+//       remaining flags to Google Benchmark.
+// ============================================================
+int main(int argc, char** argv) {
+    size_t maxN = size_t(1) << 30;
+    int kept = 1;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--max_n=", 0) == 0) {
+            maxN = std::strtoull(arg.c_str() + 8, nullptr, 10);
+        } else {
+            argv[kept++] = argv[i];
+        }
+    }
+    argc = kept;
+
+    registerSweep(maxN);
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}